@@ -149,6 +149,10 @@
  * If disabled, horizontal scroll events are discarded */
 #define LIBINPUT_PROP_HORIZ_SCROLL_ENABLED "libinput Horizontal Scroll Enabled"
 
+/* Raw motion: BOOL, 1 value (0 or 1). If enabled, relative motion is
+ * posted as the unaccelerated deltas in whole device units */
+#define LIBINPUT_PROP_RAW_MOTION "libinput Raw Motion"
+
 /* Number of modes each pad mode group has available: CARD8, one for each
  * pad mode group, read-only.
  */
@@ -193,4 +197,50 @@
 /* Tablet tool area ratio: CARD32, 2 values, w and h */
 #define LIBINPUT_PROP_TABLET_TOOL_AREA_RATIO "libinput Tablet Tool Area Ratio"
 
+/* Tablet tool axis rate: CARD32, 1 value, the maximum number of motion
+ * events per second, 0 for unlimited */
+#define LIBINPUT_PROP_TABLET_TOOL_AXIS_RATE "libinput Tablet Tool Axis Rate"
+
+/* Tablet tool prediction: CARD32, 1 value, how far ahead the position is
+ * predicted in ms, 0 for disabled. Up to 50 */
+#define LIBINPUT_PROP_TABLET_TOOL_PREDICTION "libinput Tablet Tool Prediction"
+
+/* Event latency: CARD32, 27 values, read-only. Only available if the
+ * driver was built with --enable-latency-stats.
+ * Values are the number of events, the event rate in events/s over the
+ * last full second and the peak rate, followed by 24 histogram buckets
+ * of the time between the event timestamp and the event being posted.
+ * Bucket 0 is for 0us, bucket n is for [2^(n-1), 2^n) us, the last
+ * bucket also counts anything slower.
+ */
+#define LIBINPUT_PROP_EVENT_LATENCY_HISTOGRAM "libinput Event Latency Histogram"
+
+/* Event counters: CARD32, 62 values. Writing any value resets them.
+ *   0: events discarded while the device was disabled
+ *   1: events no device was found for
+ *   2: tablet tool events queued until the tool's device was available
+ *   3: tablet tool events dropped from that queue
+ *   4: absolute motion events discarded on a relative device
+ *   5: tablet tool axis events merged into a newer one by the axis rate
+ *      limit
+ *   6 + n: events of libinput_event_type t handled by this device, with
+ *      n = (t/100 - 3) * 8 + t % 100
+ * 1 to 3 are counted for all devices of the same kernel device.
+ */
+#define LIBINPUT_PROP_EVENT_COUNTERS "libinput Event Counters"
+
+/* Log priority: BOOL, 3 values, debug, info, error. Only one may be set.
+ * The priority is shared by all libinput devices */
+#define LIBINPUT_PROP_LOG_PRIORITY "libinput Log Priority"
+
+/* Axis labels of the gesture valuators, only present if the
+ * GesturePassthrough option is enabled. All are relative: the swipe
+ * deltas, the pinch scale delta and the pinch rotation delta in degrees
+ * clockwise.
+ */
+#define LIBINPUT_AXIS_LABEL_GESTURE_SWIPE_X "libinput Gesture Swipe X"
+#define LIBINPUT_AXIS_LABEL_GESTURE_SWIPE_Y "libinput Gesture Swipe Y"
+#define LIBINPUT_AXIS_LABEL_GESTURE_PINCH_SCALE "libinput Gesture Pinch Scale"
+#define LIBINPUT_AXIS_LABEL_GESTURE_PINCH_ROTATION "libinput Gesture Pinch Rotation"
+
 #endif /* _LIBINPUT_PROPERTIES_H_ */
@@ -27,7 +27,9 @@
 
 #include <assert.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "bezier.h"
 
@@ -38,6 +40,9 @@ const struct bezier_control_point bezier_defaults[4] = {
 	{ 1.0, 1.0 },
 };
 
+#define BEZIER_SEGMENTS 50
+#define BEZIER_CHUNK 64
+
 struct point {
 	int x, y;
 };
@@ -50,21 +55,20 @@ struct point {
  * http://cubic-bezier.com/
  */
 static struct point
-decasteljau(const struct point *controls,
-	    size_t ncontrols,
-	    double t)
+decasteljau(const struct point controls[4], double t)
 {
-	struct point new_controls[ncontrols];
+	struct point p[4];
 
-	if (ncontrols == 1)
-		return controls[0];
+	memcpy(p, controls, sizeof(p));
 
-	for (int i = 0; i < ncontrols - 1; i++) {
-		new_controls[i].x = (1.0 - t) * controls[i].x + t * controls[i + 1].x;
-		new_controls[i].y = (1.0 - t) * controls[i].y + t * controls[i + 1].y;
+	for (int n = 3; n > 0; n--) {
+		for (int i = 0; i < n; i++) {
+			p[i].x = (1.0 - t) * p[i].x + t * p[i + 1].x;
+			p[i].y = (1.0 - t) * p[i].y + t * p[i + 1].y;
+		}
 	}
 
-	return decasteljau(new_controls, ncontrols - 1, t);
+	return p[0];
 }
 
 /**
@@ -72,8 +76,7 @@ decasteljau(const struct point *controls,
  * one with ncurve_points.
  */
 static void
-flatten_curve(const struct point *controls,
-	      size_t ncontrols,
+flatten_curve(const struct point controls[4],
 	      struct point *curve,
 	      size_t ncurve_points)
 {
@@ -81,10 +84,8 @@ flatten_curve(const struct point *controls,
 
 	for (int i = 0; i <= ncurve_points; i++) {
 		double t = 1.0 * i/ncurve_points;
-		struct point p;
 
-		p = decasteljau(controls, ncontrols, t);
-		curve[i] = p;
+		curve[i] = decasteljau(controls, t);
 	}
 }
 
@@ -92,11 +93,11 @@ flatten_curve(const struct point *controls,
  * Calculate line through a and b, set curve[x] for each x between
  * [a.x,  b.x].
  *
- * Note: pcurve must be at least b.x size.
+ * Note: curve must be at least b.x size.
  */
 static void
 line_between(struct point a, struct point b,
-	     struct point *curve, size_t curve_sz)
+	     int *curve, size_t curve_sz)
 {
 	double slope;
 	double offset;
@@ -104,44 +105,55 @@ line_between(struct point a, struct point b,
 	assert(b.x < curve_sz);
 
 	if (a.x == b.x) {
-		curve[a.x].x = a.x;
-		curve[a.x].y = a.y;
+		curve[a.x] = a.y;
 		return;
 	}
 
 	slope = (double)(b.y - a.y)/(b.x - a.x);
 	offset = a.y - slope * a.x;
 
-	for (int x = a.x; x <= b.x; x++) {
-		struct point p;
-		p.x = x;
-		p.y = slope * x + offset;
-		curve[x] = p;
+	for (int x = a.x; x <= b.x; x++)
+		curve[x] = slope * x + offset;
+}
+
+static bool
+scale_controls(const struct bezier_control_point controls[4],
+	       double range,
+	       struct bezier_control_point ctrls[4])
+{
+	for (int i = 0; i < 4; i++) {
+		if (controls[i].x < 0.0 || controls[i].x > 1.0 ||
+		    controls[i].y < 0.0 || controls[i].y > 1.0)
+			return false;
+
+		ctrls[i].x = controls[i].x * range;
+		ctrls[i].y = controls[i].y * range;
 	}
+
+	return true;
 }
 
 bool
 cubic_bezier(const struct bezier_control_point controls[4],
-	     int *bezier_out,
+	     int *bezier,
 	     size_t bezier_sz)
 {
-	const int nsegments = 50;
+	const int nsegments = BEZIER_SEGMENTS;
 	const int range = bezier_sz - 1;
-	struct point curve[nsegments];
-	struct point bezier[bezier_sz];
+	struct point curve[BEZIER_SEGMENTS];
 	struct point zero = { 0, 0 },
 		     max = { range, range};
+	struct bezier_control_point scaled[4];
 
 	/* Scale control points into the [0, bezier_sz) range */
 	struct point ctrls[4];
 
-	for (int i = 0; i < 4; i++) {
-		if (controls[i].x < 0.0 || controls[i].x > 1.0 ||
-		    controls[i].y < 0.0 || controls[i].y > 1.0)
-			return false;
+	if (!scale_controls(controls, range, scaled))
+		return false;
 
-		ctrls[i].x = controls[i].x * range;
-		ctrls[i].y = controls[i].y * range;
+	for (int i = 0; i < 4; i++) {
+		ctrls[i].x = scaled[i].x;
+		ctrls[i].y = scaled[i].y;
 	}
 
 	for (int i = 0; i < 3; i++) {
@@ -150,7 +162,7 @@ cubic_bezier(const struct bezier_control_point controls[4],
 	}
 
 	/* Reduce curve to nsegments, because this isn't a drawing program */
-	flatten_curve(ctrls, 4, curve, nsegments);
+	flatten_curve(ctrls, curve, nsegments);
 
 	/* we now have nsegments points in curve that represent the bezier
 	   curve (already in the [0, bezier_sz) range). Run through the
@@ -170,8 +182,136 @@ cubic_bezier(const struct bezier_control_point controls[4],
 	if (curve[nsegments - 1].x < max.x)
 		line_between(curve[nsegments - 1], max, bezier, bezier_sz);
 
-	for (int i = 0; i < bezier_sz; i++)
-		bezier_out[i] = bezier[i].y;
+	return true;
+}
+
+/**
+ * Evaluate the curve at each t[i] with the Bernstein form of the cubic
+ * Bézier curve. No iteration depends on another, so this loop is
+ * vectorized by the compiler.
+ */
+static void
+bezier_evaluate(const struct bezier_control_point c[4],
+		const double *t,
+		size_t n,
+		double *x,
+		double *y)
+{
+	for (size_t i = 0; i < n; i++) {
+		double u = 1.0 - t[i];
+		double b0 = u * u * u;
+		double b1 = 3.0 * u * u * t[i];
+		double b2 = 3.0 * u * t[i] * t[i];
+		double b3 = t[i] * t[i] * t[i];
+
+		x[i] = b0 * c[0].x + b1 * c[1].x + b2 * c[2].x + b3 * c[3].x;
+		y[i] = b0 * c[0].y + b1 * c[1].y + b2 * c[2].y + b3 * c[3].y;
+	}
+}
+
+/**
+ * Set curve[x] for each integer x in (a.x, b.x] to the fixed-point y
+ * value on the line through a and b. If a and b have the same x, b wins.
+ */
+static void
+fixed_line_between(struct bezier_control_point a,
+		   struct bezier_control_point b,
+		   int *curve, size_t curve_sz)
+{
+	const double scale = 1 << BEZIER_FRAC_BITS;
+	double slope;
+	int x, xmax;
+
+	xmax = floor(b.x);
+	if (xmax > (int)curve_sz - 1)
+		xmax = curve_sz - 1;
+
+	if (b.x - a.x < 1e-9) {
+		if (xmax >= 0 && xmax == b.x)
+			curve[xmax] = lround(b.y * scale);
+		return;
+	}
+
+	slope = (b.y - a.y)/(b.x - a.x);
+
+	for (x = floor(a.x) + 1; x <= xmax; x++)
+		curve[x] = lround((a.y + slope * (x - a.x)) * scale);
+}
+
+bool
+cubic_bezier_fixed(const struct bezier_control_point controls[4],
+		   size_t nsegments,
+		   int *bezier,
+		   size_t bezier_sz)
+{
+	const double range = bezier_sz - 1;
+	struct bezier_control_point ctrls[4];
+	struct bezier_control_point prev = { 0.0, 0.0 },
+				    max = { range, range };
+	double t[BEZIER_CHUNK], x[BEZIER_CHUNK], y[BEZIER_CHUNK];
+
+	if (bezier_sz < 2 || bezier_sz > BEZIER_MAX_SIZE || nsegments < 1)
+		return false;
+
+	if (!scale_controls(controls, range, ctrls))
+		return false;
+
+	for (int i = 0; i < 3; i++) {
+		if (ctrls[i].x > ctrls[i+1].x)
+			return false;
+	}
+
+	bezier[0] = 0;
+
+	/* Same approach as cubic_bezier(): a line from 0/0 to the first
+	   control point, nsegments lines along the curve and a line from
+	   the last control point to xmax/ymax. The curve points are
+	   calculated in chunks so the evaluator loop can be vectorized. */
+	for (size_t i = 0; i <= nsegments; i += BEZIER_CHUNK) {
+		size_t n = nsegments + 1 - i;
+
+		if (n > BEZIER_CHUNK)
+			n = BEZIER_CHUNK;
+
+		for (size_t j = 0; j < n; j++)
+			t[j] = (double)(i + j)/nsegments;
+
+		bezier_evaluate(ctrls, t, n, x, y);
+
+		for (size_t j = 0; j < n; j++) {
+			struct bezier_control_point p = { x[j], y[j] };
+
+			/* rounding errors may push x a tiny bit
+			 * backwards, x is monotonic otherwise */
+			if (p.x < prev.x)
+				p.x = prev.x;
+
+			fixed_line_between(prev, p, bezier, bezier_sz);
+			prev = p;
+		}
+	}
+
+	if (prev.x < max.x)
+		fixed_line_between(prev, max, bezier, bezier_sz);
 
 	return true;
 }
+
+int
+bezier_interpolate(const int *bezier, size_t bezier_sz, int x)
+{
+	const int one = 1 << BEZIER_FRAC_BITS;
+	int idx, frac;
+
+	if (x <= 0)
+		return bezier[0];
+
+	idx = x >> BEZIER_FRAC_BITS;
+	if (idx >= (int)bezier_sz - 1)
+		return bezier[bezier_sz - 1];
+
+	frac = x & (one - 1);
+
+	return bezier[idx] +
+		(int)(((int64_t)(bezier[idx + 1] - bezier[idx]) * frac) >> BEZIER_FRAC_BITS);
+}
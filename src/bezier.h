@@ -66,4 +66,36 @@ bool
 cubic_bezier(const struct bezier_control_point controls[4],
 	     int *bezier,
 	     size_t bezier_sz);
+
+/* Fractional bits of the values filled in by cubic_bezier_fixed() */
+#define BEZIER_FRAC_BITS 8
+/* Largest bezier_sz supported by cubic_bezier_fixed() */
+#define BEZIER_MAX_SIZE (1 << 16)
+
+/**
+ * Like cubic_bezier(), but the curve is flattened into nsegments
+ * segments and each bezier[x] is a fixed-point number with
+ * BEZIER_FRAC_BITS fractional bits, i.e. in the range
+ * [0, (bezier_sz - 1) << BEZIER_FRAC_BITS].
+ *
+ * Use bezier_interpolate() to look up values between two entries.
+ *
+ * @return true on success, false otherwise
+ */
+bool
+cubic_bezier_fixed(const struct bezier_control_point controls[4],
+		   size_t nsegments,
+		   int *bezier,
+		   size_t bezier_sz);
+
+/**
+ * Look up the y value for x in a curve filled in by cubic_bezier_fixed(),
+ * interpolating linearly between the two closest entries. x uses the
+ * same fixed-point format as the curve, values outside
+ * [0, (bezier_sz - 1) << BEZIER_FRAC_BITS] are clamped.
+ *
+ * @return the fixed-point y value for x
+ */
+int
+bezier_interpolate(const int *bezier, size_t bezier_sz, int x);
 #endif
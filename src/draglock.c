@@ -96,7 +96,8 @@ draglock_init_from_string(struct draglock *dl, const char *config)
 	dl->meta_button = 0;
 	dl->meta_state = false;
 	memset(dl->lock_pair, 0, sizeof(dl->lock_pair));
-	memset(dl->lock_state, 0, sizeof(dl->lock_state));
+	memset(dl->down, 0, sizeof(dl->down));
+	memset(dl->locked, 0, sizeof(dl->locked));
 
 	return draglock_parse_config(dl, config);
 }
@@ -163,10 +164,13 @@ draglock_set_pairs(struct draglock *dl, const int *array, size_t sz)
 	for (i = 0; i < sz; i++) {
 		if (array[i] < 0 || array[i] >= DRAGLOCK_MAX_BUTTONS)
 			return 1;
+		if (i >= DRAGLOCK_MAX_BUTTONS && array[i] != 0)
+			return 1;
 	}
 
 	dl->mode = DRAGLOCK_DISABLED;
-	for (i = 0; i < sz; i++) {
+	memset(dl->lock_pair, 0, sizeof(dl->lock_pair));
+	for (i = 0; i < sz && i < ARRAY_SIZE(dl->lock_pair); i++) {
 		dl->lock_pair[i] = array[i];
 		if (dl->lock_pair[i])
 			dl->mode = DRAGLOCK_PAIRS;
@@ -175,11 +179,45 @@ draglock_set_pairs(struct draglock *dl, const int *array, size_t sz)
 	return 0;
 }
 
+static inline bool
+draglock_is_active(const struct draglock *dl, unsigned int b)
+{
+	uint32_t mask = 1u << (b % 32);
+
+	return ((dl->down[b / 32] | dl->locked[b / 32]) & mask) != 0;
+}
+
+/* Moves the button to its next state. Returns false if the event doesn't
+ * change the state, the caller passes it through as-is. Otherwise discard
+ * is set if the event must not be sent */
+static inline bool
+draglock_advance(struct draglock *dl, unsigned int b, bool is_press,
+		 bool *discard)
+{
+	uint32_t mask = 1u << (b % 32);
+	uint32_t *down = &dl->down[b / 32],
+		 *locked = &dl->locked[b / 32];
+	bool is_down = (*down & mask) != 0,
+	     is_locked = (*locked & mask) != 0;
+
+	if (is_press == is_down)
+		return false;
+
+	/* The first release and the second press are the ones we eat */
+	*discard = (is_press == is_locked);
+
+	*down ^= mask;
+	*locked ^= is_press ? 0 : mask;
+
+	return true;
+}
+
 static int
 draglock_filter_meta(struct draglock *dl, int *button, int *press)
 {
 	int b = *button,
 	    is_press = *press;
+	bool discard;
 
 	if (b == dl->meta_button) {
 		if (is_press)
@@ -188,33 +226,18 @@ draglock_filter_meta(struct draglock *dl, int *button, int *press)
 		return 0;
 	}
 
-	switch (dl->lock_state[b]) {
-	case DRAGLOCK_BUTTON_STATE_NONE:
-		if (dl->meta_state && is_press) {
-			dl->lock_state[b] = DRAGLOCK_BUTTON_STATE_DOWN_1;
-			dl->meta_state = false;
-		}
-		break;
-	case DRAGLOCK_BUTTON_STATE_DOWN_1:
-		if (!is_press) {
-			dl->lock_state[b] = DRAGLOCK_BUTTON_STATE_UP_1;
-			b = 0;
-		}
-		break;
-	case DRAGLOCK_BUTTON_STATE_UP_1:
-		if (is_press) {
-			dl->lock_state[b] = DRAGLOCK_BUTTON_STATE_DOWN_2;
-			b = 0;
-		}
-		break;
-	case DRAGLOCK_BUTTON_STATE_DOWN_2:
-		if (!is_press) {
-			dl->lock_state[b] = DRAGLOCK_BUTTON_STATE_NONE;
-		}
-		break;
+	if (b >= DRAGLOCK_MAX_BUTTONS)
+		return 0;
+
+	/* only a press after the meta button starts a lock */
+	if (!draglock_is_active(dl, b)) {
+		if (!dl->meta_state || !is_press)
+			return 0;
+		dl->meta_state = false;
 	}
 
-	*button = b;
+	if (draglock_advance(dl, b, is_press, &discard) && discard)
+		*button = 0;
 
 	return 0;
 }
@@ -224,38 +247,13 @@ draglock_filter_pair(struct draglock *dl, int *button, int *press)
 {
 	int b = *button,
 	    is_press = *press;
+	bool discard;
 
-	if (dl->lock_pair[b] == 0)
+	if (b >= DRAGLOCK_MAX_BUTTONS || dl->lock_pair[b] == 0)
 		return 0;
 
-	switch (dl->lock_state[b]) {
-	case DRAGLOCK_BUTTON_STATE_NONE:
-		if (is_press) {
-			dl->lock_state[b] = DRAGLOCK_BUTTON_STATE_DOWN_1;
-			b = dl->lock_pair[b];
-		}
-		break;
-	case DRAGLOCK_BUTTON_STATE_DOWN_1:
-		if (!is_press) {
-			dl->lock_state[b] = DRAGLOCK_BUTTON_STATE_UP_1;
-			b = 0;
-		}
-		break;
-	case DRAGLOCK_BUTTON_STATE_UP_1:
-		if (is_press) {
-			dl->lock_state[b] = DRAGLOCK_BUTTON_STATE_DOWN_2;
-			b = 0;
-		}
-		break;
-	case DRAGLOCK_BUTTON_STATE_DOWN_2:
-		if (!is_press) {
-			dl->lock_state[b] = DRAGLOCK_BUTTON_STATE_NONE;
-			b = dl->lock_pair[b];
-		}
-		break;
-	}
-
-	*button = b;
+	if (draglock_advance(dl, b, is_press, &discard))
+		*button = discard ? 0 : dl->lock_pair[b];
 
 	return 0;
 }
@@ -29,13 +29,15 @@
 #define DRAGLOCK_H 1
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
-/* 32 buttons are enough for everybody™
+/* 128 buttons are enough for everybody™
  * Note that this is the limit of physical buttons as well as the highest
- * allowed target button.
+ * allowed target button. Must fit into the uint8_t lock_pair.
  */
-#define DRAGLOCK_MAX_BUTTONS 32
+#define DRAGLOCK_MAX_BUTTONS 128
+#define DRAGLOCK_BITSET_SIZE ((DRAGLOCK_MAX_BUTTONS + 31)/32)
 
 enum draglock_mode
 {
@@ -44,21 +46,21 @@ enum draglock_mode
 	DRAGLOCK_PAIRS
 };
 
-enum draglock_button_state
-{
-	DRAGLOCK_BUTTON_STATE_NONE,
-	DRAGLOCK_BUTTON_STATE_DOWN_1,
-	DRAGLOCK_BUTTON_STATE_UP_1,
-	DRAGLOCK_BUTTON_STATE_DOWN_2,
-};
-
+/* The state of a button is one bit each in down and locked:
+ *   neither: not locked
+ *   down: first press, the release will lock the button
+ *   locked: logically held down
+ *   down|locked: second press, the release will unlock the button
+ * A press sets down, a release clears it and toggles locked.
+ */
 struct draglock
 {
 	enum draglock_mode mode;
 	int meta_button;			/* meta key to lock any button */
 	bool meta_state;			/* meta_button state */
-	unsigned int lock_pair[DRAGLOCK_MAX_BUTTONS + 1];/* specify a meta/lock pair */
-	enum draglock_button_state lock_state[DRAGLOCK_MAX_BUTTONS + 1];	/* state of any locked buttons */
+	uint8_t lock_pair[DRAGLOCK_MAX_BUTTONS];/* specify a meta/lock pair */
+	uint32_t down[DRAGLOCK_BITSET_SIZE];	/* bitmask of button states, see above */
+	uint32_t locked[DRAGLOCK_BITSET_SIZE];
 };
 
 /**
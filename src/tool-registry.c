@@ -0,0 +1,127 @@
+/*
+ * Copyright © 2018 Red Hat, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of Red Hat
+ * not be used in advertising or publicity pertaining to distribution
+ * of the software without specific, written prior permission.  Red
+ * Hat makes no representations about the suitability of this software
+ * for any purpose.  It is provided "as is" without express or implied
+ * warranty.
+ *
+ * THE AUTHORS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "tool-registry.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+
+size_t
+tool_registry_load(struct tool_registry *registry, FILE *fp)
+{
+	char line[256];
+
+	registry->nentries = 0;
+
+	while (fgets(line, sizeof(line), fp)) {
+		struct tool_registry_entry e;
+		char extra;
+
+		if (line[0] == '#')
+			continue;
+
+		if (sscanf(line, "%" SCNx32 ":%" SCNx32 " %" SCNx64 " %" SCNx64 " %" SCNu32 " %" SCNu32 " %c",
+			   &e.vendor, &e.product, &e.serial, &e.tool_id,
+			   &e.type, &e.axes, &extra) != 6)
+			continue;
+
+		tool_registry_add(registry, &e);
+	}
+
+	return registry->nentries;
+}
+
+int
+tool_registry_save(const struct tool_registry *registry, FILE *fp)
+{
+	size_t i;
+
+	fprintf(fp, "# vendor:product serial tool_id type axes\n");
+	for (i = 0; i < registry->nentries; i++) {
+		const struct tool_registry_entry *e = &registry->entries[i];
+
+		fprintf(fp, "%04" PRIx32 ":%04" PRIx32 " %" PRIx64 " %" PRIx64 " %" PRIu32 " %" PRIu32 "\n",
+			e->vendor, e->product, e->serial, e->tool_id,
+			e->type, e->axes);
+	}
+
+	if (fflush(fp) != 0 || ferror(fp))
+		return -EIO;
+
+	return 0;
+}
+
+struct tool_registry_entry *
+tool_registry_find(struct tool_registry *registry,
+		   uint32_t vendor, uint32_t product,
+		   uint64_t serial, uint64_t tool_id)
+{
+	size_t i;
+
+	for (i = 0; i < registry->nentries; i++) {
+		struct tool_registry_entry *e = &registry->entries[i];
+
+		if (e->vendor == vendor && e->product == product &&
+		    e->serial == serial && e->tool_id == tool_id)
+			return e;
+	}
+
+	return NULL;
+}
+
+bool
+tool_registry_add(struct tool_registry *registry,
+		  const struct tool_registry_entry *entry)
+{
+	struct tool_registry_entry *e;
+
+	e = tool_registry_find(registry,
+			       entry->vendor, entry->product,
+			       entry->serial, entry->tool_id);
+	if (!e) {
+		if (registry->nentries == TOOL_REGISTRY_MAX)
+			return false;
+		e = &registry->entries[registry->nentries++];
+	}
+
+	*e = *entry;
+
+	return true;
+}
+
+void
+tool_registry_remove(struct tool_registry *registry,
+		     struct tool_registry_entry *entry)
+{
+	size_t idx = entry - registry->entries;
+
+	memmove(entry, entry + 1,
+		(registry->nentries - idx - 1) * sizeof(*entry));
+	registry->nentries--;
+}
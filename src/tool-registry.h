@@ -0,0 +1,90 @@
+/*
+ * Copyright © 2018 Red Hat, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of Red Hat
+ * not be used in advertising or publicity pertaining to distribution
+ * of the software without specific, written prior permission.  Red
+ * Hat makes no representations about the suitability of this software
+ * for any purpose.  It is provided "as is" without express or implied
+ * warranty.
+ *
+ * THE AUTHORS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef TOOL_REGISTRY_H
+#define TOOL_REGISTRY_H 1
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* The tablet tools seen before, so their subdevices can be created in
+ * PreInit instead of on the first proximity in. One line per tool:
+ *    vendor:product serial tool_id type axes
+ * vendor, product, serial and tool_id in hex, type is the
+ * libinput_tablet_tool_type, axes the tool_registry_axes. Lines
+ * starting with # are comments.
+ */
+#define TOOL_REGISTRY_MAX 32
+
+enum tool_registry_axes {
+	TOOL_AXIS_PRESSURE = (1 << 0),
+	TOOL_AXIS_TILT = (1 << 1),
+	TOOL_AXIS_SLIDER = (1 << 2),
+	TOOL_AXIS_ROTATION = (1 << 3),
+};
+
+struct tool_registry_entry {
+	uint32_t vendor;
+	uint32_t product;
+	uint64_t serial;
+	uint64_t tool_id;
+	uint32_t type;
+	uint32_t axes;
+};
+
+struct tool_registry {
+	size_t nentries;
+	struct tool_registry_entry entries[TOOL_REGISTRY_MAX];
+};
+
+/* Reads the registry from fp, malformed lines are skipped. If a tool is
+ * listed twice the last line wins. Returns the number of entries. */
+size_t
+tool_registry_load(struct tool_registry *registry, FILE *fp);
+
+/* Returns 0 on success or a negative errno */
+int
+tool_registry_save(const struct tool_registry *registry, FILE *fp);
+
+struct tool_registry_entry *
+tool_registry_find(struct tool_registry *registry,
+		   uint32_t vendor, uint32_t product,
+		   uint64_t serial, uint64_t tool_id);
+
+/* Adds or replaces the entry for this tool. Returns false if the
+ * registry is full */
+bool
+tool_registry_add(struct tool_registry *registry,
+		  const struct tool_registry_entry *entry);
+
+void
+tool_registry_remove(struct tool_registry *registry,
+		     struct tool_registry_entry *entry);
+
+#endif
@@ -0,0 +1,136 @@
+/*
+ * Copyright © 2018 Red Hat, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of Red Hat
+ * not be used in advertising or publicity pertaining to distribution
+ * of the software without specific, written prior permission.  Red
+ * Hat makes no representations about the suitability of this software
+ * for any purpose.  It is provided "as is" without express or implied
+ * warranty.
+ *
+ * THE AUTHORS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int
+trace_map(struct trace *trace, int fd, size_t size, int prot)
+{
+	void *map;
+
+	map = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	trace->header = map;
+	trace->records = (struct trace_record*)(trace->header + 1);
+	trace->size = size;
+
+	return 0;
+}
+
+int
+trace_open(struct trace *trace, const char *path, uint32_t nrecords)
+{
+	size_t size;
+	int fd, rc;
+
+	/* one slot is always the writer's */
+	if (nrecords < 2)
+		return -EINVAL;
+
+	size = sizeof(struct trace_header) +
+	       (size_t)nrecords * sizeof(struct trace_record);
+
+	fd = open(path, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+	if (fd < 0)
+		return -errno;
+
+	if (ftruncate(fd, size) < 0) {
+		rc = -errno;
+		goto out;
+	}
+
+	rc = trace_map(trace, fd, size, PROT_READ|PROT_WRITE);
+	if (rc != 0)
+		goto out;
+
+	trace->header->magic = TRACE_MAGIC;
+	trace->header->version = TRACE_VERSION;
+	trace->header->record_size = sizeof(struct trace_record);
+	trace->header->nrecords = nrecords;
+	trace->header->head = 0;
+
+out:
+	close(fd);
+	return rc;
+}
+
+int
+trace_open_readonly(struct trace *trace, const char *path)
+{
+	struct stat st;
+	const struct trace_header *h;
+	int fd, rc;
+
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st) < 0) {
+		rc = -errno;
+		goto out;
+	}
+
+	rc = -EINVAL;
+	if ((size_t)st.st_size < sizeof(struct trace_header))
+		goto out;
+
+	rc = trace_map(trace, fd, st.st_size, PROT_READ);
+	if (rc != 0)
+		goto out;
+
+	h = trace->header;
+	if (h->magic != TRACE_MAGIC ||
+	    h->version != TRACE_VERSION ||
+	    h->record_size != sizeof(struct trace_record) ||
+	    h->nrecords == 0 ||
+	    trace->size < sizeof(*h) + (size_t)h->nrecords * h->record_size) {
+		trace_close(trace);
+		rc = -EINVAL;
+	}
+
+out:
+	close(fd);
+	return rc;
+}
+
+void
+trace_close(struct trace *trace)
+{
+	if (trace->header)
+		munmap(trace->header, trace->size);
+
+	memset(trace, 0, sizeof(*trace));
+}
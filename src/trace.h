@@ -0,0 +1,160 @@
+/*
+ * Copyright © 2018 Red Hat, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of Red Hat
+ * not be used in advertising or publicity pertaining to distribution
+ * of the software without specific, written prior permission.  Red
+ * Hat makes no representations about the suitability of this software
+ * for any purpose.  It is provided "as is" without express or implied
+ * warranty.
+ *
+ * THE AUTHORS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef TRACE_H
+#define TRACE_H 1
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* An event trace is a file with a header and a ring of fixed-size
+ * records, mmap'd by the writer. Once the ring is full the oldest
+ * record is overwritten, head counts all records ever written.
+ *
+ * A record is filled in first and then published by bumping head with
+ * a release store, so a reader that loads head with acquire never sees
+ * a half-written record. The slot at head is the writer's, the ring
+ * holds at most nrecords - 1 published records.
+ */
+#define TRACE_MAGIC 0x5254494c /* "LITR" */
+#define TRACE_VERSION 1
+#define TRACE_NUM_VALUES 8
+
+struct trace_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t nrecords;
+	_Atomic uint64_t head;
+};
+
+/* Records of what the driver posted to the server have TRACE_POSTED
+ * set in the type, the rest is a trace_posted_type. Their time is when
+ * the event was posted, axes is the bitmask of the valuators set and
+ * values are the first TRACE_NUM_VALUES valuators.
+ */
+#define TRACE_POSTED 0x10000
+
+enum trace_posted_type {
+	TRACE_POSTED_MOTION = 1,	/* state: 1 if absolute */
+	TRACE_POSTED_BUTTON,		/* code: button, state: pressed */
+	TRACE_POSTED_KEY,		/* code: X keycode, state: pressed */
+	TRACE_POSTED_TOUCH,		/* code: touch id, state: XI event type */
+	TRACE_POSTED_PROXIMITY,		/* state: in proximity */
+};
+
+/* Otherwise the values depend on the type (a libinput_event_type):
+ *   pointer motion: dx, dy, unaccelerated dx, dy
+ *   absolute pointer motion and touch: x, y, normalized to [0, 1]
+ *   pointer axis and scroll: vertical, horizontal value, then the
+ *     discrete (or v120) values, the source is in state
+ *   tablet tool: x, y normalized, pressure, tilt x, tilt y, slider,
+ *     rotation
+ * Buttons and keys have their code and state only.
+ */
+struct trace_record {
+	uint64_t time;		/* event timestamp, µs */
+	uint64_t handled;	/* CLOCK_MONOTONIC when handled, µs */
+	uint32_t device;	/* the driver's shared device id */
+	uint32_t type;		/* libinput_event_type or TRACE_POSTED */
+	uint32_t code;		/* button or key */
+	uint32_t state;		/* button, key, tip, proximity state or axis source */
+	int32_t slot;
+	uint32_t axes;		/* bitmask of pointer axes */
+	double values[TRACE_NUM_VALUES];
+};
+
+struct trace {
+	struct trace_header *header;
+	struct trace_record *records;
+	size_t size; /* of the mapping */
+};
+
+/* Creates (or truncates) the file at path with room for nrecords,
+ * at least 2. Returns 0 on success, a negative errno otherwise */
+int
+trace_open(struct trace *trace, const char *path, uint32_t nrecords);
+
+/* Maps an existing trace read-only */
+int
+trace_open_readonly(struct trace *trace, const char *path);
+
+void
+trace_close(struct trace *trace);
+
+/* The record to fill in next. The writer fills it in place, there's no
+ * per-record syscall, then publishes it with trace_commit() */
+static inline struct trace_record *
+trace_next(struct trace *trace)
+{
+	struct trace_header *h = trace->header;
+	uint64_t head = atomic_load_explicit(&h->head, memory_order_relaxed);
+
+	return &trace->records[head % h->nrecords];
+}
+
+/* Publishes the record returned by trace_next(). Only the writer
+ * stores to head */
+static inline void
+trace_commit(struct trace *trace)
+{
+	struct trace_header *h = trace->header;
+	uint64_t head = atomic_load_explicit(&h->head, memory_order_relaxed);
+
+	atomic_store_explicit(&h->head, head + 1, memory_order_release);
+}
+
+static inline uint64_t
+trace_head(const struct trace *trace)
+{
+	return atomic_load_explicit(&trace->header->head, memory_order_acquire);
+}
+
+/* Number of published records still in the ring */
+static inline size_t
+trace_count(const struct trace *trace)
+{
+	const struct trace_header *h = trace->header;
+	uint64_t head = trace_head(trace);
+
+	return head < h->nrecords ? head : h->nrecords - 1;
+}
+
+/* The idx-th oldest record still in the ring. A reader of a live trace
+ * loses the oldest records while it reads, copy what's needed */
+static inline const struct trace_record *
+trace_get(const struct trace *trace, size_t idx)
+{
+	const struct trace_header *h = trace->header;
+	uint64_t first = trace_head(trace) - trace_count(trace);
+
+	return &trace->records[(first + idx) % h->nrecords];
+}
+
+#endif
@@ -25,8 +25,10 @@
 #include "config.h"
 #endif
 
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdatomic.h>
 #include <time.h>
 #include <unistd.h>
 #include <xorg-server.h>
@@ -45,6 +47,8 @@
 #include "bezier.h"
 #include "draglock.h"
 #include "libinput-properties.h"
+#include "tool-registry.h"
+#include "trace.h"
 
 #ifndef XI86_SERVER_FD
 #define XI86_SERVER_FD 0x20
@@ -61,7 +65,15 @@
 #endif
 
 #define TOUCHPAD_NUM_AXES 4 /* x, y, hscroll, vscroll */
+#define GESTURE_NUM_AXES 4 /* swipe x, swipe y, pinch scale, pinch rotation */
+#define GESTURE_AXIS_SWIPE_X (TOUCHPAD_NUM_AXES + 0)
+#define GESTURE_AXIS_SWIPE_Y (TOUCHPAD_NUM_AXES + 1)
+#define GESTURE_AXIS_PINCH_SCALE (TOUCHPAD_NUM_AXES + 2)
+#define GESTURE_AXIS_PINCH_ROTATION (TOUCHPAD_NUM_AXES + 3)
 #define TABLET_NUM_BUTTONS 7 /* we need scroll buttons */
+#define TABLET_PAD_NUM_AXES 9 /* x, y, pressure, 2 strips, 2 rings, 2 scroll */
+#define TABLET_PAD_AXIS_RING_SCROLL 7
+#define TABLET_PAD_AXIS_STRIP_SCROLL 8
 #define TOUCH_MAX_SLOTS 15
 #define XORG_KEYCODE_OFFSET 8
 
@@ -80,6 +92,8 @@
 #define TABLET_TILT_AXIS_MAX 64
 #define TABLET_STRIP_AXIS_MAX 4096
 #define TABLET_RING_AXIS_MAX 71
+#define TABLET_RING_SCROLL_INCREMENT 3 /* steps of 360/71 degrees */
+#define TABLET_STRIP_SCROLL_INCREMENT (TABLET_STRIP_AXIS_MAX/8)
 
 #define CAP_KEYBOARD	0x1
 #define CAP_POINTER	0x2
@@ -88,14 +102,187 @@
 #define CAP_TABLET_TOOL	0x10
 #define CAP_TABLET_PAD	0x20
 
-struct xf86libinput_driver {
+#define PREDICTION_MAX_GAP 50000 /* us, a longer pause restarts */
+#define TABLET_PREDICTION_MAX 50 /* ms */
+#define EVENT_TRACE_SIZE 65536 /* records */
+#define TOOL_ROUTE_CACHE_SIZE 8 /* power of 2 */
+#define BUTTON_MAP_SIZE (BTN_TRIGGER_HAPPY40 - BTN_MISC + 1)
+#define BUTTON_MAP_DRAGLOCK 0x1 /* needs to go through draglock_filter_button */
+#define TOOL_EVENT_QUEUE_SIZE 64
+#define LATENCY_BUCKETS 24 /* log2 of µs, see latency_bucket() */
+/* libinput event types are grouped by hundreds from keyboard (300) to
+ * switch (900) events, none has more than 8, see event_counter_index() */
+#define EVENT_COUNTER_GROUPS 7
+#define EVENT_COUNTER_TYPES (EVENT_COUNTER_GROUPS * 8)
+#define EVENT_COUNTERS_SIZE (6 + EVENT_COUNTER_TYPES)
+#define DEFERRED_EVENTS_MAX 4096
+#define DEVICE_HANDLES_MAX 256 /* low 8 bits of a handle */
+#define DEFERRED_PROPS_SIZE 64 /* power of two */
+#define INPUT_CONTEXTS_MAX 16 /* see "InputContext" */
+
+/* Property changes the input thread can't do itself, applied by a work
+   proc on the main thread. The device is looked up by handle, if it was
+   removed in the meantime the entry is dropped */
+enum deferred_prop_type {
+	DEFERRED_PROP_MODE_GROUP,
+};
+
+struct deferred_prop {
+	uint32_t handle;
+	enum deferred_prop_type type;
+	union {
+		struct {
+			unsigned int idx;
+			unsigned int mode;
+		} mode_group;
+	};
+};
+
+/* Devices are split across libinput contexts with the "InputContext"
+   option, each has its own fd and event queue. Only one InputInfoPtr
+   per context is registered with the server, its read_input dispatches
+   for all devices in that context */
+enum input_context_type {
+	INPUT_CONTEXT_SHARED = 0,
+	INPUT_CONTEXT_CLASS_KEYBOARD,
+	INPUT_CONTEXT_CLASS_POINTER,
+	INPUT_CONTEXT_CLASS_TOUCH,
+	INPUT_CONTEXT_CLASS_TABLET,
+	INPUT_CONTEXT_CLASS_TABLET_PAD,
+	INPUT_CONTEXT_DEVICE, /* first of the per-device contexts */
+};
+
+struct xf86libinput_context {
 	struct libinput *libinput;
 	int device_enabled_count;
 	void *registered_InputInfoPtr;
+	/* Bumped for each read_input of this context, it resets the
+	   EventBudget of the devices in it */
+	uint32_t budget_generation;
+};
+
+struct xf86libinput_driver {
+	/* The shared one is refcounted per PreInit, the rest have one
+	   ref per shared device using them */
+	struct xf86libinput_context contexts[INPUT_CONTEXTS_MAX];
+	int device_enabled_count; /* in all contexts */
+
+	/* Pending merged pointer motion, see "MotionBatching". Only ever
+	   set during read_input, flushed before it returns */
+	struct motion_batch {
+		InputInfoPtr pInfo;
+		bool absolute;
+		double x, y;
+		double ux, uy; /* relative only */
+	} motion_batch;
+
+	/* Devices with events held back because of their EventBudget,
+	   in the order they're serviced, from all contexts */
+	struct xorg_list deferred_devices;
+	OsTimerPtr deferred_timer;
+
+	/* Subdevices waiting to be created by the (single) queued
+	   work proc. Only valid while hotplug_queued is set */
+	struct xorg_list pending_hotplugs;
+	bool hotplug_queued;
+
+	/* Handles are slot | generation << 8, so a stale handle doesn't
+	   find a device that reuses its slot. Main thread only */
+	struct {
+		InputInfoPtr pInfo;
+		uint32_t generation;
+	} handles[DEVICE_HANDLES_MAX];
+
+	/* Single producer (the input thread), single consumer (the work
+	   proc). queued is set while a work proc is scheduled */
+	struct {
+		struct deferred_prop entries[DEFERRED_PROPS_SIZE];
+		atomic_uint head; /* next to write */
+		atomic_uint tail; /* next to read */
+		atomic_bool queued;
+	} deferred_props;
+
+	/* See "EventTrace", header is NULL unless enabled */
+	struct trace trace;
 };
 
 static struct xf86libinput_driver driver_context;
 
+static uint32_t
+xf86libinput_handle_new(InputInfoPtr pInfo)
+{
+	uint32_t slot;
+
+	for (slot = 0; slot < DEVICE_HANDLES_MAX; slot++) {
+		if (driver_context.handles[slot].pInfo)
+			continue;
+
+		driver_context.handles[slot].pInfo = pInfo;
+		if (++driver_context.handles[slot].generation > UINT32_MAX >> 8)
+			driver_context.handles[slot].generation = 1;
+		return slot | driver_context.handles[slot].generation << 8;
+	}
+
+	return 0;
+}
+
+static void
+xf86libinput_handle_release(uint32_t handle)
+{
+	uint32_t slot = handle % DEVICE_HANDLES_MAX;
+
+	if (handle != 0)
+		driver_context.handles[slot].pInfo = NULL;
+}
+
+static InputInfoPtr
+xf86libinput_handle_lookup(uint32_t handle)
+{
+	uint32_t slot = handle % DEVICE_HANDLES_MAX;
+
+	if (handle == 0 ||
+	    driver_context.handles[slot].generation != handle >> 8)
+		return NULL;
+
+	return driver_context.handles[slot].pInfo;
+}
+
+struct options {
+	BOOL tapping;
+	BOOL tap_drag;
+	BOOL tap_drag_lock;
+	enum libinput_config_tap_button_map tap_button_map;
+	BOOL natural_scrolling;
+	BOOL left_handed;
+	BOOL middle_emulation;
+	BOOL disable_while_typing;
+	CARD32 sendevents;
+	CARD32 scroll_button; /* xorg button number */
+	float speed;
+	float matrix[9];
+	enum libinput_config_scroll_method scroll_method;
+	enum libinput_config_click_method click_method;
+	enum libinput_config_accel_profile accel_profile;
+
+	unsigned char btnmap[MAX_BUTTONS + 1];
+
+	BOOL horiz_scrolling_enabled;
+	BOOL motion_batching;
+	BOOL gesture_passthrough;
+	BOOL raw_motion;
+	BOOL pad_scrolling;
+	int tool_queue_size;
+	int tool_axis_rate; /* Hz, 0 for unlimited */
+	int tool_prediction; /* ms, 0 for disabled */
+	int event_budget;
+
+	float rotation_angle;
+	struct bezier_control_point pressurecurve[4];
+	struct ratio {
+		int x, y;
+	} area;
+};
+
 struct xf86libinput_device {
 	int refcount;
 	int enabled_count;
@@ -103,18 +290,80 @@ struct xf86libinput_device {
 	struct libinput_device *device;
 	struct xorg_list device_list;
 	int server_fd;
+	struct xf86libinput_context *context;
+
+	/* device is still in the path context from PreInit, suspended
+	   until the first DEVICE_ON, see "ProbeOnce" */
+	bool probed;
 
 	struct xorg_list unclaimed_tablet_tool_list;
-};
 
-struct xf86libinput_tablet_tool_queued_event {
-	struct xorg_list node;
-	struct libinput_event_tablet_tool *event;
+	/* TabletToolRegistry path, NULL if unset. pending_tools are the
+	   subdevices created from it in PreInit that didn't claim their
+	   tool yet */
+	char *tool_registry;
+	struct tool_registry pending_tools;
+
+	/* The part of the "libinput Event Counters" that isn't for one X
+	   device (yet) */
+	struct {
+		uint32_t unrouted;
+		uint32_t tool_queued;
+		uint32_t tool_dropped;
+	} counters;
+
+	/* Cached results of xf86libinput_pick_device(), rebuilt on demand
+	   whenever the device_list changed. The tool cache holds a ref on
+	   each tool so a pointer can't be reused for a different tool */
+	struct {
+		bool valid;
+		InputInfoPtr keyboard;
+		InputInfoPtr tablet;
+		InputInfoPtr other;
+		struct {
+			struct libinput_tablet_tool *tool;
+			InputInfoPtr pInfo;
+		} tools[TOOL_ROUTE_CACHE_SIZE];
+	} route;
+
+	/* At most limit events are handled per read_input, anything
+	   beyond that waits in the events ring for the next one */
+	struct {
+		int limit; /* 0 for unlimited */
+		int used;
+		uint32_t generation;
+		struct libinput_event **events;
+		size_t first;
+		size_t count;
+		size_t size;
+		struct xorg_list link; /* driver_context.deferred_devices */
+	} budget;
+
+	/* The libinput options as the first device parsed them, keyed
+	   by its option list. A subdevice with the same list copies these
+	   instead of parsing everything again. Invalid once a property
+	   changed the config, parsing then picks up the new defaults */
+	struct {
+		bool valid;
+		uint64_t hash;
+		struct options options;
+	} parsed;
+
+	/* The config the libinput device currently has, so
+	   LibinputApplyConfig only needs to push what changed. Read back
+	   from the device whenever it is added, it starts with the
+	   libinput defaults */
+	struct options applied;
 };
 
+/* Events are queued between the first proximity in of a tool and its
+   subdevice appearing. Allocated once per tool with room for size events,
+   queuing itself never allocates */
 struct xf86libinput_tablet_tool_event_queue {
 	bool need_to_queue;
-	struct xorg_list event_list;
+	size_t nevents;
+	size_t size;
+	struct libinput_event_tablet_tool *events[];
 };
 
 struct xf86libinput_tablet_tool {
@@ -133,8 +382,13 @@ struct xf86libinput {
 
 		double vdist_fraction;
 		double hdist_fraction;
+
+		/* dist/120, for the hi-res wheel events */
+		double vdist_v120;
+		double hdist_v120;
 	} scroll;
 
+	/* the remainders are the sub-pixel motion of "RawMotion" */
 	struct {
 		double x;
 		double y;
@@ -147,53 +401,129 @@ struct xf86libinput {
 	ValuatorMask *valuators;
 	ValuatorMask *valuators_unaccelerated;
 
-	struct options {
-		BOOL tapping;
-		BOOL tap_drag;
-		BOOL tap_drag_lock;
-		enum libinput_config_tap_button_map tap_button_map;
-		BOOL natural_scrolling;
-		BOOL left_handed;
-		BOOL middle_emulation;
-		BOOL disable_while_typing;
-		CARD32 sendevents;
-		CARD32 scroll_button; /* xorg button number */
-		float speed;
-		float matrix[9];
-		enum libinput_config_scroll_method scroll_method;
-		enum libinput_config_click_method click_method;
-		enum libinput_config_accel_profile accel_profile;
-
-		unsigned char btnmap[MAX_BUTTONS + 1];
-
-		BOOL horiz_scrolling_enabled;
-
-		float rotation_angle;
-		struct bezier_control_point pressurecurve[4];
-		struct ratio {
-			int x, y;
-		} area;
-	} options;
+	/* The last value posted per ring and strip, -1 while there's no
+	   finger down */
+	struct {
+		int ring[2];
+		int strip[2];
+	} pad;
+
+	struct options options;
 
 	struct draglock draglock;
 
+	/* Linux button code - BTN_MISC (the button number for pads) to the
+	   button we post, see xf86libinput_build_button_map() */
+	struct button_map_entry {
+		uint8_t button; /* 0 to discard */
+		uint8_t flags;
+	} button_map[BUTTON_MAP_SIZE];
+
 	struct xf86libinput_device *shared_device;
 	struct xorg_list shared_device_link;
 
+	/* The tool has a ref on the libinput tool once it was in proximity.
+	   A subdevice pre-created from the TabletToolRegistry has no
+	   tablet_tool until then, only the desc */
 	struct libinput_tablet_tool *tablet_tool;
+	struct tool_registry_entry tool_desc;
+
+	/* libinput doesn't give us hw touch ids which X expects, so
+	   emulate them here. Touch motion is buffered until the next
+	   TOUCH_FRAME, only the most recent position per slot is kept */
+	struct {
+		unsigned int next_touchid;
+		int nslots;
+		int npending;
+		struct touch_slot {
+			unsigned int touchid;
+			bool pending;
+			double x, y;
+		} *slots;
+	} touch;
 
 	bool allow_mode_group_updates;
 
+	/* See "TabletToolAxisRate". Axis events less than interval apart
+	   are held back, only the last one is posted, with the highest
+	   pressure since the last one posted */
+	struct {
+		uint64_t interval; /* us, 0 for unlimited */
+		uint64_t last_time;
+		struct libinput_event_tablet_tool *held;
+		double max_pressure;
+		OsTimerPtr timer;
+	} axis_rate;
+
+	/* See "TabletToolPrediction". The velocity is smoothed over the
+	   samples since the last reset, in TABLET_AXIS_MAX units per us */
+	struct tool_prediction {
+		uint64_t ahead; /* us, 0 if disabled */
+		bool valid;
+		uint64_t time;
+		double x, y;
+		double dx, dy;
+	} prediction;
+
+	uint32_t handle; /* see xf86libinput_handle_lookup() */
+
+	/* Gestures posted as extra valuators, see "GesturePassthrough".
+	   The scale is the last one of the current pinch */
+	struct {
+		bool enabled;
+		double scale;
+	} gesture;
+
 	/* Pre-calculated pressure curve.
-	   In the 0...TABLET_AXIS_MAX range */
+	   In the 0...TABLET_AXIS_MAX range, or with nsegments set a
+	   fixed-point curve with sz entries, see cubic_bezier_fixed() */
 	struct {
 		int *values;
 		size_t sz;
+		size_t nsegments;
 	} pressurecurve;
 
 	struct scale_factor {
 		double x, y;
 	} area_scale_factor;
+
+	/* What post_tablet_motion needs to know about the tool, built on
+	   the first event after proximity in or a config change */
+	struct axis_plan {
+		bool valid;
+		double scale_x, scale_y;
+		const int *pressurecurve;
+		size_t pressurecurve_sz;
+		bool pressurecurve_fixed;
+		double pressure_in_scale, pressure_out_scale;
+		bool has_pressure;
+		bool has_tilt;
+		bool has_slider;
+		int rotation_valuator; /* -1 for none */
+	} axis_plan;
+
+	/* see LIBINPUT_PROP_EVENT_COUNTERS */
+	struct event_counters {
+		uint32_t discarded_off;
+		uint32_t discarded_abs;
+		uint32_t merged; /* tool axis events replaced by a newer one */
+		uint32_t handled[EVENT_COUNTER_TYPES];
+		bool allow_updates;
+	} counters;
+
+#if ENABLE_LATENCY_STATS
+	/* Time between the event timestamp and the event being posted.
+	   The rate is counted over each full second of event time */
+	struct latency_stats {
+		uint32_t buckets[LATENCY_BUCKETS];
+		uint32_t nevents;
+		uint64_t rate_start;
+		uint32_t rate_count;
+		uint32_t rate;
+		uint32_t peak_rate;
+		bool allow_updates;
+	} latency;
+#endif
 };
 
 enum event_handling {
@@ -204,7 +534,8 @@ enum event_handling {
 static void
 xf86libinput_create_subdevice(InputInfoPtr pInfo,
 			      uint32_t capabilities,
-			      XF86OptionPtr extra_opts);
+			      XF86OptionPtr extra_opts,
+			      const struct tool_registry_entry *register_tool);
 static inline void
 update_mode_prop(InputInfoPtr pInfo,
 		 struct libinput_event_tablet_pad *event);
@@ -216,6 +547,12 @@ static void
 xf86libinput_post_tablet_motion(InputInfoPtr pInfo,
 				struct libinput_event_tablet_tool *event);
 
+static void
+xf86libinput_flush_tablet_axis(InputInfoPtr pInfo);
+
+static void
+xf86libinput_discard_tablet_axis(struct xf86libinput *driver_data);
+
 static inline int
 use_server_fd(const InputInfoPtr pInfo) {
 	return pInfo->fd > -1 && (pInfo->flags & XI86_SERVER_FD);
@@ -259,6 +596,68 @@ btn_xorg2linux(unsigned int b)
 	return button;
 }
 
+/* Must be rebuilt whenever the capabilities or the draglock config
+ * change. The server applies the ButtonMapping and libinput handles
+ * left-handed, so neither is part of this */
+static void
+xf86libinput_build_button_map(struct xf86libinput *driver_data)
+{
+	int pairs[DRAGLOCK_MAX_BUTTONS] = {0};
+	enum draglock_mode mode;
+	size_t i;
+
+	mode = draglock_get_mode(&driver_data->draglock);
+	if (mode == DRAGLOCK_PAIRS)
+		draglock_get_pairs(&driver_data->draglock, pairs, ARRAY_SIZE(pairs));
+
+	for (i = 0; i < ARRAY_SIZE(driver_data->button_map); i++) {
+		struct button_map_entry *entry = &driver_data->button_map[i];
+		int button;
+
+		/* pads are devices of their own */
+		if (driver_data->capabilities & CAP_TABLET_PAD) {
+			button = 1 + i;
+			if (button > 3)
+				button += 4; /* offset by scroll buttons */
+		} else {
+			button = btn_linux2xorg(BTN_MISC + i);
+		}
+
+		if (button <= 0 || button > 255)
+			button = 0;
+
+		entry->button = button;
+		entry->flags = 0;
+
+		if (button == 0 || button >= DRAGLOCK_MAX_BUTTONS)
+			continue;
+
+		if (mode == DRAGLOCK_META ||
+		    (mode == DRAGLOCK_PAIRS && pairs[button] != 0))
+			entry->flags |= BUTTON_MAP_DRAGLOCK;
+	}
+}
+
+/* index is the linux button code or, for pads, the button number */
+static inline int
+xf86libinput_map_button(struct xf86libinput *driver_data,
+			unsigned int index,
+			int *is_press)
+{
+	const struct button_map_entry *entry;
+	int button;
+
+	if (index >= ARRAY_SIZE(driver_data->button_map))
+		return 0;
+
+	entry = &driver_data->button_map[index];
+	button = entry->button;
+	if (entry->flags & BUTTON_MAP_DRAGLOCK)
+		draglock_filter_button(&driver_data->draglock, &button, is_press);
+
+	return button;
+}
+
 static BOOL
 xf86libinput_is_subdevice(InputInfoPtr pInfo)
 {
@@ -306,8 +705,10 @@ xf86libinput_shared_create(struct libinput_device *device)
 	shared_device->device = device;
 	shared_device->refcount = 1;
 	shared_device->id = ++next_shared_device_id;
+	shared_device->context = &driver_context.contexts[INPUT_CONTEXT_SHARED];
 	xorg_list_init(&shared_device->device_list);
 	xorg_list_init(&shared_device->unclaimed_tablet_tool_list);
+	xorg_list_init(&shared_device->budget.link);
 
 	return shared_device;
 }
@@ -320,6 +721,33 @@ xf86libinput_shared_ref(struct xf86libinput_device *shared_device)
 	return shared_device;
 }
 
+static inline void
+xf86libinput_shared_invalidate_route(struct xf86libinput_device *shared_device)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(shared_device->route.tools); i++) {
+		if (shared_device->route.tools[i].tool)
+			libinput_tablet_tool_unref(shared_device->route.tools[i].tool);
+	}
+
+	memset(&shared_device->route, 0, sizeof(shared_device->route));
+}
+
+static void
+xf86libinput_shared_discard_deferred(struct xf86libinput_device *shared_device)
+{
+	while (shared_device->budget.count > 0) {
+		size_t idx = shared_device->budget.first;
+
+		libinput_event_destroy(shared_device->budget.events[idx]);
+		shared_device->budget.first = (idx + 1) % shared_device->budget.size;
+		shared_device->budget.count--;
+	}
+
+	xorg_list_del(&shared_device->budget.link);
+}
+
 static inline struct xf86libinput_device*
 xf86libinput_shared_unref(struct xf86libinput_device *shared_device)
 {
@@ -328,18 +756,77 @@ xf86libinput_shared_unref(struct xf86libinput_device *shared_device)
 	if (shared_device->refcount > 0)
 		return shared_device;
 
+	xf86libinput_shared_invalidate_route(shared_device);
+	xf86libinput_shared_discard_deferred(shared_device);
+	free(shared_device->budget.events);
+	free(shared_device->tool_registry);
+
+	/* never enabled after PreInit */
+	if (shared_device->probed) {
+		libinput_path_remove_device(shared_device->device);
+		libinput_device_unref(shared_device->device);
+	}
+
+	if (shared_device->context != &driver_context.contexts[INPUT_CONTEXT_SHARED])
+		shared_device->context->libinput = libinput_unref(shared_device->context->libinput);
+
 	free(shared_device);
 
 	return NULL;
 }
 
+static void
+xf86libinput_shared_read_config(struct xf86libinput_device *shared_device)
+{
+	struct libinput_device *device = shared_device->device;
+	struct options *applied = &shared_device->applied;
+
+	/* Only the fields LibinputApplyConfig pushes to the device */
+	applied->sendevents = libinput_device_config_send_events_get_mode(device);
+	applied->natural_scrolling = libinput_device_config_scroll_get_natural_scroll_enabled(device);
+	applied->speed = libinput_device_config_accel_get_speed(device);
+	applied->accel_profile = libinput_device_config_accel_get_profile(device);
+	applied->tapping = libinput_device_config_tap_get_enabled(device);
+	applied->tap_button_map = libinput_device_config_tap_get_button_map(device);
+	applied->tap_drag_lock = libinput_device_config_tap_get_drag_lock_enabled(device);
+	applied->tap_drag = libinput_device_config_tap_get_drag_enabled(device);
+	libinput_device_config_calibration_get_matrix(device, applied->matrix);
+	applied->left_handed = libinput_device_config_left_handed_get(device);
+	applied->scroll_method = libinput_device_config_scroll_get_method(device);
+	applied->scroll_button = btn_linux2xorg(libinput_device_config_scroll_get_button(device));
+	applied->click_method = libinput_device_config_click_get_method(device);
+	applied->middle_emulation = libinput_device_config_middle_emulation_get_enabled(device);
+	applied->disable_while_typing = libinput_device_config_dwt_get_enabled(device);
+	applied->rotation_angle = libinput_device_config_rotation_get_angle(device);
+}
+
+/* Resume the device kept from PreInit. If that fails (e.g. it was
+ * unplugged in the meantime), drop it so the caller re-adds by path */
+static inline struct libinput_device *
+xf86libinput_shared_resume_probed(struct xf86libinput_device *shared_device)
+{
+	struct libinput_device *device = shared_device->device;
+
+	shared_device->probed = false;
+
+	if (libinput_device_config_send_events_set_mode(device,
+							LIBINPUT_CONFIG_SEND_EVENTS_ENABLED) == LIBINPUT_CONFIG_STATUS_SUCCESS)
+		return device;
+
+	libinput_path_remove_device(device);
+	libinput_device_unref(device);
+	shared_device->device = NULL;
+
+	return NULL;
+}
+
 static inline struct libinput_device *
 xf86libinput_shared_enable(InputInfoPtr pInfo,
 			   struct xf86libinput_device *shared_device,
 			   const char *path)
 {
-	struct libinput_device *device;
-	struct libinput *libinput = driver_context.libinput;
+	struct libinput_device *device = NULL;
+	struct libinput *libinput = shared_device->context->libinput;
 
 	/* With systemd-logind the server requests the fd from logind, sets
 	 * pInfo->fd and sets the "fd" option to the fd number.
@@ -369,12 +856,19 @@ xf86libinput_shared_enable(InputInfoPtr pInfo,
 		return shared_device->device;
 	}
 
-	device = libinput_path_add_device(libinput, path);
-	if (!device)
-		return NULL;
+	if (shared_device->probed)
+		device = xf86libinput_shared_resume_probed(shared_device);
+
+	if (!device) {
+		device = libinput_path_add_device(libinput, path);
+		if (!device)
+			return NULL;
+
+		shared_device->device = libinput_device_ref(device);
+	}
 
 	libinput_device_set_user_data(device, shared_device);
-	shared_device->device = libinput_device_ref(device);
+	xf86libinput_shared_read_config(shared_device);
 
 	if (pInfo->flags & XI86_SERVER_FD)
 		shared_device->server_fd = xf86CheckIntOption(pInfo->options,
@@ -396,6 +890,8 @@ xf86libinput_shared_disable(struct xf86libinput_device *shared_device)
 	if (!device)
 		return;
 
+	xf86libinput_shared_discard_deferred(shared_device);
+
 	libinput_device_set_user_data(device, NULL);
 	libinput_path_remove_device(device);
 	device = libinput_device_unref(device);
@@ -412,6 +908,8 @@ static inline bool
 xf86libinput_set_pressurecurve(struct xf86libinput *driver_data,
 			       const struct bezier_control_point controls[4])
 {
+	driver_data->axis_plan.valid = false;
+
 	if (memcmp(controls, bezier_defaults, sizeof(bezier_defaults)) == 0) {
 		free(driver_data->pressurecurve.values);
 		driver_data->pressurecurve.values = NULL;
@@ -419,14 +917,26 @@ xf86libinput_set_pressurecurve(struct xf86libinput *driver_data,
 	}
 
 	if (!driver_data->pressurecurve.values) {
-		int *vals = calloc(TABLET_PRESSURE_AXIS_MAX + 1, sizeof(int));
+		size_t sz = driver_data->pressurecurve.sz;
+		int *vals;
+
+		if (sz == 0)
+			sz = TABLET_PRESSURE_AXIS_MAX + 1;
+
+		vals = calloc(sz, sizeof(int));
 		if (!vals)
 			return false;
 
 		driver_data->pressurecurve.values = vals;
-		driver_data->pressurecurve.sz = TABLET_PRESSURE_AXIS_MAX + 1;
+		driver_data->pressurecurve.sz = sz;
 	}
 
+	if (driver_data->pressurecurve.nsegments)
+		return cubic_bezier_fixed(controls,
+					  driver_data->pressurecurve.nsegments,
+					  driver_data->pressurecurve.values,
+					  driver_data->pressurecurve.sz);
+
 	return cubic_bezier(controls,
 			    driver_data->pressurecurve.values,
 			    driver_data->pressurecurve.sz);
@@ -443,6 +953,7 @@ xf86libinput_set_area_ratio(struct xf86libinput *driver_data,
 		return;
 
 	driver_data->options.area = *ratio;
+	driver_data->axis_plan.valid = false;
 
 	if (ratio->y == 0) {
 		driver_data->area_scale_factor.x = 1.0;
@@ -480,22 +991,35 @@ subdevice_has_capabilities(DeviceIntPtr dev, uint32_t capabilities)
 static int
 LibinputSetProperty(DeviceIntPtr dev, Atom atom, XIPropertyValuePtr val,
                  BOOL checkonly);
+static int
+LibinputGetProperty(DeviceIntPtr dev, Atom atom);
 static void
 LibinputInitProperty(DeviceIntPtr dev);
 
+/* The LibinputApplyConfig helpers only call into libinput for settings
+ * that differ from what the device already has, see
+ * xf86libinput_device.applied. A failed setting is left as-is there, so
+ * it is tried again next time.
+ */
 static void
 LibinputApplyConfigSendEvents(DeviceIntPtr dev,
 			      struct xf86libinput *driver_data,
 			      struct libinput_device *device)
 {
 	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct options *applied = &driver_data->shared_device->applied;
+
+	if (libinput_device_config_send_events_get_modes(device) == LIBINPUT_CONFIG_SEND_EVENTS_ENABLED ||
+	    driver_data->options.sendevents == applied->sendevents)
+		return;
 
-	if (libinput_device_config_send_events_get_modes(device) != LIBINPUT_CONFIG_SEND_EVENTS_ENABLED &&
-	    libinput_device_config_send_events_set_mode(device,
+	if (libinput_device_config_send_events_set_mode(device,
 							driver_data->options.sendevents) != LIBINPUT_CONFIG_STATUS_SUCCESS)
 		xf86IDrvMsg(pInfo, X_ERROR,
 			    "Failed to set SendEventsMode %u\n",
 			    driver_data->options.sendevents);
+	else
+		applied->sendevents = driver_data->options.sendevents;
 }
 
 static void
@@ -504,16 +1028,22 @@ LibinputApplyConfigNaturalScroll(DeviceIntPtr dev,
 				 struct libinput_device *device)
 {
 	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct options *applied = &driver_data->shared_device->applied;
 
 	if (!subdevice_has_capabilities(dev, CAP_POINTER))
 		return;
 
-	if (libinput_device_config_scroll_has_natural_scroll(device) &&
-	    libinput_device_config_scroll_set_natural_scroll_enabled(device,
+	if (!libinput_device_config_scroll_has_natural_scroll(device) ||
+	    driver_data->options.natural_scrolling == applied->natural_scrolling)
+		return;
+
+	if (libinput_device_config_scroll_set_natural_scroll_enabled(device,
 								     driver_data->options.natural_scrolling) != LIBINPUT_CONFIG_STATUS_SUCCESS)
 		xf86IDrvMsg(pInfo, X_ERROR,
 			    "Failed to set NaturalScrolling to %d\n",
 			    driver_data->options.natural_scrolling);
+	else
+		applied->natural_scrolling = driver_data->options.natural_scrolling;
 }
 
 static void
@@ -522,25 +1052,42 @@ LibinputApplyConfigAccel(DeviceIntPtr dev,
 			 struct libinput_device *device)
 {
 	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct options *applied = &driver_data->shared_device->applied;
+	enum libinput_config_accel_profile accel_profile = driver_data->options.accel_profile;
 
 	if (!subdevice_has_capabilities(dev, CAP_POINTER))
 		return;
 
+	/* Raw motion posts the unaccelerated deltas, the flat profile
+	 * is the least work for libinput. The configured profile comes
+	 * back when raw motion is disabled again */
+	if (driver_data->options.raw_motion)
+		accel_profile = LIBINPUT_CONFIG_ACCEL_PROFILE_FLAT;
+
 	if (libinput_device_config_accel_is_available(device) &&
-	    libinput_device_config_accel_set_speed(device,
-						   driver_data->options.speed) != LIBINPUT_CONFIG_STATUS_SUCCESS)
+	    driver_data->options.speed != applied->speed) {
+		if (libinput_device_config_accel_set_speed(device,
+							   driver_data->options.speed) != LIBINPUT_CONFIG_STATUS_SUCCESS)
 			xf86IDrvMsg(pInfo, X_ERROR,
 				    "Failed to set speed %.2f\n",
 				    driver_data->options.speed);
+		else
+			applied->speed = driver_data->options.speed;
+	}
 
 	if (libinput_device_config_accel_get_profiles(device) &&
-	    driver_data->options.accel_profile != LIBINPUT_CONFIG_ACCEL_PROFILE_NONE  &&
-	    libinput_device_config_accel_set_profile(device,
-						     driver_data->options.accel_profile) !=
-			    LIBINPUT_CONFIG_STATUS_SUCCESS) {
+	    accel_profile != LIBINPUT_CONFIG_ACCEL_PROFILE_NONE  &&
+	    accel_profile != applied->accel_profile) {
 		const char *profile;
 
-		switch (driver_data->options.accel_profile) {
+		if (libinput_device_config_accel_set_profile(device,
+							     accel_profile) ==
+				LIBINPUT_CONFIG_STATUS_SUCCESS) {
+			applied->accel_profile = accel_profile;
+			return;
+		}
+
+		switch (accel_profile) {
 		case LIBINPUT_CONFIG_ACCEL_PROFILE_ADAPTIVE:
 			profile = "adaptive";
 			break;
@@ -561,45 +1108,61 @@ LibinputApplyConfigTap(DeviceIntPtr dev,
 		       struct libinput_device *device)
 {
 	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct options *applied = &driver_data->shared_device->applied;
 
 	if (!subdevice_has_capabilities(dev, CAP_POINTER))
 		return;
 
-	if (libinput_device_config_tap_get_finger_count(device) > 0 &&
-	    libinput_device_config_tap_set_enabled(device,
-						   driver_data->options.tapping) != LIBINPUT_CONFIG_STATUS_SUCCESS)
-		xf86IDrvMsg(pInfo, X_ERROR,
-			    "Failed to set Tapping to %d\n",
-			    driver_data->options.tapping);
+	if (libinput_device_config_tap_get_finger_count(device) == 0)
+		return;
+
+	if (driver_data->options.tapping != applied->tapping) {
+		if (libinput_device_config_tap_set_enabled(device,
+							   driver_data->options.tapping) != LIBINPUT_CONFIG_STATUS_SUCCESS)
+			xf86IDrvMsg(pInfo, X_ERROR,
+				    "Failed to set Tapping to %d\n",
+				    driver_data->options.tapping);
+		else
+			applied->tapping = driver_data->options.tapping;
+	}
 
-	if (libinput_device_config_tap_get_finger_count(device) > 0 &&
-	    libinput_device_config_tap_set_button_map(device,
-						      driver_data->options.tap_button_map) != LIBINPUT_CONFIG_STATUS_SUCCESS) {
-		const char *map;
+	if (driver_data->options.tap_button_map != applied->tap_button_map) {
+		if (libinput_device_config_tap_set_button_map(device,
+							      driver_data->options.tap_button_map) != LIBINPUT_CONFIG_STATUS_SUCCESS) {
+			const char *map;
 
-		switch(driver_data->options.tap_button_map) {
-		case LIBINPUT_CONFIG_TAP_MAP_LRM: map = "lrm"; break;
-		case LIBINPUT_CONFIG_TAP_MAP_LMR: map = "lmr"; break;
-		default: map = "unknown"; break;
+			switch(driver_data->options.tap_button_map) {
+			case LIBINPUT_CONFIG_TAP_MAP_LRM: map = "lrm"; break;
+			case LIBINPUT_CONFIG_TAP_MAP_LMR: map = "lmr"; break;
+			default: map = "unknown"; break;
+			}
+			xf86IDrvMsg(pInfo, X_ERROR,
+				    "Failed to set Tapping ButtonMap to %s\n",
+				    map);
+		} else {
+			applied->tap_button_map = driver_data->options.tap_button_map;
 		}
-		xf86IDrvMsg(pInfo, X_ERROR,
-			    "Failed to set Tapping ButtonMap to %s\n",
-			    map);
 	}
 
-	if (libinput_device_config_tap_get_finger_count(device) > 0 &&
-	    libinput_device_config_tap_set_drag_lock_enabled(device,
-							     driver_data->options.tap_drag_lock) != LIBINPUT_CONFIG_STATUS_SUCCESS)
-		xf86IDrvMsg(pInfo, X_ERROR,
-			    "Failed to set Tapping DragLock to %d\n",
-			    driver_data->options.tap_drag_lock);
+	if (driver_data->options.tap_drag_lock != applied->tap_drag_lock) {
+		if (libinput_device_config_tap_set_drag_lock_enabled(device,
+								     driver_data->options.tap_drag_lock) != LIBINPUT_CONFIG_STATUS_SUCCESS)
+			xf86IDrvMsg(pInfo, X_ERROR,
+				    "Failed to set Tapping DragLock to %d\n",
+				    driver_data->options.tap_drag_lock);
+		else
+			applied->tap_drag_lock = driver_data->options.tap_drag_lock;
+	}
 
-	if (libinput_device_config_tap_get_finger_count(device) > 0 &&
-	    libinput_device_config_tap_set_drag_enabled(device,
-							driver_data->options.tap_drag) != LIBINPUT_CONFIG_STATUS_SUCCESS)
-		xf86IDrvMsg(pInfo, X_ERROR,
-			    "Failed to set Tapping Drag to %d\n",
-			    driver_data->options.tap_drag);
+	if (driver_data->options.tap_drag != applied->tap_drag) {
+		if (libinput_device_config_tap_set_drag_enabled(device,
+								driver_data->options.tap_drag) != LIBINPUT_CONFIG_STATUS_SUCCESS)
+			xf86IDrvMsg(pInfo, X_ERROR,
+				    "Failed to set Tapping Drag to %d\n",
+				    driver_data->options.tap_drag);
+		else
+			applied->tap_drag = driver_data->options.tap_drag;
+	}
 }
 
 static void
@@ -608,12 +1171,17 @@ LibinputApplyConfigCalibration(DeviceIntPtr dev,
 			       struct libinput_device *device)
 {
 	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct options *applied = &driver_data->shared_device->applied;
 
 	if (!subdevice_has_capabilities(dev, CAP_TOUCH|CAP_TABLET))
 		return;
 
-	if (libinput_device_config_calibration_has_matrix(device) &&
-	    libinput_device_config_calibration_set_matrix(device,
+	/* libinput only uses the first 6 values, the last row is fixed */
+	if (!libinput_device_config_calibration_has_matrix(device) ||
+	    memcmp(driver_data->options.matrix, applied->matrix, 6 * sizeof(float)) == 0)
+		return;
+
+	if (libinput_device_config_calibration_set_matrix(device,
 							  driver_data->options.matrix) != LIBINPUT_CONFIG_STATUS_SUCCESS)
 		xf86IDrvMsg(pInfo, X_ERROR,
 			    "Failed to apply matrix: "
@@ -623,6 +1191,8 @@ LibinputApplyConfigCalibration(DeviceIntPtr dev,
 			    driver_data->options.matrix[4], driver_data->options.matrix[5],
 			    driver_data->options.matrix[6], driver_data->options.matrix[7],
 			    driver_data->options.matrix[8]);
+	else
+		memcpy(applied->matrix, driver_data->options.matrix, sizeof(applied->matrix));
 }
 
 static void
@@ -631,16 +1201,22 @@ LibinputApplyConfigLeftHanded(DeviceIntPtr dev,
 			       struct libinput_device *device)
 {
 	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct options *applied = &driver_data->shared_device->applied;
 
 	if (!subdevice_has_capabilities(dev, CAP_POINTER|CAP_TABLET))
 		return;
 
-	if (libinput_device_config_left_handed_is_available(device) &&
-	    libinput_device_config_left_handed_set(device,
+	if (!libinput_device_config_left_handed_is_available(device) ||
+	    driver_data->options.left_handed == applied->left_handed)
+		return;
+
+	if (libinput_device_config_left_handed_set(device,
 						   driver_data->options.left_handed) != LIBINPUT_CONFIG_STATUS_SUCCESS)
 		xf86IDrvMsg(pInfo, X_ERROR,
 			    "Failed to set LeftHanded to %d\n",
 			    driver_data->options.left_handed);
+	else
+		applied->left_handed = driver_data->options.left_handed;
 }
 
 static void
@@ -649,29 +1225,35 @@ LibinputApplyConfigScrollMethod(DeviceIntPtr dev,
 				struct libinput_device *device)
 {
 	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct options *applied = &driver_data->shared_device->applied;
 
 	if (!subdevice_has_capabilities(dev, CAP_POINTER))
 		return;
 
-	if (libinput_device_config_scroll_set_method(device,
-						     driver_data->options.scroll_method) != LIBINPUT_CONFIG_STATUS_SUCCESS) {
-		const char *method;
+	if (driver_data->options.scroll_method != applied->scroll_method) {
+		if (libinput_device_config_scroll_set_method(device,
+							     driver_data->options.scroll_method) != LIBINPUT_CONFIG_STATUS_SUCCESS) {
+			const char *method;
+
+			switch(driver_data->options.scroll_method) {
+			case LIBINPUT_CONFIG_SCROLL_NO_SCROLL: method = "none"; break;
+			case LIBINPUT_CONFIG_SCROLL_2FG: method = "twofinger"; break;
+			case LIBINPUT_CONFIG_SCROLL_EDGE: method = "edge"; break;
+			case LIBINPUT_CONFIG_SCROLL_ON_BUTTON_DOWN: method = "button"; break;
+			default:
+				method = "unknown"; break;
+			}
 
-		switch(driver_data->options.scroll_method) {
-		case LIBINPUT_CONFIG_SCROLL_NO_SCROLL: method = "none"; break;
-		case LIBINPUT_CONFIG_SCROLL_2FG: method = "twofinger"; break;
-		case LIBINPUT_CONFIG_SCROLL_EDGE: method = "edge"; break;
-		case LIBINPUT_CONFIG_SCROLL_ON_BUTTON_DOWN: method = "button"; break;
-		default:
-			method = "unknown"; break;
+			xf86IDrvMsg(pInfo, X_ERROR,
+				    "Failed to set scroll to %s\n",
+				    method);
+		} else {
+			applied->scroll_method = driver_data->options.scroll_method;
 		}
-
-		xf86IDrvMsg(pInfo, X_ERROR,
-			    "Failed to set scroll to %s\n",
-			    method);
 	}
 
-	if (libinput_device_config_scroll_get_methods(device) & LIBINPUT_CONFIG_SCROLL_ON_BUTTON_DOWN) {
+	if ((libinput_device_config_scroll_get_methods(device) & LIBINPUT_CONFIG_SCROLL_ON_BUTTON_DOWN) &&
+	    driver_data->options.scroll_button != applied->scroll_button) {
 		unsigned int scroll_button;
 
 		scroll_button = btn_xorg2linux(driver_data->options.scroll_button);
@@ -679,6 +1261,8 @@ LibinputApplyConfigScrollMethod(DeviceIntPtr dev,
 			xf86IDrvMsg(pInfo, X_ERROR,
 				    "Failed to set ScrollButton to %u\n",
 				    driver_data->options.scroll_button);
+		else
+			applied->scroll_button = driver_data->options.scroll_button;
 	}
 }
 
@@ -688,26 +1272,32 @@ LibinputApplyConfigClickMethod(DeviceIntPtr dev,
 			       struct libinput_device *device)
 {
 	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct options *applied = &driver_data->shared_device->applied;
+	const char *method;
 
 	if (!subdevice_has_capabilities(dev, CAP_POINTER))
 		return;
 
-	if (libinput_device_config_click_set_method(device,
-						    driver_data->options.click_method) != LIBINPUT_CONFIG_STATUS_SUCCESS) {
-		const char *method;
+	if (driver_data->options.click_method == applied->click_method)
+		return;
 
-		switch (driver_data->options.click_method) {
-		case LIBINPUT_CONFIG_CLICK_METHOD_NONE: method = "none"; break;
-		case LIBINPUT_CONFIG_CLICK_METHOD_BUTTON_AREAS: method = "buttonareas"; break;
-		case LIBINPUT_CONFIG_CLICK_METHOD_CLICKFINGER: method = "clickfinger"; break;
-		default:
-			method = "unknown"; break;
-		}
+	if (libinput_device_config_click_set_method(device,
+						    driver_data->options.click_method) == LIBINPUT_CONFIG_STATUS_SUCCESS) {
+		applied->click_method = driver_data->options.click_method;
+		return;
+	}
 
-		xf86IDrvMsg(pInfo, X_ERROR,
-			    "Failed to set click method to %s\n",
-			    method);
+	switch (driver_data->options.click_method) {
+	case LIBINPUT_CONFIG_CLICK_METHOD_NONE: method = "none"; break;
+	case LIBINPUT_CONFIG_CLICK_METHOD_BUTTON_AREAS: method = "buttonareas"; break;
+	case LIBINPUT_CONFIG_CLICK_METHOD_CLICKFINGER: method = "clickfinger"; break;
+	default:
+		method = "unknown"; break;
 	}
+
+	xf86IDrvMsg(pInfo, X_ERROR,
+		    "Failed to set click method to %s\n",
+		    method);
 }
 
 static void
@@ -716,16 +1306,22 @@ LibinputApplyConfigMiddleEmulation(DeviceIntPtr dev,
 				   struct libinput_device *device)
 {
 	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct options *applied = &driver_data->shared_device->applied;
 
 	if (!subdevice_has_capabilities(dev, CAP_POINTER))
 		return;
 
-	if (libinput_device_config_middle_emulation_is_available(device) &&
-	    libinput_device_config_middle_emulation_set_enabled(device,
+	if (!libinput_device_config_middle_emulation_is_available(device) ||
+	    driver_data->options.middle_emulation == applied->middle_emulation)
+		return;
+
+	if (libinput_device_config_middle_emulation_set_enabled(device,
 								driver_data->options.middle_emulation) != LIBINPUT_CONFIG_STATUS_SUCCESS)
 		xf86IDrvMsg(pInfo, X_ERROR,
 			    "Failed to set MiddleEmulation to %d\n",
 			    driver_data->options.middle_emulation);
+	else
+		applied->middle_emulation = driver_data->options.middle_emulation;
 }
 
 static void
@@ -734,16 +1330,22 @@ LibinputApplyConfigDisableWhileTyping(DeviceIntPtr dev,
 				      struct libinput_device *device)
 {
 	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct options *applied = &driver_data->shared_device->applied;
 
 	if (!subdevice_has_capabilities(dev, CAP_POINTER))
 		return;
 
-	if (libinput_device_config_dwt_is_available(device) &&
-	    libinput_device_config_dwt_set_enabled(device,
+	if (!libinput_device_config_dwt_is_available(device) ||
+	    driver_data->options.disable_while_typing == applied->disable_while_typing)
+		return;
+
+	if (libinput_device_config_dwt_set_enabled(device,
 						   driver_data->options.disable_while_typing) != LIBINPUT_CONFIG_STATUS_SUCCESS)
 		xf86IDrvMsg(pInfo, X_ERROR,
 			    "Failed to set DisableWhileTyping to %d\n",
 			    driver_data->options.disable_while_typing);
+	else
+		applied->disable_while_typing = driver_data->options.disable_while_typing;
 }
 
 static void
@@ -752,15 +1354,21 @@ LibinputApplyConfigRotation(DeviceIntPtr dev,
 			    struct libinput_device *device)
 {
 	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct options *applied = &driver_data->shared_device->applied;
 
 	if (!subdevice_has_capabilities(dev, CAP_POINTER))
 		return;
 
-	if (libinput_device_config_rotation_is_available(device) &&
-	    libinput_device_config_rotation_set_angle(device, driver_data->options.rotation_angle) != LIBINPUT_CONFIG_STATUS_SUCCESS)
+	if (!libinput_device_config_rotation_is_available(device) ||
+	    driver_data->options.rotation_angle == applied->rotation_angle)
+		return;
+
+	if (libinput_device_config_rotation_set_angle(device, driver_data->options.rotation_angle) != LIBINPUT_CONFIG_STATUS_SUCCESS)
 		xf86IDrvMsg(pInfo, X_ERROR,
 			    "Failed to set RotationAngle to %.2f\n",
 			    driver_data->options.rotation_angle);
+	else
+		applied->rotation_angle = driver_data->options.rotation_angle;
 }
 
 static inline void
@@ -789,7 +1397,7 @@ xf86libinput_on(DeviceIntPtr dev)
 	InputInfoPtr pInfo = dev->public.devicePrivate;
 	struct xf86libinput *driver_data = pInfo->private;
 	struct xf86libinput_device *shared_device = driver_data->shared_device;
-	struct libinput *libinput = driver_context.libinput;
+	struct xf86libinput_context *context = shared_device->context;
 	struct libinput_device *device;
 
 	device = xf86libinput_shared_enable(pInfo,
@@ -802,18 +1410,19 @@ xf86libinput_on(DeviceIntPtr dev)
 	   libinput nonetheless, otherwise the server won't call ReadInput
 	   for our device. This must be swapped back to the real fd in
 	   DEVICE_OFF so systemd-logind closes the right fd */
-	pInfo->fd = libinput_get_fd(libinput);
+	pInfo->fd = libinput_get_fd(context->libinput);
 
-	if (driver_context.device_enabled_count == 0) {
+	if (context->device_enabled_count == 0) {
 #if HAVE_THREADED_INPUT
 		xf86AddEnabledDevice(pInfo);
-		driver_context.registered_InputInfoPtr = pInfo;
+		context->registered_InputInfoPtr = pInfo;
 #else
 		/* Can't use xf86AddEnabledDevice on an epollfd */
 		AddEnabledDevice(pInfo->fd);
 #endif
 	}
 
+	context->device_enabled_count++;
 	driver_context.device_enabled_count++;
 	dev->public.on = TRUE;
 
@@ -828,8 +1437,9 @@ xf86libinput_off(DeviceIntPtr dev)
 	InputInfoPtr pInfo = dev->public.devicePrivate;
 	struct xf86libinput *driver_data = pInfo->private;
 	struct xf86libinput_device *shared_device = driver_data->shared_device;
+	struct xf86libinput_context *context = shared_device->context;
 
-	if (--driver_context.device_enabled_count == 0) {
+	if (--context->device_enabled_count == 0) {
 #if HAVE_THREADED_INPUT
 		xf86RemoveEnabledDevice(pInfo);
 #else
@@ -837,6 +1447,11 @@ xf86libinput_off(DeviceIntPtr dev)
 #endif
 	}
 
+	if (--driver_context.device_enabled_count == 0) {
+		TimerFree(driver_context.deferred_timer);
+		driver_context.deferred_timer = NULL;
+	}
+
 	if (use_server_fd(pInfo)) {
 		pInfo->fd = xf86SetIntOption(pInfo->options, "fd", -1);
 	} else {
@@ -844,6 +1459,12 @@ xf86libinput_off(DeviceIntPtr dev)
 	}
 
 	dev->public.on = FALSE;
+	xf86libinput_discard_tablet_axis(driver_data);
+	if (driver_data->touch.slots) {
+		memset(driver_data->touch.slots, 0,
+		       driver_data->touch.nslots * sizeof(*driver_data->touch.slots));
+		driver_data->touch.npending = 0;
+	}
 
 	xf86libinput_shared_disable(shared_device);
 
@@ -894,6 +1515,23 @@ init_axis_labels(Atom *labels, size_t size)
 	labels[3] = XIGetKnownProperty(AXIS_LABEL_PROP_REL_VSCROLL);
 }
 
+static inline void
+init_gesture_axis_labels(Atom *labels)
+{
+	const char *names[GESTURE_NUM_AXES] = {
+		LIBINPUT_AXIS_LABEL_GESTURE_SWIPE_X,
+		LIBINPUT_AXIS_LABEL_GESTURE_SWIPE_Y,
+		LIBINPUT_AXIS_LABEL_GESTURE_PINCH_SCALE,
+		LIBINPUT_AXIS_LABEL_GESTURE_PINCH_ROTATION,
+	};
+	int i;
+
+	for (i = 0; i < GESTURE_NUM_AXES; i++)
+		labels[TOUCHPAD_NUM_AXES + i] = MakeAtom(names[i],
+							 strlen(names[i]),
+							 TRUE);
+}
+
 static int
 xf86libinput_init_pointer(InputInfoPtr pInfo)
 {
@@ -902,10 +1540,11 @@ xf86libinput_init_pointer(InputInfoPtr pInfo)
 	struct libinput_device *device = driver_data->shared_device->device;
 	int min, max, res;
 	int nbuttons = 7;
+	int naxes = TOUCHPAD_NUM_AXES;
 	int i;
 
 	Atom btnlabels[MAX_BUTTONS];
-	Atom axislabels[TOUCHPAD_NUM_AXES];
+	Atom axislabels[TOUCHPAD_NUM_AXES + GESTURE_NUM_AXES];
 
 	for (i = BTN_JOYSTICK - 1; i >= BTN_SIDE; i--) {
 		if (libinput_device_pointer_has_button(device, i)) {
@@ -917,13 +1556,20 @@ xf86libinput_init_pointer(InputInfoPtr pInfo)
 	init_button_labels(btnlabels, ARRAY_SIZE(btnlabels));
 	init_axis_labels(axislabels, ARRAY_SIZE(axislabels));
 
+	driver_data->gesture.enabled = driver_data->options.gesture_passthrough &&
+		libinput_device_has_capability(device, LIBINPUT_DEVICE_CAP_GESTURE);
+	if (driver_data->gesture.enabled) {
+		init_gesture_axis_labels(axislabels);
+		naxes += GESTURE_NUM_AXES;
+	}
+
 	InitPointerDeviceStruct((DevicePtr)dev,
 				driver_data->options.btnmap,
 				nbuttons,
 				btnlabels,
 				xf86libinput_ptr_ctl,
 				GetMotionHistorySize(),
-				TOUCHPAD_NUM_AXES,
+				naxes,
 				axislabels);
 	min = -1;
 	max = -1;
@@ -939,6 +1585,11 @@ xf86libinput_init_pointer(InputInfoPtr pInfo)
 	SetScrollValuator(dev, 2, SCROLL_TYPE_HORIZONTAL, driver_data->scroll.hdist, 0);
 	SetScrollValuator(dev, 3, SCROLL_TYPE_VERTICAL, driver_data->scroll.vdist, 0);
 
+	/* All gesture axes are deltas, the pinch scale too */
+	for (i = TOUCHPAD_NUM_AXES; i < naxes; i++)
+		xf86InitValuatorAxisStruct(dev, i, axislabels[i],
+					   min, max, res * 1000, 0, res * 1000, Relative);
+
 	return Success;
 }
 
@@ -1096,11 +1747,19 @@ xf86libinput_init_touch(InputInfoPtr pInfo)
 #endif
 	InitTouchClassDeviceStruct(dev, ntouches, XIDirectTouch, 2);
 
+	driver_data->touch.slots = calloc(ntouches,
+					  sizeof(*driver_data->touch.slots));
+	if (driver_data->touch.slots)
+		driver_data->touch.nslots = ntouches;
+	else
+		xf86IDrvMsg(pInfo, X_ERROR,
+			    "Failed to allocate touch slots\n");
+
 }
 
 static int
 xf86libinput_init_tablet_pen_or_eraser(InputInfoPtr pInfo,
-				       struct libinput_tablet_tool *tool)
+				       const struct tool_registry_entry *desc)
 {
 	DeviceIntPtr dev = pInfo->dev;
 	int min, max, res;
@@ -1110,13 +1769,13 @@ xf86libinput_init_tablet_pen_or_eraser(InputInfoPtr pInfo,
 	max = TABLET_PRESSURE_AXIS_MAX;
 	res = 0;
 	axis = 2;
-	if (libinput_tablet_tool_has_pressure(tool))
+	if (desc->axes & TOOL_AXIS_PRESSURE)
 		xf86InitValuatorAxisStruct(dev, axis++,
 					   XIGetKnownProperty(AXIS_LABEL_PROP_ABS_PRESSURE),
 					   min, max, res * 1000, 0, res * 1000, Absolute);
 	max = TABLET_TILT_AXIS_MAX;
 	min = -TABLET_TILT_AXIS_MAX;
-	if (libinput_tablet_tool_has_tilt(tool)) {
+	if (desc->axes & TOOL_AXIS_TILT) {
 		xf86InitValuatorAxisStruct(dev, axis++,
 					   XIGetKnownProperty(AXIS_LABEL_PROP_ABS_TILT_X),
 					   min, max, res * 1000, 0, res * 1000, Absolute);
@@ -1127,7 +1786,7 @@ xf86libinput_init_tablet_pen_or_eraser(InputInfoPtr pInfo,
 
 	min = -TABLET_AXIS_MAX;
 	max = TABLET_AXIS_MAX;
-	if (libinput_tablet_tool_has_rotation(tool))
+	if (desc->axes & TOOL_AXIS_ROTATION)
 		xf86InitValuatorAxisStruct(dev, axis++,
 					   XIGetKnownProperty(AXIS_LABEL_PROP_ABS_RZ),
 					   min, max, res * 1000, 0, res * 1000, Absolute);
@@ -1136,20 +1795,20 @@ xf86libinput_init_tablet_pen_or_eraser(InputInfoPtr pInfo,
 
 static void
 xf86libinput_init_tablet_airbrush(InputInfoPtr pInfo,
-				  struct libinput_tablet_tool *tool)
+				  const struct tool_registry_entry *desc)
 {
 	DeviceIntPtr dev = pInfo->dev;
 	int min, max, res;
 	int axis;
 
 	/* first axes are shared */
-	axis = xf86libinput_init_tablet_pen_or_eraser(pInfo, tool);
+	axis = xf86libinput_init_tablet_pen_or_eraser(pInfo, desc);
 	if (axis < 5) {
 		xf86IDrvMsg(pInfo, X_ERROR, "Airbrush tool has missing pressure or tilt axes\n");
 		return;
 	}
 
-	if (!libinput_tablet_tool_has_slider(tool)) {
+	if (!(desc->axes & TOOL_AXIS_SLIDER)) {
 		xf86IDrvMsg(pInfo, X_ERROR, "Airbrush tool is missing the slider axis\n");
 		return;
 	}
@@ -1165,13 +1824,13 @@ xf86libinput_init_tablet_airbrush(InputInfoPtr pInfo,
 
 static void
 xf86libinput_init_tablet_mouse(InputInfoPtr pInfo,
-			       struct libinput_tablet_tool *tool)
+			       const struct tool_registry_entry *desc)
 {
 	DeviceIntPtr dev = pInfo->dev;
 	int min, max, res;
 	int axis;
 
-	if (!libinput_tablet_tool_has_rotation(tool)) {
+	if (!(desc->axes & TOOL_AXIS_ROTATION)) {
 		xf86IDrvMsg(pInfo, X_ERROR, "Mouse tool is missing the rotation axis\n");
 		return;
 	}
@@ -1201,7 +1860,7 @@ xf86libinput_init_tablet(InputInfoPtr pInfo)
 {
 	DeviceIntPtr dev = pInfo->dev;
 	struct xf86libinput *driver_data = pInfo->private;
-	struct libinput_tablet_tool *tool;
+	const struct tool_registry_entry *desc = &driver_data->tool_desc;
 	int min, max, res;
 	unsigned char btnmap[TABLET_NUM_BUTTONS];
 	Atom btnlabels[TABLET_NUM_BUTTONS] = {0};
@@ -1209,19 +1868,17 @@ xf86libinput_init_tablet(InputInfoPtr pInfo)
 	int nbuttons = TABLET_NUM_BUTTONS;
 	int naxes = 2;
 
-	BUG_RETURN(driver_data->tablet_tool == NULL);
-
-	tool = driver_data->tablet_tool;
+	BUG_RETURN(desc->type == 0);
 
 	init_button_map(btnmap, ARRAY_SIZE(btnmap));
 
-	if (libinput_tablet_tool_has_pressure(tool))
+	if (desc->axes & TOOL_AXIS_PRESSURE)
 		naxes++;
-	if (libinput_tablet_tool_has_tilt(tool))
+	if (desc->axes & TOOL_AXIS_TILT)
 		naxes += 2;
-	if (libinput_tablet_tool_has_slider(tool))
+	if (desc->axes & TOOL_AXIS_SLIDER)
 		naxes++;
-	if (libinput_tablet_tool_has_rotation(tool))
+	if (desc->axes & TOOL_AXIS_ROTATION)
 		naxes++;
 
 	InitPointerDeviceStruct((DevicePtr)dev,
@@ -1243,17 +1900,17 @@ xf86libinput_init_tablet(InputInfoPtr pInfo)
 			           XIGetKnownProperty(AXIS_LABEL_PROP_ABS_Y),
 				   min, max, res * 1000, 0, res * 1000, Absolute);
 
-	switch (libinput_tablet_tool_get_type(tool)) {
+	switch (desc->type) {
 	case LIBINPUT_TABLET_TOOL_TYPE_PEN:
 	case LIBINPUT_TABLET_TOOL_TYPE_ERASER:
-		xf86libinput_init_tablet_pen_or_eraser(pInfo, tool);
+		xf86libinput_init_tablet_pen_or_eraser(pInfo, desc);
 		break;
 	case LIBINPUT_TABLET_TOOL_TYPE_AIRBRUSH:
-		xf86libinput_init_tablet_airbrush(pInfo, tool);
+		xf86libinput_init_tablet_airbrush(pInfo, desc);
 		break;
 	case LIBINPUT_TABLET_TOOL_TYPE_MOUSE:
 	case LIBINPUT_TABLET_TOOL_TYPE_LENS:
-		xf86libinput_init_tablet_mouse(pInfo, tool);
+		xf86libinput_init_tablet_mouse(pInfo, desc);
 		break;
 	default:
 		xf86IDrvMsg(pInfo, X_ERROR, "Tool type not supported yet\n");
@@ -1272,13 +1929,22 @@ xf86libinput_init_tablet_pad(InputInfoPtr pInfo)
 	int min, max, res;
 	unsigned char btnmap[MAX_BUTTONS];
 	Atom btnlabels[MAX_BUTTONS] = {0};
-	Atom axislabels[TOUCHPAD_NUM_AXES] = {0};
+	Atom axislabels[TABLET_PAD_NUM_AXES] = {0};
 	int nbuttons;
 	int naxes = 7;
+	size_t i;
 
 	nbuttons = libinput_device_tablet_pad_get_num_buttons(device) + 4;
 	init_button_map(btnmap, nbuttons);
 
+	if (driver_data->options.pad_scrolling)
+		naxes = TABLET_PAD_NUM_AXES;
+
+	for (i = 0; i < ARRAY_SIZE(driver_data->pad.ring); i++) {
+		driver_data->pad.ring[i] = -1;
+		driver_data->pad.strip[i] = -1;
+	}
+
 	InitPointerDeviceStruct((DevicePtr)dev,
 				driver_data->options.btnmap,
 				nbuttons,
@@ -1321,6 +1987,23 @@ xf86libinput_init_tablet_pad(InputInfoPtr pInfo)
 	xf86InitValuatorAxisStruct(dev, 6,
 			           None,
 				   min, max, res * 1000, 0, res * 1000, Absolute);
+
+	if (!driver_data->options.pad_scrolling)
+		return;
+
+	/* ring and strip deltas, see "TabletPadScrolling" */
+	min = -1;
+	max = -1;
+	xf86InitValuatorAxisStruct(dev, TABLET_PAD_AXIS_RING_SCROLL,
+				   XIGetKnownProperty(AXIS_LABEL_PROP_REL_VSCROLL),
+				   min, max, res * 1000, 0, res * 1000, Relative);
+	xf86InitValuatorAxisStruct(dev, TABLET_PAD_AXIS_STRIP_SCROLL,
+				   XIGetKnownProperty(AXIS_LABEL_PROP_REL_VSCROLL),
+				   min, max, res * 1000, 0, res * 1000, Relative);
+	SetScrollValuator(dev, TABLET_PAD_AXIS_RING_SCROLL, SCROLL_TYPE_VERTICAL,
+			  TABLET_RING_SCROLL_INCREMENT, 0);
+	SetScrollValuator(dev, TABLET_PAD_AXIS_STRIP_SCROLL, SCROLL_TYPE_VERTICAL,
+			  TABLET_STRIP_SCROLL_INCREMENT, 0);
 }
 
 static int
@@ -1353,13 +2036,15 @@ xf86libinput_init(DeviceIntPtr dev)
 
 	LibinputApplyConfig(dev);
 	LibinputInitProperty(dev);
-	XIRegisterPropertyHandler(dev, LibinputSetProperty, NULL, NULL);
+	XIRegisterPropertyHandler(dev, LibinputSetProperty, LibinputGetProperty, NULL);
 
 	/* If we have a device but it's not yet enabled it's the
 	 * already-removed device from PreInit. Drop the ref to clean up,
 	 * we'll get a new libinput_device during DEVICE_ON when we re-add
-	 * it. */
-	if (!xf86libinput_shared_is_enabled(shared_device)) {
+	 * it. A probed device stays in the context with its PreInit ref
+	 * until it is resumed or the shared device goes away. */
+	if (!xf86libinput_shared_is_enabled(shared_device) &&
+	    !shared_device->probed) {
 		libinput_device_unref(device);
 		shared_device->device = NULL;
 	}
@@ -1380,16 +2065,30 @@ is_libinput_device(InputInfoPtr pInfo)
 	return rc;
 }
 
-static void
-swap_registered_device(InputInfoPtr pInfo)
+static inline struct xf86libinput_context *
+xf86libinput_get_context(InputInfoPtr pInfo)
 {
-	InputInfoPtr next;
+	struct xf86libinput *driver_data = pInfo->private;
 
-	if (pInfo != driver_context.registered_InputInfoPtr)
-		return;
+	if (!driver_data)
+		return NULL;
+
+	return driver_data->shared_device->context;
+}
+
+static void
+swap_registered_device(InputInfoPtr pInfo)
+{
+	struct xf86libinput_context *context = xf86libinput_get_context(pInfo);
+	InputInfoPtr next;
+
+	if (pInfo != context->registered_InputInfoPtr)
+		return;
 
+	/* must be one with the same fd, i.e. the same context */
 	next = xf86FirstLocalDevice();
-	while (next == pInfo || !is_libinput_device(next))
+	while (next == pInfo || !is_libinput_device(next) ||
+	       xf86libinput_get_context(next) != context)
 		next = next->next;
 
 #if HAVE_THREADED_INPUT
@@ -1399,7 +2098,7 @@ swap_registered_device(InputInfoPtr pInfo)
 #endif
 	xf86RemoveEnabledDevice(pInfo);
 	xf86AddEnabledDevice(next);
-	driver_context.registered_InputInfoPtr = next;
+	context->registered_InputInfoPtr = next;
 #if HAVE_THREADED_INPUT
 	input_unlock();
 #else
@@ -1422,10 +2121,11 @@ xf86libinput_destroy(DeviceIntPtr dev)
 	 * Avoid this by removing ours and substituting one that's still
 	 * valid, the fd is the same anyway (libinput's epollfd).
 	 */
-	if (driver_context.device_enabled_count > 0)
+	if (shared_device->context->device_enabled_count > 0)
 		swap_registered_device(pInfo);
 
 	xorg_list_del(&driver_data->shared_device_link);
+	xf86libinput_shared_invalidate_route(shared_device);
 
 	if (driver_data->tablet_tool)
 		libinput_tablet_tool_unref(driver_data->tablet_tool);
@@ -1457,48 +2157,295 @@ xf86libinput_device_control(DeviceIntPtr dev, int mode)
 	return rc;
 }
 
+static inline uint64_t
+xf86libinput_now_usec(void)
+{
+	struct timespec ts;
+
+	/* libinput timestamps are CLOCK_MONOTONIC */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec/1000;
+}
+
+/* One record per event posted to the server, see "EventTrace" */
 static void
-xf86libinput_handle_motion(InputInfoPtr pInfo, struct libinput_event_pointer *event)
+xf86libinput_trace_posted(DeviceIntPtr dev,
+			  enum trace_posted_type type,
+			  uint32_t code,
+			  uint32_t state,
+			  const ValuatorMask *mask)
+{
+	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct xf86libinput *driver_data = pInfo->private;
+	struct trace_record *r;
+	int i;
+
+	r = trace_next(&driver_context.trace);
+	memset(r, 0, sizeof(*r));
+
+	r->device = driver_data->shared_device->id;
+	r->type = TRACE_POSTED | type;
+	r->time = xf86libinput_now_usec();
+	r->handled = r->time;
+	r->code = code;
+	r->state = state;
+
+	for (i = 0; mask && i < TRACE_NUM_VALUES; i++) {
+		if (!valuator_mask_isset(mask, i))
+			continue;
+		r->axes |= 1 << i;
+		r->values[i] = valuator_mask_get_double(mask, i);
+	}
+
+	trace_commit(&driver_context.trace);
+}
+
+/* The xf86Post* calls, plus a record in the trace if it's enabled */
+static inline void
+xf86libinput_post_motion_event(DeviceIntPtr dev, int is_absolute,
+			       const ValuatorMask *mask)
+{
+	xf86PostMotionEventM(dev, is_absolute, mask);
+	if (driver_context.trace.header)
+		xf86libinput_trace_posted(dev, TRACE_POSTED_MOTION, 0,
+					  is_absolute, mask);
+}
+
+static inline void
+xf86libinput_post_button_event(DeviceIntPtr dev, int is_absolute,
+			       int button, int is_press)
+{
+	xf86PostButtonEventP(dev, is_absolute, button, is_press, 0, 0, NULL);
+	if (driver_context.trace.header)
+		xf86libinput_trace_posted(dev, TRACE_POSTED_BUTTON, button,
+					  is_press, NULL);
+}
+
+static inline void
+xf86libinput_post_key_event(DeviceIntPtr dev, unsigned int key, int is_press)
+{
+	xf86PostKeyboardEvent(dev, key, is_press);
+	if (driver_context.trace.header)
+		xf86libinput_trace_posted(dev, TRACE_POSTED_KEY, key,
+					  is_press, NULL);
+}
+
+static inline void
+xf86libinput_post_touch_event(DeviceIntPtr dev, uint32_t touchid,
+			      uint16_t type, const ValuatorMask *mask)
+{
+	xf86PostTouchEvent(dev, touchid, type, 0, mask);
+	if (driver_context.trace.header)
+		xf86libinput_trace_posted(dev, TRACE_POSTED_TOUCH, touchid,
+					  type, mask);
+}
+
+static inline void
+xf86libinput_post_proximity_event(DeviceIntPtr dev, int in_prox,
+				  const ValuatorMask *mask)
+{
+	xf86PostProximityEventM(dev, in_prox, mask);
+	if (driver_context.trace.header)
+		xf86libinput_trace_posted(dev, TRACE_POSTED_PROXIMITY, 0,
+					  in_prox, mask);
+}
+
+static void
+xf86libinput_post_motion(InputInfoPtr pInfo,
+			 double x, double y,
+			 double ux, double uy)
+{
+	struct xf86libinput *driver_data = pInfo->private;
+	ValuatorMask *mask = driver_data->valuators;
+
+	valuator_mask_zero(mask);
+
+#if HAVE_VMASK_UNACCEL
+	valuator_mask_set_unaccelerated(mask, 0, x, ux);
+	valuator_mask_set_unaccelerated(mask, 1, y, uy);
+#else
+	valuator_mask_set_double(mask, 0, x);
+	valuator_mask_set_double(mask, 1, y);
+#endif
+	xf86libinput_post_motion_event(pInfo->dev, Relative, mask);
+}
+
+static void
+xf86libinput_post_absmotion(InputInfoPtr pInfo, double x, double y)
 {
-	DeviceIntPtr dev = pInfo->dev;
 	struct xf86libinput *driver_data = pInfo->private;
 	ValuatorMask *mask = driver_data->valuators;
+
+	valuator_mask_zero(mask);
+	valuator_mask_set_double(mask, 0, x);
+	valuator_mask_set_double(mask, 1, y);
+
+	xf86libinput_post_motion_event(pInfo->dev, Absolute, mask);
+}
+
+static void
+xf86libinput_flush_motion(void)
+{
+	struct motion_batch *batch = &driver_context.motion_batch;
+	InputInfoPtr pInfo = batch->pInfo;
+
+	if (!pInfo)
+		return;
+
+	batch->pInfo = NULL;
+
+	if (batch->absolute)
+		xf86libinput_post_absmotion(pInfo, batch->x, batch->y);
+	else
+		xf86libinput_post_motion(pInfo,
+					 batch->x, batch->y,
+					 batch->ux, batch->uy);
+}
+
+/* Merge the motion into the pending batch: relative deltas are summed,
+ * for absolute motion only the most recent position matters. A batch
+ * only ever covers one device and one type of motion.
+ */
+static void
+xf86libinput_batch_motion(InputInfoPtr pInfo,
+			  bool absolute,
+			  double x, double y,
+			  double ux, double uy)
+{
+	struct motion_batch *batch = &driver_context.motion_batch;
+
+	if (batch->pInfo != pInfo || batch->absolute != absolute)
+		xf86libinput_flush_motion();
+
+	if (!batch->pInfo) {
+		batch->pInfo = pInfo;
+		batch->absolute = absolute;
+		batch->x = 0.0;
+		batch->y = 0.0;
+		batch->ux = 0.0;
+		batch->uy = 0.0;
+	}
+
+	if (absolute) {
+		batch->x = x;
+		batch->y = y;
+	} else {
+		batch->x += x;
+		batch->y += y;
+		batch->ux += ux;
+		batch->uy += uy;
+	}
+}
+
+/* Whole device units of the unaccelerated deltas only, the rest is kept
+ * for the next event */
+static void
+xf86libinput_post_raw_motion(InputInfoPtr pInfo,
+			     struct libinput_event_pointer *event)
+{
+	struct xf86libinput *driver_data = pInfo->private;
+	ValuatorMask *mask = driver_data->valuators_unaccelerated;
 	double x, y;
+	int dx, dy;
+
+	x = libinput_event_pointer_get_dx_unaccelerated(event) + driver_data->scale.x_remainder;
+	y = libinput_event_pointer_get_dy_unaccelerated(event) + driver_data->scale.y_remainder;
+	dx = (int)x;
+	dy = (int)y;
+	driver_data->scale.x_remainder = x - dx;
+	driver_data->scale.y_remainder = y - dy;
+
+	if (dx == 0 && dy == 0)
+		return;
+
+	valuator_mask_zero(mask);
+	if (dx)
+		valuator_mask_set(mask, 0, dx);
+	if (dy)
+		valuator_mask_set(mask, 1, dy);
+	xf86libinput_post_motion_event(pInfo->dev, Relative, mask);
+}
+
+static void
+xf86libinput_handle_motion(InputInfoPtr pInfo, struct libinput_event_pointer *event)
+{
+	struct xf86libinput *driver_data = pInfo->private;
+	double x, y, ux = 0.0, uy = 0.0;
 
 	if ((driver_data->capabilities & CAP_POINTER) == 0)
 		return;
 
+	/* not batched, the remainders merge the small deltas already */
+	if (driver_data->options.raw_motion) {
+		xf86libinput_flush_motion();
+		xf86libinput_post_raw_motion(pInfo, event);
+		return;
+	}
+
 	x = libinput_event_pointer_get_dx(event);
 	y = libinput_event_pointer_get_dy(event);
+#if HAVE_VMASK_UNACCEL
+	ux = libinput_event_pointer_get_dx_unaccelerated(event);
+	uy = libinput_event_pointer_get_dy_unaccelerated(event);
+#endif
 
-	valuator_mask_zero(mask);
+	if (driver_data->options.motion_batching) {
+		xf86libinput_batch_motion(pInfo, false, x, y, ux, uy);
+		return;
+	}
 
-#if HAVE_VMASK_UNACCEL
-	{
-		double ux, uy;
+	xf86libinput_flush_motion();
+	xf86libinput_post_motion(pInfo, x, y, ux, uy);
+}
 
-		ux = libinput_event_pointer_get_dx_unaccelerated(event);
-		uy = libinput_event_pointer_get_dy_unaccelerated(event);
+static void
+xf86libinput_handle_gesture(InputInfoPtr pInfo,
+			    struct libinput_event_gesture *event,
+			    enum libinput_event_type type)
+{
+	struct xf86libinput *driver_data = pInfo->private;
+	ValuatorMask *mask = driver_data->valuators;
+	double scale;
+
+	if (!driver_data->gesture.enabled)
+		return;
+
+	valuator_mask_zero(mask);
 
-		valuator_mask_set_unaccelerated(mask, 0, x, ux);
-		valuator_mask_set_unaccelerated(mask, 1, y, uy);
+	switch (type) {
+	case LIBINPUT_EVENT_GESTURE_SWIPE_UPDATE:
+		valuator_mask_set_double(mask, GESTURE_AXIS_SWIPE_X,
+					 libinput_event_gesture_get_dx(event));
+		valuator_mask_set_double(mask, GESTURE_AXIS_SWIPE_Y,
+					 libinput_event_gesture_get_dy(event));
+		break;
+	case LIBINPUT_EVENT_GESTURE_PINCH_BEGIN:
+		driver_data->gesture.scale = 1.0;
+		return;
+	case LIBINPUT_EVENT_GESTURE_PINCH_UPDATE:
+		scale = libinput_event_gesture_get_scale(event);
+		valuator_mask_set_double(mask, GESTURE_AXIS_PINCH_SCALE,
+					 scale - driver_data->gesture.scale);
+		valuator_mask_set_double(mask, GESTURE_AXIS_PINCH_ROTATION,
+					 libinput_event_gesture_get_angle_delta(event));
+		driver_data->gesture.scale = scale;
+		break;
+	default:
+		return;
 	}
-#else
-	valuator_mask_set_double(mask, 0, x);
-	valuator_mask_set_double(mask, 1, y);
-#endif
-	xf86PostMotionEventM(dev, Relative, mask);
+
+	xf86libinput_post_motion_event(pInfo->dev, Relative, mask);
 }
 
 static void
 xf86libinput_handle_absmotion(InputInfoPtr pInfo, struct libinput_event_pointer *event)
 {
-	DeviceIntPtr dev = pInfo->dev;
 	struct xf86libinput *driver_data = pInfo->private;
-	ValuatorMask *mask = driver_data->valuators;
 	double x, y;
 
 	if (!driver_data->has_abs) {
+		driver_data->counters.discarded_abs++;
 		xf86IDrvMsg(pInfo, X_ERROR,
 			    "Discarding absolute event from relative device. "
 			    "Please file a bug\n");
@@ -1511,11 +2458,13 @@ xf86libinput_handle_absmotion(InputInfoPtr pInfo, struct libinput_event_pointer
 	x = libinput_event_pointer_get_absolute_x_transformed(event, TOUCH_AXIS_MAX);
 	y = libinput_event_pointer_get_absolute_y_transformed(event, TOUCH_AXIS_MAX);
 
-	valuator_mask_zero(mask);
-	valuator_mask_set_double(mask, 0, x);
-	valuator_mask_set_double(mask, 1, y);
+	if (driver_data->options.motion_batching) {
+		xf86libinput_batch_motion(pInfo, true, x, y, 0.0, 0.0);
+		return;
+	}
 
-	xf86PostMotionEventM(dev, Absolute, mask);
+	xf86libinput_flush_motion();
+	xf86libinput_post_absmotion(pInfo, x, y);
 }
 
 static void
@@ -1529,14 +2478,13 @@ xf86libinput_handle_button(InputInfoPtr pInfo, struct libinput_event_pointer *ev
 	if ((driver_data->capabilities & CAP_POINTER) == 0)
 		return;
 
-	button = btn_linux2xorg(libinput_event_pointer_get_button(event));
 	is_press = (libinput_event_pointer_get_button_state(event) == LIBINPUT_BUTTON_STATE_PRESSED);
+	button = xf86libinput_map_button(driver_data,
+					 libinput_event_pointer_get_button(event) - BTN_MISC,
+					 &is_press);
 
-	if (draglock_get_mode(&driver_data->draglock) != DRAGLOCK_DISABLED)
-		draglock_filter_button(&driver_data->draglock, &button, &is_press);
-
-	if (button && button < 256)
-		xf86PostButtonEvent(dev, Relative, button, is_press, 0, 0);
+	if (button)
+		xf86libinput_post_button_event(dev, Relative, button, is_press);
 }
 
 static void
@@ -1553,9 +2501,10 @@ xf86libinput_handle_key(InputInfoPtr pInfo, struct libinput_event_keyboard *even
 	key += XORG_KEYCODE_OFFSET;
 
 	is_press = (libinput_event_keyboard_get_key_state(event) == LIBINPUT_KEY_STATE_PRESSED);
-	xf86PostKeyboardEvent(dev, key, is_press);
+	xf86libinput_post_key_event(dev, key, is_press);
 }
 
+#if !HAVE_LIBINPUT_AXIS_VALUE_V120
 /*
  * The scroll fraction is the value we divide the scroll dist with to
  * accommodate for wheels with a small click angle. On these devices,
@@ -1682,7 +2631,90 @@ xf86libinput_handle_axis(InputInfoPtr pInfo, struct libinput_event_pointer *even
 		valuator_mask_set_double(mask, 2, value);
 
 out:
-	xf86PostMotionEventM(dev, Relative, mask);
+	xf86libinput_post_motion_event(dev, Relative, mask);
+}
+#else
+/* One logical wheel click is 120, hi-res wheels send fractions of it.
+ * The server accumulates the smooth scroll values into legacy button
+ * events, so each event is passed on as-is */
+static inline bool
+calculate_scroll_value(struct xf86libinput *driver_data,
+		       enum libinput_pointer_axis axis,
+		       struct libinput_event_pointer *event,
+		       enum libinput_event_type type,
+		       double *value_out)
+{
+	double value;
+
+	if (!libinput_event_pointer_has_axis(event, axis))
+		return false;
+
+	if (type == LIBINPUT_EVENT_POINTER_SCROLL_WHEEL) {
+		value = libinput_event_pointer_get_scroll_value_v120(event, axis);
+		if (axis == LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL)
+			value *= driver_data->scroll.vdist_v120;
+		else
+			value *= driver_data->scroll.hdist_v120;
+	} else {
+		value = libinput_event_pointer_get_scroll_value(event, axis);
+	}
+
+	*value_out = value;
+
+	return true;
+}
+
+static void
+xf86libinput_handle_scroll(InputInfoPtr pInfo,
+			   struct libinput_event_pointer *event,
+			   enum libinput_event_type type)
+{
+	DeviceIntPtr dev = pInfo->dev;
+	struct xf86libinput *driver_data = pInfo->private;
+	ValuatorMask *mask = driver_data->valuators;
+	double value;
+
+	if ((driver_data->capabilities & CAP_POINTER) == 0)
+		return;
+
+	valuator_mask_zero(mask);
+
+	if (calculate_scroll_value(driver_data,
+				   LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL,
+				   event,
+				   type,
+				   &value))
+		valuator_mask_set_double(mask, 3, value);
+
+	if (driver_data->options.horiz_scrolling_enabled &&
+	    calculate_scroll_value(driver_data,
+				   LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL,
+				   event,
+				   type,
+				   &value))
+		valuator_mask_set_double(mask, 2, value);
+
+	xf86libinput_post_motion_event(dev, Relative, mask);
+}
+#endif
+
+static void
+xf86libinput_flush_touch_slot(InputInfoPtr pInfo, struct touch_slot *ts)
+{
+	struct xf86libinput *driver_data = pInfo->private;
+	ValuatorMask *m = driver_data->valuators;
+
+	if (!ts->pending)
+		return;
+
+	ts->pending = false;
+	driver_data->touch.npending--;
+
+	valuator_mask_zero(m);
+	valuator_mask_set_double(m, 0, ts->x);
+	valuator_mask_set_double(m, 1, ts->y);
+
+	xf86libinput_post_touch_event(pInfo->dev, ts->touchid, XI_TouchUpdate, m);
 }
 
 static void
@@ -1694,30 +2726,55 @@ xf86libinput_handle_touch(InputInfoPtr pInfo,
 	struct xf86libinput *driver_data = pInfo->private;
 	int type;
 	int slot;
+	struct touch_slot *ts;
 	ValuatorMask *m = driver_data->valuators;
 	double val;
 
-	/* libinput doesn't give us hw touch ids which X expects, so
-	   emulate them here */
-	static unsigned int next_touchid;
-	static unsigned int touchids[TOUCH_MAX_SLOTS] = {0};
-
 	if ((driver_data->capabilities & CAP_TOUCH) == 0)
 		return;
 
-	slot = libinput_event_touch_get_slot(event);
+	if (event_type == LIBINPUT_EVENT_TOUCH_FRAME) {
+		for (slot = 0;
+		     slot < driver_data->touch.nslots && driver_data->touch.npending > 0;
+		     slot++)
+			xf86libinput_flush_touch_slot(pInfo,
+						      &driver_data->touch.slots[slot]);
+		return;
+	}
+
+	/* single-touch devices don't have slots */
+	slot = max(libinput_event_touch_get_slot(event), 0);
+	if (slot >= driver_data->touch.nslots)
+		return;
+
+	ts = &driver_data->touch.slots[slot];
 
 	switch (event_type) {
 		case LIBINPUT_EVENT_TOUCH_DOWN:
 			type = XI_TouchBegin;
-			touchids[slot] = next_touchid++;
+			ts->touchid = driver_data->touch.next_touchid++;
 			break;
 		case LIBINPUT_EVENT_TOUCH_UP:
 			type = XI_TouchEnd;
+			/* the last position must go out before the end */
+			xf86libinput_flush_touch_slot(pInfo, ts);
 			break;
 		case LIBINPUT_EVENT_TOUCH_MOTION:
-			type = XI_TouchUpdate;
-			break;
+			/* posted on the next TOUCH_FRAME */
+			ts->x = libinput_event_touch_get_x_transformed(event, TOUCH_AXIS_MAX);
+			ts->y = libinput_event_touch_get_y_transformed(event, TOUCH_AXIS_MAX);
+			if (!ts->pending) {
+				ts->pending = true;
+				driver_data->touch.npending++;
+			}
+			return;
+		case LIBINPUT_EVENT_TOUCH_CANCEL:
+			/* a buffered motion must not go out after the cancel */
+			if (ts->pending) {
+				ts->pending = false;
+				driver_data->touch.npending--;
+			}
+			return;
 		default:
 			return;
 	};
@@ -1732,118 +2789,224 @@ xf86libinput_handle_touch(InputInfoPtr pInfo,
 		valuator_mask_set_double(m, 1, val);
 	}
 
-	xf86PostTouchEvent(dev, touchids[slot], type, 0, m);
+	xf86libinput_post_touch_event(dev, ts->touchid, type, m);
 }
 
-static InputInfoPtr
-xf86libinput_pick_device(struct xf86libinput_device *shared_device,
-			 struct libinput_event *event)
+static void
+xf86libinput_build_route(struct xf86libinput_device *shared_device)
 {
 	struct xf86libinput *driver_data;
-	uint32_t needed_cap;
-	enum libinput_event_type type = libinput_event_get_type(event);
-
-	if (shared_device == NULL)
-		return NULL;
-
-	switch(type) {
-	case LIBINPUT_EVENT_KEYBOARD_KEY:
-		needed_cap = CAP_KEYBOARD;
-		break;
-	case LIBINPUT_EVENT_TABLET_TOOL_PROXIMITY:
-		needed_cap = CAP_TABLET;
-		break;
-	case LIBINPUT_EVENT_TABLET_TOOL_BUTTON:
-	case LIBINPUT_EVENT_TABLET_TOOL_AXIS:
-	case LIBINPUT_EVENT_TABLET_TOOL_TIP:
-		needed_cap = CAP_TABLET_TOOL;
-		break;
-	default:
-		needed_cap = ~CAP_KEYBOARD;
-		break;
-	}
 
 	xorg_list_for_each_entry(driver_data,
 				 &shared_device->device_list,
 				 shared_device_link) {
-		if (driver_data->capabilities & needed_cap) {
-			struct libinput_tablet_tool *tool;
-
-			if (needed_cap != CAP_TABLET_TOOL)
-				return driver_data->pInfo;
-
-			tool = libinput_event_tablet_tool_get_tool(
-					   libinput_event_get_tablet_tool_event(event));
-			if (libinput_tablet_tool_get_serial(driver_data->tablet_tool) ==
-			    libinput_tablet_tool_get_serial(tool) &&
-			    libinput_tablet_tool_get_tool_id(driver_data->tablet_tool) ==
-			    libinput_tablet_tool_get_tool_id(tool))
-				return driver_data->pInfo;
-		}
+		uint32_t caps = driver_data->capabilities;
+
+		if (!shared_device->route.keyboard && (caps & CAP_KEYBOARD))
+			shared_device->route.keyboard = driver_data->pInfo;
+		if (!shared_device->route.tablet && (caps & CAP_TABLET))
+			shared_device->route.tablet = driver_data->pInfo;
+		if (!shared_device->route.other && (caps & ~CAP_KEYBOARD))
+			shared_device->route.other = driver_data->pInfo;
 	}
 
-	return NULL;
+	shared_device->route.valid = true;
 }
 
-static void
-xf86libinput_tool_destroy_queued_event(struct xf86libinput_tablet_tool_queued_event *qe)
-{
-	struct libinput_event *e;
-
-	e = libinput_event_tablet_tool_get_base_event(qe->event);
-	libinput_event_destroy(e);
-	xorg_list_del(&qe->node);
-	free(qe);
+static inline void
+xf86libinput_describe_tool(struct tool_registry_entry *desc,
+			   struct libinput_device *device,
+			   struct libinput_tablet_tool *tool)
+{
+	desc->vendor = libinput_device_get_id_vendor(device);
+	desc->product = libinput_device_get_id_product(device);
+	desc->serial = libinput_tablet_tool_get_serial(tool);
+	desc->tool_id = libinput_tablet_tool_get_tool_id(tool);
+	desc->type = libinput_tablet_tool_get_type(tool);
+	desc->axes = 0;
+	if (libinput_tablet_tool_has_pressure(tool))
+		desc->axes |= TOOL_AXIS_PRESSURE;
+	if (libinput_tablet_tool_has_tilt(tool))
+		desc->axes |= TOOL_AXIS_TILT;
+	if (libinput_tablet_tool_has_slider(tool))
+		desc->axes |= TOOL_AXIS_SLIDER;
+	if (libinput_tablet_tool_has_rotation(tool))
+		desc->axes |= TOOL_AXIS_ROTATION;
 }
 
-static void
-xf86libinput_tool_replay_events(struct xf86libinput_tablet_tool_event_queue *queue)
+/* True if the tool belongs to this subdevice. A subdevice created from
+ * the registry binds the tool here, unless the tool has different axes
+ * than the ones the device was set up with */
+static inline bool
+xf86libinput_tool_matches(struct xf86libinput *driver_data,
+			  struct libinput_tablet_tool *tool)
 {
-	struct xf86libinput_tablet_tool_queued_event *qe, *tmp;
-
-	xorg_list_for_each_entry_safe(qe, tmp, &queue->event_list, node) {
-		struct libinput_event *e;
+	struct tool_registry_entry desc;
 
-		e = libinput_event_tablet_tool_get_base_event(qe->event);
-		xf86libinput_handle_event(e);
-		xf86libinput_tool_destroy_queued_event(qe);
-	}
-}
-
-static bool
-xf86libinput_tool_queue_event(struct libinput_event_tablet_tool *event)
-{
-	struct libinput_event *e;
-	struct libinput_tablet_tool *tool;
-	struct xf86libinput_tablet_tool_event_queue *queue;
-	struct xf86libinput_tablet_tool_queued_event *qe;
+	if ((driver_data->capabilities & CAP_TABLET_TOOL) == 0 ||
+	    driver_data->tool_desc.serial != libinput_tablet_tool_get_serial(tool) ||
+	    driver_data->tool_desc.tool_id != libinput_tablet_tool_get_tool_id(tool))
+		return false;
 
-	tool = libinput_event_tablet_tool_get_tool(event);
-	if (!tool)
+	if (driver_data->tablet_tool)
 		return true;
 
-	queue = libinput_tablet_tool_get_user_data(tool);
-	if (!queue)
+	xf86libinput_describe_tool(&desc, driver_data->shared_device->device, tool);
+	if (desc.type != driver_data->tool_desc.type ||
+	    desc.axes != driver_data->tool_desc.axes)
 		return false;
 
-	if (!queue->need_to_queue) {
-		if (!xorg_list_is_empty(&queue->event_list)) {
-			libinput_tablet_tool_set_user_data(tool, NULL);
-			xf86libinput_tool_replay_events(queue);
-			free(queue);
+	driver_data->tablet_tool = libinput_tablet_tool_ref(tool);
+
+	return true;
+}
+
+static InputInfoPtr
+xf86libinput_pick_tool_device(struct xf86libinput_device *shared_device,
+			      struct libinput_tablet_tool *tool)
+{
+	struct xf86libinput *driver_data;
+	size_t idx;
+
+	idx = ((uintptr_t)tool >> 4) & (TOOL_ROUTE_CACHE_SIZE - 1);
+	if (shared_device->route.tools[idx].tool == tool)
+		return shared_device->route.tools[idx].pInfo;
+
+	xorg_list_for_each_entry(driver_data,
+				 &shared_device->device_list,
+				 shared_device_link) {
+		if (xf86libinput_tool_matches(driver_data, tool)) {
+			if (shared_device->route.tools[idx].tool)
+				libinput_tablet_tool_unref(shared_device->route.tools[idx].tool);
+			shared_device->route.tools[idx].tool = libinput_tablet_tool_ref(tool);
+			shared_device->route.tools[idx].pInfo = driver_data->pInfo;
+			return driver_data->pInfo;
 		}
+	}
+
+	/* Not cached, the subdevice may not exist yet */
+	return NULL;
+}
+
+static InputInfoPtr
+xf86libinput_pick_device(struct xf86libinput_device *shared_device,
+			 struct libinput_event *event)
+{
+	enum libinput_event_type type = libinput_event_get_type(event);
+	struct libinput_tablet_tool *tool;
+
+	if (shared_device == NULL)
+		return NULL;
+
+	if (!shared_device->route.valid)
+		xf86libinput_build_route(shared_device);
+
+	switch(type) {
+	case LIBINPUT_EVENT_KEYBOARD_KEY:
+		return shared_device->route.keyboard;
+	case LIBINPUT_EVENT_TABLET_TOOL_PROXIMITY:
+		return shared_device->route.tablet;
+	case LIBINPUT_EVENT_TABLET_TOOL_BUTTON:
+	case LIBINPUT_EVENT_TABLET_TOOL_AXIS:
+	case LIBINPUT_EVENT_TABLET_TOOL_TIP:
+		tool = libinput_event_tablet_tool_get_tool(
+				   libinput_event_get_tablet_tool_event(event));
+		return xf86libinput_pick_tool_device(shared_device, tool);
+	default:
+		return shared_device->route.other;
+	}
+}
+
+static void
+xf86libinput_tool_discard_events(struct xf86libinput_tablet_tool_event_queue *queue)
+{
+	size_t i;
+
+	for (i = 0; i < queue->nevents; i++) {
+		struct libinput_event *e;
+
+		e = libinput_event_tablet_tool_get_base_event(queue->events[i]);
+		libinput_event_destroy(e);
+	}
+
+	queue->nevents = 0;
+}
+
+static void
+xf86libinput_tool_replay_events(struct xf86libinput_tablet_tool_event_queue *queue)
+{
+	size_t i;
+
+	for (i = 0; i < queue->nevents; i++) {
+		struct libinput_event *e;
+
+		e = libinput_event_tablet_tool_get_base_event(queue->events[i]);
+		xf86libinput_handle_event(e);
+		libinput_event_destroy(e);
+	}
+
+	queue->nevents = 0;
+}
+
+/* The queue is full: drop the oldest axis event, proximity, tip and
+ * button events are what matters for the state the client sees. If
+ * there is no axis event to drop, return false.
+ */
+static bool
+xf86libinput_tool_queue_make_room(struct xf86libinput_tablet_tool_event_queue *queue)
+{
+	size_t i;
+
+	for (i = 0; i < queue->nevents; i++) {
+		struct libinput_event *e;
+
+		e = libinput_event_tablet_tool_get_base_event(queue->events[i]);
+		if (libinput_event_get_type(e) != LIBINPUT_EVENT_TABLET_TOOL_AXIS)
+			continue;
+
+		libinput_event_destroy(e);
+		memmove(&queue->events[i], &queue->events[i + 1],
+			(queue->nevents - i - 1) * sizeof(queue->events[0]));
+		queue->nevents--;
+		return true;
+	}
+
+	return false;
+}
+
+static bool
+xf86libinput_tool_queue_event(struct libinput_event_tablet_tool *event)
+{
+	struct libinput_event *e;
+	struct libinput_tablet_tool *tool;
+	struct xf86libinput_tablet_tool_event_queue *queue;
+	struct xf86libinput_device *shared_device;
+
+	tool = libinput_event_tablet_tool_get_tool(event);
+	if (!tool)
+		return true;
+
+	queue = libinput_tablet_tool_get_user_data(tool);
+	if (!queue)
+		return false;
+
+	if (!queue->need_to_queue) {
+		libinput_tablet_tool_set_user_data(tool, NULL);
+		xf86libinput_tool_replay_events(queue);
+		free(queue);
 
 		return false;
 	}
 
+	e = libinput_event_tablet_tool_get_base_event(event);
+	shared_device = libinput_device_get_user_data(libinput_event_get_device(e));
+
 	/* We got the prox out while still queuing, just ditch the whole
 	 * series of events and the event queue with it. */
 	if (libinput_event_tablet_tool_get_proximity_state(event) ==
 	    LIBINPUT_TABLET_TOOL_PROXIMITY_STATE_OUT) {
-		struct xf86libinput_tablet_tool_queued_event *tmp;
-
-		xorg_list_for_each_entry_safe(qe, tmp, &queue->event_list, node)
-			xf86libinput_tool_destroy_queued_event(qe);
+		shared_device->counters.tool_dropped += queue->nevents + 1;
+		xf86libinput_tool_discard_events(queue);
 
 		libinput_tablet_tool_set_user_data(tool, NULL);
 		free(queue);
@@ -1852,24 +3015,32 @@ xf86libinput_tool_queue_event(struct libinput_event_tablet_tool *event)
 		 * to make sure the event looks like it got queued and the
 		 * caller doesn't destroy it for us
 		 */
-		e = libinput_event_tablet_tool_get_base_event(event);
 		libinput_event_destroy(e);
 		return true;
 	}
 
-	qe = calloc(1, sizeof(*qe));
-	if (!qe) {
-		e = libinput_event_tablet_tool_get_base_event(event);
-		libinput_event_destroy(e);
-		return true;
+	if (queue->nevents == queue->size) {
+		shared_device->counters.tool_dropped++;
+		if (!xf86libinput_tool_queue_make_room(queue)) {
+			libinput_event_destroy(e);
+			return true;
+		}
 	}
 
-	qe->event = event;
-	xorg_list_append(&qe->node, &queue->event_list);
+	queue->events[queue->nevents++] = event;
+	shared_device->counters.tool_queued++;
 
 	return true;
 }
 
+static inline void
+xf86libinput_reset_prediction(struct xf86libinput *driver_data)
+{
+	driver_data->prediction.valid = false;
+	driver_data->prediction.dx = 0.0;
+	driver_data->prediction.dy = 0.0;
+}
+
 static enum event_handling
 xf86libinput_handle_tablet_tip(InputInfoPtr pInfo,
 			       struct libinput_event_tablet_tool *event)
@@ -1881,14 +3052,15 @@ xf86libinput_handle_tablet_tip(InputInfoPtr pInfo,
 	if (xf86libinput_tool_queue_event(event))
 		return EVENT_QUEUED;
 
+	xf86libinput_flush_tablet_axis(pInfo);
+	xf86libinput_reset_prediction(pInfo->private);
 	xf86libinput_post_tablet_motion(pDev->public.devicePrivate, event);
 
 	state = libinput_event_tablet_tool_get_tip_state(event);
 
-	xf86PostButtonEventP(pInfo->dev,
-			     is_absolute, 1,
-			     state == LIBINPUT_TABLET_TOOL_TIP_DOWN ? 1 : 0,
-			     0, 0, NULL);
+	xf86libinput_post_button_event(pInfo->dev,
+				       is_absolute, 1,
+				       state == LIBINPUT_TABLET_TOOL_TIP_DOWN ? 1 : 0);
 
 	return EVENT_HANDLED;
 }
@@ -1897,75 +3069,163 @@ static enum event_handling
 xf86libinput_handle_tablet_button(InputInfoPtr pInfo,
 				  struct libinput_event_tablet_tool *event)
 {
-	enum libinput_button_state state;
-	uint32_t button, b;
+	struct xf86libinput *driver_data = pInfo->private;
+	int is_press;
+	int b;
 
 	if (xf86libinput_tool_queue_event(event))
 		return EVENT_QUEUED;
 
-	button = libinput_event_tablet_tool_get_button(event);
-	state = libinput_event_tablet_tool_get_button_state(event);
+	xf86libinput_flush_tablet_axis(pInfo);
 
-	b = btn_linux2xorg(button);
+	is_press = libinput_event_tablet_tool_get_button_state(event) == LIBINPUT_BUTTON_STATE_PRESSED;
+	b = xf86libinput_map_button(driver_data,
+				    libinput_event_tablet_tool_get_button(event) - BTN_MISC,
+				    &is_press);
 
-	xf86PostButtonEventP(pInfo->dev,
-			     TRUE,
-			     b,
-			     state == LIBINPUT_BUTTON_STATE_PRESSED ? 1 : 0,
-			     0, 0, NULL);
+	if (b)
+		xf86libinput_post_button_event(pInfo->dev, TRUE, b, is_press);
 
 	return EVENT_HANDLED;
 }
 
 static void
-xf86libinput_apply_area(InputInfoPtr pInfo, double *x, double *y)
+xf86libinput_build_axis_plan(InputInfoPtr pInfo,
+			     struct libinput_tablet_tool *tool)
 {
 	struct xf86libinput *driver_data = pInfo->private;
-	const struct scale_factor *f = &driver_data->area_scale_factor;
-	double sx, sy;
-
-	if (driver_data->options.area.x == 0)
-		return;
+	struct axis_plan *plan = &driver_data->axis_plan;
 
 	/* In left-handed mode, libinput already gives us transformed
 	 * coordinates, so we can clip the same way. */
+	if (driver_data->options.area.x == 0) {
+		plan->scale_x = 1.0;
+		plan->scale_y = 1.0;
+	} else {
+		plan->scale_x = driver_data->area_scale_factor.x;
+		plan->scale_y = driver_data->area_scale_factor.y;
+	}
+
+	plan->pressurecurve = driver_data->pressurecurve.values;
+	plan->pressurecurve_sz = driver_data->pressurecurve.sz;
+	plan->pressurecurve_fixed = plan->pressurecurve &&
+				    driver_data->pressurecurve.nsegments > 0;
+	if (plan->pressurecurve_fixed) {
+		double range = (plan->pressurecurve_sz - 1) << BEZIER_FRAC_BITS;
+
+		plan->pressure_in_scale = range;
+		plan->pressure_out_scale = TABLET_PRESSURE_AXIS_MAX/range;
+	}
+	plan->has_pressure = libinput_tablet_tool_has_pressure(tool);
+	plan->has_tilt = libinput_tablet_tool_has_tilt(tool);
+	plan->has_slider = libinput_tablet_tool_has_slider(tool);
+	plan->rotation_valuator = -1;
+
+	if (libinput_tablet_tool_has_rotation(tool)) {
+		switch (libinput_tablet_tool_get_type(tool)) {
+		case LIBINPUT_TABLET_TOOL_TYPE_PEN:
+		case LIBINPUT_TABLET_TOOL_TYPE_ERASER:
+			plan->rotation_valuator = 5;
+			break;
+		case LIBINPUT_TABLET_TOOL_TYPE_MOUSE:
+		case LIBINPUT_TABLET_TOOL_TYPE_LENS:
+			plan->rotation_valuator = 3;
+			break;
+		default:
+			xf86IDrvMsg(pInfo, X_ERROR,
+				    "Invalid rotation axis on tool\n");
+			break;
+		}
+	}
+
+	plan->valid = true;
+}
 
-	sx = min(*x * f->x, TABLET_AXIS_MAX);
-	sy = min(*y * f->y, TABLET_AXIS_MAX);
+/* Moves x/y along the pen's recent velocity by the prediction interval.
+ * The first sample after a reset or a long pause only seeds the history */
+static inline void
+xf86libinput_predict_tablet_motion(struct xf86libinput *driver_data,
+				   uint64_t time,
+				   double *x, double *y)
+{
+	struct tool_prediction *p = &driver_data->prediction;
+	uint64_t dt = time - p->time;
+	double in_x = *x, in_y = *y;
+
+	if (!p->valid || dt >= PREDICTION_MAX_GAP) {
+		xf86libinput_reset_prediction(driver_data);
+	} else if (dt > 0) {
+		/* half the new velocity, half the old one: enough to not
+		   jitter on noisy samples, quick enough for a change of
+		   direction */
+		p->dx = (p->dx + (in_x - p->x)/dt)/2;
+		p->dy = (p->dy + (in_y - p->y)/dt)/2;
+	}
 
-	*x = sx;
-	*y = sy;
+	*x = max(0.0, min(in_x + p->dx * p->ahead, TABLET_AXIS_MAX));
+	*y = max(0.0, min(in_y + p->dy * p->ahead, TABLET_AXIS_MAX));
+
+	p->valid = true;
+	p->time = time;
+	p->x = in_x;
+	p->y = in_y;
 }
 
 static void
-xf86libinput_post_tablet_motion(InputInfoPtr pInfo,
-				struct libinput_event_tablet_tool *event)
+xf86libinput_set_prediction(struct xf86libinput *driver_data, int ms)
+{
+	driver_data->options.tool_prediction = ms;
+	driver_data->prediction.ahead = ms * 1000;
+	xf86libinput_reset_prediction(driver_data);
+}
+
+/* pressure is the normalized libinput pressure, it may be the event's
+ * or a higher one from a merged event, see "TabletToolAxisRate" */
+static void
+xf86libinput_post_tablet_motion_pressure(InputInfoPtr pInfo,
+					 struct libinput_event_tablet_tool *event,
+					 double pressure)
 {
 	DeviceIntPtr dev = pInfo->dev;
 	struct xf86libinput *driver_data = pInfo->private;
+	const struct axis_plan *plan = &driver_data->axis_plan;
 	ValuatorMask *mask = driver_data->valuators;
-	struct libinput_tablet_tool *tool;
 	double value;
 	double x, y;
 
+	if (!plan->valid)
+		xf86libinput_build_axis_plan(pInfo,
+					     libinput_event_tablet_tool_get_tool(event));
+
 	x = libinput_event_tablet_tool_get_x_transformed(event,
 							 TABLET_AXIS_MAX);
 	y = libinput_event_tablet_tool_get_y_transformed(event,
 							 TABLET_AXIS_MAX);
-	xf86libinput_apply_area(pInfo, &x, &y);
+	x = min(x * plan->scale_x, TABLET_AXIS_MAX);
+	y = min(y * plan->scale_y, TABLET_AXIS_MAX);
+	if (driver_data->prediction.ahead)
+		xf86libinput_predict_tablet_motion(driver_data,
+						   libinput_event_tablet_tool_get_time_usec(event),
+						   &x, &y);
 	valuator_mask_set_double(mask, 0, x);
 	valuator_mask_set_double(mask, 1, y);
 
-	tool = libinput_event_tablet_tool_get_tool(event);
-
-	if (libinput_tablet_tool_has_pressure(tool)) {
-		value = TABLET_PRESSURE_AXIS_MAX * libinput_event_tablet_tool_get_pressure(event);
-		if (driver_data->pressurecurve.values)
-			value = driver_data->pressurecurve.values[(int)value];
+	if (plan->has_pressure) {
+		value = pressure;
+		if (plan->pressurecurve_fixed) {
+			int y = bezier_interpolate(plan->pressurecurve,
+						   plan->pressurecurve_sz,
+						   value * plan->pressure_in_scale);
+			value = y * plan->pressure_out_scale;
+		} else {
+			value *= TABLET_PRESSURE_AXIS_MAX;
+			if (plan->pressurecurve)
+				value = plan->pressurecurve[(int)value];
+		}
 		valuator_mask_set_double(mask, 2, value);
 	}
 
-	if (libinput_tablet_tool_has_tilt(tool)) {
+	if (plan->has_tilt) {
 		value = libinput_event_tablet_tool_get_tilt_x(event);
 		valuator_mask_set_double(mask, 3, value);
 
@@ -1973,46 +3233,151 @@ xf86libinput_post_tablet_motion(InputInfoPtr pInfo,
 		valuator_mask_set_double(mask, 4, value);
 	}
 
-	if (libinput_tablet_tool_has_slider(tool)) {
+	if (plan->has_slider) {
 		value = libinput_event_tablet_tool_get_slider_position(event);
 		value *= TABLET_AXIS_MAX;
 		valuator_mask_set_double(mask, 5, value);
 	}
 
-	if (libinput_tablet_tool_has_rotation(tool)) {
-		int valuator;
-
+	if (plan->rotation_valuator != -1) {
 		value = libinput_event_tablet_tool_get_rotation(event);
 		value *= TABLET_AXIS_MAX;
+		valuator_mask_set_double(mask, plan->rotation_valuator, value);
+	}
 
-		switch (libinput_tablet_tool_get_type(tool)) {
-		case LIBINPUT_TABLET_TOOL_TYPE_PEN:
-		case LIBINPUT_TABLET_TOOL_TYPE_ERASER:
-			valuator = 5;
-			break;
-		case LIBINPUT_TABLET_TOOL_TYPE_MOUSE:
-		case LIBINPUT_TABLET_TOOL_TYPE_LENS:
-			valuator = 3;
-			break;
-		default:
-			xf86IDrvMsg(pInfo, X_ERROR,
-				    "Invalid rotation axis on tool\n");
-			return;
-		}
+	xf86libinput_post_motion_event(dev, Absolute, mask);
+}
+
+static void
+xf86libinput_post_tablet_motion(InputInfoPtr pInfo,
+				struct libinput_event_tablet_tool *event)
+{
+	xf86libinput_post_tablet_motion_pressure(pInfo, event,
+						 libinput_event_tablet_tool_get_pressure(event));
+}
+
+/* The index into the handled event counters, -1 for the device
+ * added/removed events */
+static inline int
+event_counter_index(enum libinput_event_type type)
+{
+	int group = type/100 - 3;
+	int n = type % 100;
+
+	if (group < 0 || group >= EVENT_COUNTER_GROUPS || n >= 8)
+		return -1;
+
+	return group * 8 + n;
+}
+
+/* Posts the held axis event, if any. Called before anything that must
+ * not overtake it (tip, buttons, proximity) and once the interval is up */
+static void
+xf86libinput_flush_tablet_axis(InputInfoPtr pInfo)
+{
+	struct xf86libinput *driver_data = pInfo->private;
+	struct libinput_event_tablet_tool *event = driver_data->axis_rate.held;
+
+	if (!event)
+		return;
+
+	driver_data->axis_rate.held = NULL;
+	driver_data->axis_rate.last_time = libinput_event_tablet_tool_get_time_usec(event);
+	xf86libinput_post_tablet_motion_pressure(pInfo, event,
+						 driver_data->axis_rate.max_pressure);
+	/* it was EVENT_QUEUED when it came in */
+	driver_data->counters.handled[event_counter_index(LIBINPUT_EVENT_TABLET_TOOL_AXIS)]++;
+	libinput_event_destroy(libinput_event_tablet_tool_get_base_event(event));
+}
+
+static void
+xf86libinput_discard_tablet_axis(struct xf86libinput *driver_data)
+{
+	struct libinput_event_tablet_tool *event = driver_data->axis_rate.held;
+
+	TimerFree(driver_data->axis_rate.timer);
+	driver_data->axis_rate.timer = NULL;
+
+	if (!event)
+		return;
+
+	driver_data->axis_rate.held = NULL;
+	driver_data->counters.discarded_off++;
+	libinput_event_destroy(libinput_event_tablet_tool_get_base_event(event));
+}
+
+static CARD32
+xf86libinput_axis_rate_timer_cb(OsTimerPtr timer, CARD32 time, void *data)
+{
+	InputInfoPtr pInfo = data;
+
+#if HAVE_THREADED_INPUT
+	input_lock();
+#else
+	int sigstate = xf86BlockSIGIO();
+#endif
+	xf86libinput_flush_tablet_axis(pInfo);
+#if HAVE_THREADED_INPUT
+	input_unlock();
+#else
+	xf86UnblockSIGIO(sigstate);
+#endif
+
+	return 0;
+}
+
+static void
+xf86libinput_set_axis_rate(struct xf86libinput *driver_data, int hz)
+{
+	driver_data->options.tool_axis_rate = hz;
+	driver_data->axis_rate.interval = hz > 0 ? 1000000/hz : 0;
+}
 
-		valuator_mask_set_double(mask, valuator, value);
+/* An already held event is replaced, the timer that was set for it
+ * posts this one instead */
+static enum event_handling
+xf86libinput_rate_limit_tablet_axis(InputInfoPtr pInfo,
+				    struct libinput_event_tablet_tool *event)
+{
+	struct xf86libinput *driver_data = pInfo->private;
+	uint64_t time = libinput_event_tablet_tool_get_time_usec(event);
+	uint64_t elapsed = time - driver_data->axis_rate.last_time;
+	double pressure = libinput_event_tablet_tool_get_pressure(event);
+	struct libinput_event_tablet_tool *held = driver_data->axis_rate.held;
+
+	if (held) {
+		pressure = max(pressure, driver_data->axis_rate.max_pressure);
+		driver_data->counters.merged++;
+		libinput_event_destroy(libinput_event_tablet_tool_get_base_event(held));
 	}
 
-	xf86PostMotionEventM(dev, Absolute, mask);
+	driver_data->axis_rate.held = event;
+	driver_data->axis_rate.max_pressure = pressure;
+
+	if (elapsed >= driver_data->axis_rate.interval)
+		xf86libinput_flush_tablet_axis(pInfo);
+	else if (!held)
+		driver_data->axis_rate.timer = TimerSet(driver_data->axis_rate.timer,
+							0,
+							(driver_data->axis_rate.interval - elapsed + 999)/1000,
+							xf86libinput_axis_rate_timer_cb,
+							pInfo);
+
+	return EVENT_QUEUED;
 }
 
 static enum event_handling
 xf86libinput_handle_tablet_axis(InputInfoPtr pInfo,
 				struct libinput_event_tablet_tool *event)
 {
+	struct xf86libinput *driver_data = pInfo->private;
+
 	if (xf86libinput_tool_queue_event(event))
 		return EVENT_QUEUED;
 
+	if (driver_data->axis_rate.interval > 0 || driver_data->axis_rate.held)
+		return xf86libinput_rate_limit_tablet_axis(pInfo, event);
+
 	xf86libinput_post_tablet_motion(pInfo, event);
 
 	return EVENT_HANDLED;
@@ -2039,76 +3404,163 @@ tool_type_to_str(enum libinput_tablet_tool_type type)
 	return str;
 }
 
-static inline void
-xf86libinput_create_tool_subdevice(InputInfoPtr pInfo,
-				   struct libinput_event_tablet_tool *event)
+/* Sets up the queue for the tool's events until its subdevice claims
+ * the tool, see claim_tablet_tool() */
+static bool
+xf86libinput_queue_tool(InputInfoPtr pInfo,
+			struct libinput_event_tablet_tool *event)
 {
 	struct xf86libinput *driver_data = pInfo->private;
 	struct xf86libinput_device *shared_device = driver_data->shared_device;
 	struct xf86libinput_tablet_tool *t;
 	struct xf86libinput_tablet_tool_event_queue *queue;
 	struct libinput_tablet_tool *tool;
-	uint64_t serial, tool_id;
-	XF86OptionPtr options = NULL;
-	char name[64];
 
 	t = calloc(1, sizeof *t);
 	if (!t)
-		return;
+		return false;
 
-	queue = calloc(1, sizeof(*queue));
+	queue = calloc(1, sizeof(*queue) +
+		       driver_data->options.tool_queue_size * sizeof(queue->events[0]));
 	if (!queue) {
 		free(t);
-		return;
+		return false;
 	}
 	queue->need_to_queue = true;
-	xorg_list_init(&queue->event_list);
+	queue->size = driver_data->options.tool_queue_size;
 
 	tool = libinput_event_tablet_tool_get_tool(event);
-	serial = libinput_tablet_tool_get_serial(tool);
-	tool_id = libinput_tablet_tool_get_tool_id(tool);
-
 	t->tool = libinput_tablet_tool_ref(tool);
 	xorg_list_append(&t->node, &shared_device->unclaimed_tablet_tool_list);
 
-	options = xf86ReplaceIntOption(options, "_libinput/tablet-tool-serial", serial);
-	options = xf86ReplaceIntOption(options, "_libinput/tablet-tool-id", tool_id);
+	libinput_tablet_tool_set_user_data(tool, queue);
+	xf86libinput_tool_queue_event(event);
+
+	return true;
+}
+
+static XF86OptionPtr
+xf86libinput_tool_subdevice_options(InputInfoPtr pInfo,
+				    const struct tool_registry_entry *desc)
+{
+	XF86OptionPtr options = NULL;
+	char name[64];
+
+	options = xf86ReplaceIntOption(options, "_libinput/tablet-tool-serial", desc->serial);
+	options = xf86ReplaceIntOption(options, "_libinput/tablet-tool-id", desc->tool_id);
 	/* Convert the name to "<base name> <tool type> (serial number)" */
 	if (snprintf(name,
 		     sizeof(name),
 		     "%s %s (%#x)",
 		     pInfo->name,
-		     tool_type_to_str(libinput_tablet_tool_get_type(tool)),
-		     (uint32_t)serial) > strlen(pInfo->name))
+		     tool_type_to_str(desc->type),
+		     (uint32_t)desc->serial) > strlen(pInfo->name))
 		options = xf86ReplaceStrOption(options, "Name", name);
 
-	libinput_tablet_tool_set_user_data(tool, queue);
-	xf86libinput_tool_queue_event(event);
-
-	xf86libinput_create_subdevice(pInfo, CAP_TABLET_TOOL, options);
+	return options;
 }
 
-static inline DeviceIntPtr
-xf86libinput_find_device_for_tool(InputInfoPtr pInfo,
-				  struct libinput_tablet_tool *tool)
-{
-	struct xf86libinput *dev = pInfo->private;
-	struct xf86libinput *driver_data = pInfo->private;
-	struct xf86libinput_device *shared_device = driver_data->shared_device;
-	uint64_t serial = libinput_tablet_tool_get_serial(tool);
-	uint64_t tool_id = libinput_tablet_tool_get_tool_id(tool);
+/* Adds the tools to the registry file, an existing entry for the same
+ * tool is replaced. This is file I/O, it runs from the hotplug work
+ * proc on the main thread, never from the input thread */
+static void
+xf86libinput_register_tools(const char *path,
+			    const struct tool_registry_entry **tools,
+			    size_t ntools)
+{
+	struct tool_registry registry = {0};
+	char *tmp;
+	FILE *fp;
+	size_t i;
+	int rc;
 
-	xorg_list_for_each_entry(dev,
-				 &shared_device->device_list,
-				 shared_device_link) {
-		if (dev->tablet_tool &&
-		    libinput_tablet_tool_get_serial(dev->tablet_tool) == serial &&
-		    libinput_tablet_tool_get_tool_id(dev->tablet_tool) == tool_id) {
-			return dev->pInfo->dev;
+	/* other tablets may share the file, so re-read it first */
+	fp = fopen(path, "r");
+	if (fp) {
+		tool_registry_load(&registry, fp);
+		fclose(fp);
+	}
+
+	for (i = 0; i < ntools; i++) {
+		if (!tool_registry_add(&registry, tools[i])) {
+			xf86Msg(X_WARNING, "libinput: tool registry %s is full\n",
+				path);
+			break;
 		}
 	}
 
-	return NULL;
+	tmp = malloc(strlen(path) + 5);
+	if (!tmp)
+		return;
+	sprintf(tmp, "%s.new", path);
+
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		rc = -errno;
+		goto out;
+	}
+
+	rc = tool_registry_save(&registry, fp);
+	if (fclose(fp) != 0 && rc == 0)
+		rc = -EIO;
+	if (rc == 0 && rename(tmp, path) != 0)
+		rc = -errno;
+
+out:
+	if (rc != 0) {
+		xf86Msg(X_ERROR, "libinput: failed to write tool registry %s: %s\n",
+			path, strerror(-rc));
+		unlink(tmp);
+	}
+	free(tmp);
+}
+
+static inline void
+xf86libinput_create_tool_subdevice(InputInfoPtr pInfo,
+				   struct libinput_event_tablet_tool *event)
+{
+	struct xf86libinput *driver_data = pInfo->private;
+	struct xf86libinput_device *shared_device = driver_data->shared_device;
+	struct libinput_tablet_tool *tool;
+	struct tool_registry_entry desc;
+	bool pending;
+
+	tool = libinput_event_tablet_tool_get_tool(event);
+	xf86libinput_describe_tool(&desc, shared_device->device, tool);
+
+	/* Created in PreInit from the registry but not there yet, it
+	 * claims the tool (and its queued events) like any other */
+	pending = tool_registry_find(&shared_device->pending_tools,
+				     desc.vendor, desc.product,
+				     desc.serial, desc.tool_id) != NULL;
+
+	if (!xf86libinput_queue_tool(pInfo, event) || pending)
+		return;
+
+	/* the registry is written once the subdevice exists, see
+	 * xf86libinput_hotplug_device_cb() */
+	xf86libinput_create_subdevice(pInfo,
+				      CAP_TABLET_TOOL,
+				      xf86libinput_tool_subdevice_options(pInfo, &desc),
+				      shared_device->tool_registry ? &desc : NULL);
+}
+
+static inline DeviceIntPtr
+xf86libinput_find_device_for_tool(InputInfoPtr pInfo,
+				  struct libinput_tablet_tool *tool)
+{
+	struct xf86libinput *dev = pInfo->private;
+	struct xf86libinput *driver_data = pInfo->private;
+	struct xf86libinput_device *shared_device = driver_data->shared_device;
+
+	xorg_list_for_each_entry(dev,
+				 &shared_device->device_list,
+				 shared_device_link) {
+		if (xf86libinput_tool_matches(dev, tool))
+			return dev->pInfo->dev;
+	}
+
+	return NULL;
 }
 
 static enum event_handling
@@ -2118,6 +3570,8 @@ xf86libinput_handle_tablet_proximity(InputInfoPtr pInfo,
 	struct xf86libinput *driver_data = pInfo->private;
 	struct libinput_tablet_tool *tool;
 	DeviceIntPtr pDev;
+	InputInfoPtr tool_pInfo;
+	struct xf86libinput *tool_data;
 	ValuatorMask *mask = driver_data->valuators;
 	double x, y;
 	BOOL in_prox;
@@ -2138,12 +3592,25 @@ xf86libinput_handle_tablet_proximity(InputInfoPtr pInfo,
 
 	BUG_RETURN_VAL(pDev == NULL, EVENT_HANDLED);
 
+	/* A new stroke starts with an event posted right away */
+	tool_pInfo = pDev->public.devicePrivate;
+	tool_data = tool_pInfo->private;
+	xf86libinput_flush_tablet_axis(tool_pInfo);
+	xf86libinput_reset_prediction(tool_data);
+	if (in_prox)
+		tool_data->axis_rate.last_time = 0;
+
 	x = libinput_event_tablet_tool_get_x_transformed(event, TABLET_AXIS_MAX);
 	y = libinput_event_tablet_tool_get_y_transformed(event, TABLET_AXIS_MAX);
 	valuator_mask_set_double(mask, 0, x);
 	valuator_mask_set_double(mask, 1, y);
 
-	xf86PostProximityEventM(pDev, in_prox, mask);
+	/* Tool capabilities don't change but the area or pressure curve
+	 * may have since the last time */
+	if (in_prox)
+		xf86libinput_build_axis_plan(pDev->public.devicePrivate, tool);
+
+	xf86libinput_post_proximity_event(pDev, in_prox, mask);
 
 	/* We have to send an extra motion event after proximity to make
 	 * sure the client got the updated x/y coordinates, especially if
@@ -2169,83 +3636,388 @@ xf86libinput_handle_tablet_pad_button(InputInfoPtr pInfo,
 		return;
 
 	b = libinput_event_tablet_pad_get_button_number(event);
-	button = 1 + b;
-	if (button > 3)
-		button += 4; /* offset by scroll buttons */
 	is_press = (libinput_event_tablet_pad_get_button_state(event) == LIBINPUT_BUTTON_STATE_PRESSED);
+	button = xf86libinput_map_button(driver_data, b, &is_press);
 
-	xf86PostButtonEvent(dev, Relative, button, is_press, 0, 0);
+	if (button)
+		xf86libinput_post_button_event(dev, Relative, button, is_press);
 
 	group = libinput_event_tablet_pad_get_mode_group(event);
 	if (libinput_tablet_pad_mode_group_button_is_toggle(group, b))
 		update_mode_prop(pInfo, event);
 }
 
+/* Posts a ring or strip value only if it changed. In scrolling mode the
+ * change is posted instead, the ring wraps around every period steps.
+ * The first value after a finger down is the reference for the deltas.
+ */
+static void
+xf86libinput_post_pad_axis(InputInfoPtr pInfo,
+			   int *last,
+			   int v,
+			   int axis,
+			   int scroll_axis,
+			   int period)
+{
+	struct xf86libinput *driver_data = pInfo->private;
+	ValuatorMask *mask = driver_data->valuators;
+	int delta;
+
+	if (v == *last)
+		return;
+
+	valuator_mask_zero(mask);
+
+	if (!driver_data->options.pad_scrolling) {
+		*last = v;
+		valuator_mask_set(mask, axis, v);
+		xf86libinput_post_motion_event(pInfo->dev, Absolute, mask);
+		return;
+	}
+
+	delta = v - *last;
+	if (*last == -1)
+		delta = 0;
+	*last = v;
+
+	if (period) {
+		if (delta > period/2)
+			delta -= period;
+		else if (delta < -period/2)
+			delta += period;
+	}
+
+	if (delta == 0)
+		return;
+
+	valuator_mask_set(mask, scroll_axis, delta);
+	xf86libinput_post_motion_event(pInfo->dev, Relative, mask);
+}
+
 static void
 xf86libinput_handle_tablet_pad_strip(InputInfoPtr pInfo,
 				     struct libinput_event_tablet_pad *event)
 {
-	DeviceIntPtr dev = pInfo->dev;
 	struct xf86libinput *driver_data = pInfo->private;
-	ValuatorMask *mask = driver_data->valuators;
 	double value;
-	int axis = 3;
-	int v;
+	unsigned int strip;
 
 	if ((driver_data->capabilities & CAP_TABLET_PAD) == 0)
 		return;
 
-	/* this isn't compatible with the wacom driver which just forwards
-	 * the values and lets the clients handle them with log2. */
-	axis += libinput_event_tablet_pad_get_strip_number(event);
-	value = libinput_event_tablet_pad_get_strip_position(event);
-	v = TABLET_STRIP_AXIS_MAX * value;
+	strip = libinput_event_tablet_pad_get_strip_number(event);
+	if (strip >= ARRAY_SIZE(driver_data->pad.strip))
+		return;
 
-	valuator_mask_zero(mask);
-	valuator_mask_set(mask, axis, v);
+	/* finger up, nothing to post */
+	value = libinput_event_tablet_pad_get_strip_position(event);
+	if (value < 0) {
+		driver_data->pad.strip[strip] = -1;
+		return;
+	}
 
-	xf86PostMotionEventM(dev, Absolute, mask);
+	/* this isn't compatible with the wacom driver which just forwards
+	 * the values and lets the clients handle them with log2. */
+	xf86libinput_post_pad_axis(pInfo,
+				   &driver_data->pad.strip[strip],
+				   TABLET_STRIP_AXIS_MAX * value,
+				   3 + strip,
+				   TABLET_PAD_AXIS_STRIP_SCROLL,
+				   0);
 }
 
 static void
 xf86libinput_handle_tablet_pad_ring(InputInfoPtr pInfo,
 				     struct libinput_event_tablet_pad *event)
 {
-	DeviceIntPtr dev = pInfo->dev;
 	struct xf86libinput *driver_data = pInfo->private;
-	ValuatorMask *mask = driver_data->valuators;
 	double value;
-	int axis = 5;
-	int v;
+	unsigned int ring;
 
 	if ((driver_data->capabilities & CAP_TABLET_PAD) == 0)
 		return;
 
-	axis += libinput_event_tablet_pad_get_ring_number(event);
-	value = libinput_event_tablet_pad_get_ring_position(event)/360.0;
-	v = TABLET_RING_AXIS_MAX * value;
+	ring = libinput_event_tablet_pad_get_ring_number(event);
+	if (ring >= ARRAY_SIZE(driver_data->pad.ring))
+		return;
 
-	valuator_mask_zero(mask);
-	valuator_mask_set(mask, axis, v);
+	value = libinput_event_tablet_pad_get_ring_position(event);
+	if (value < 0) {
+		driver_data->pad.ring[ring] = -1;
+		return;
+	}
+
+	xf86libinput_post_pad_axis(pInfo,
+				   &driver_data->pad.ring[ring],
+				   TABLET_RING_AXIS_MAX * value/360.0,
+				   5 + ring,
+				   TABLET_PAD_AXIS_RING_SCROLL,
+				   TABLET_RING_AXIS_MAX);
+}
+
+static uint64_t
+xf86libinput_event_time(struct libinput_event *event)
+{
+	switch (libinput_event_get_type(event)) {
+	case LIBINPUT_EVENT_KEYBOARD_KEY:
+		return libinput_event_keyboard_get_time_usec(
+				libinput_event_get_keyboard_event(event));
+	case LIBINPUT_EVENT_POINTER_MOTION:
+	case LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE:
+	case LIBINPUT_EVENT_POINTER_BUTTON:
+	case LIBINPUT_EVENT_POINTER_AXIS:
+#if HAVE_LIBINPUT_AXIS_VALUE_V120
+	case LIBINPUT_EVENT_POINTER_SCROLL_WHEEL:
+	case LIBINPUT_EVENT_POINTER_SCROLL_FINGER:
+	case LIBINPUT_EVENT_POINTER_SCROLL_CONTINUOUS:
+#endif
+		return libinput_event_pointer_get_time_usec(
+				libinput_event_get_pointer_event(event));
+	case LIBINPUT_EVENT_TOUCH_DOWN:
+	case LIBINPUT_EVENT_TOUCH_UP:
+	case LIBINPUT_EVENT_TOUCH_MOTION:
+	case LIBINPUT_EVENT_TOUCH_CANCEL:
+	case LIBINPUT_EVENT_TOUCH_FRAME:
+		return libinput_event_touch_get_time_usec(
+				libinput_event_get_touch_event(event));
+	case LIBINPUT_EVENT_TABLET_TOOL_AXIS:
+	case LIBINPUT_EVENT_TABLET_TOOL_PROXIMITY:
+	case LIBINPUT_EVENT_TABLET_TOOL_TIP:
+	case LIBINPUT_EVENT_TABLET_TOOL_BUTTON:
+		return libinput_event_tablet_tool_get_time_usec(
+				libinput_event_get_tablet_tool_event(event));
+	case LIBINPUT_EVENT_TABLET_PAD_BUTTON:
+	case LIBINPUT_EVENT_TABLET_PAD_RING:
+	case LIBINPUT_EVENT_TABLET_PAD_STRIP:
+		return libinput_event_tablet_pad_get_time_usec(
+				libinput_event_get_tablet_pad_event(event));
+	default:
+		return 0;
+	}
+}
+
+#if ENABLE_LATENCY_STATS
+/* 0 for 0µs, n for [2^(n-1), 2^n)µs */
+static inline unsigned int
+latency_bucket(uint64_t usec)
+{
+	unsigned int bucket = 0;
+
+	while (usec > 0 && bucket < LATENCY_BUCKETS - 1) {
+		usec >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+static void
+xf86libinput_record_latency(InputInfoPtr pInfo,
+			    struct libinput_event *event)
+{
+	struct xf86libinput *driver_data = pInfo->private;
+	struct latency_stats *stats = &driver_data->latency;
+	uint64_t time, now;
+
+	time = xf86libinput_event_time(event);
+	if (time == 0)
+		return;
+
+	now = xf86libinput_now_usec();
+
+	stats->buckets[latency_bucket(now > time ? now - time : 0)]++;
+	stats->nevents++;
+
+	if (time - stats->rate_start >= 1000000) {
+		/* more than a second without events means a rate of 0 */
+		if (time - stats->rate_start >= 2000000)
+			stats->rate = 0;
+		else
+			stats->rate = stats->rate_count;
+		stats->peak_rate = max(stats->peak_rate, stats->rate);
+		stats->rate_start = time;
+		stats->rate_count = 0;
+	}
+	stats->rate_count++;
+}
+#endif
+
+static void
+xf86libinput_trace_pointer(struct trace_record *r,
+			   struct libinput_event_pointer *event)
+{
+	enum libinput_pointer_axis axis;
+
+	switch (r->type) {
+	case LIBINPUT_EVENT_POINTER_MOTION:
+		r->values[0] = libinput_event_pointer_get_dx(event);
+		r->values[1] = libinput_event_pointer_get_dy(event);
+		r->values[2] = libinput_event_pointer_get_dx_unaccelerated(event);
+		r->values[3] = libinput_event_pointer_get_dy_unaccelerated(event);
+		break;
+	case LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE:
+		r->values[0] = libinput_event_pointer_get_absolute_x_transformed(event, 1);
+		r->values[1] = libinput_event_pointer_get_absolute_y_transformed(event, 1);
+		break;
+	case LIBINPUT_EVENT_POINTER_BUTTON:
+		r->code = libinput_event_pointer_get_button(event);
+		r->state = libinput_event_pointer_get_button_state(event);
+		break;
+	default:
+		/* axis and scroll events */
+		if (r->type == LIBINPUT_EVENT_POINTER_AXIS)
+			r->state = libinput_event_pointer_get_axis_source(event);
+
+		for (axis = LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL;
+		     axis <= LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL;
+		     axis++) {
+			int idx = axis == LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL ? 0 : 1;
+
+			if (!libinput_event_pointer_has_axis(event, axis))
+				continue;
+
+			r->axes |= 1 << axis;
+#if HAVE_LIBINPUT_AXIS_VALUE_V120
+			if (r->type != LIBINPUT_EVENT_POINTER_AXIS) {
+				r->values[idx] = libinput_event_pointer_get_scroll_value(event, axis);
+				r->values[idx + 2] = libinput_event_pointer_get_scroll_value_v120(event, axis);
+				continue;
+			}
+#endif
+			r->values[idx] = libinput_event_pointer_get_axis_value(event, axis);
+			r->values[idx + 2] = libinput_event_pointer_get_axis_value_discrete(event, axis);
+		}
+		break;
+	}
+}
+
+static void
+xf86libinput_trace_tablet_tool(struct trace_record *r,
+			       struct libinput_event_tablet_tool *event)
+{
+	r->values[0] = libinput_event_tablet_tool_get_x_transformed(event, 1);
+	r->values[1] = libinput_event_tablet_tool_get_y_transformed(event, 1);
+	r->values[2] = libinput_event_tablet_tool_get_pressure(event);
+	r->values[3] = libinput_event_tablet_tool_get_tilt_x(event);
+	r->values[4] = libinput_event_tablet_tool_get_tilt_y(event);
+	r->values[5] = libinput_event_tablet_tool_get_slider_position(event);
+	r->values[6] = libinput_event_tablet_tool_get_rotation(event);
+
+	switch (r->type) {
+	case LIBINPUT_EVENT_TABLET_TOOL_PROXIMITY:
+		r->state = libinput_event_tablet_tool_get_proximity_state(event);
+		break;
+	case LIBINPUT_EVENT_TABLET_TOOL_TIP:
+		r->state = libinput_event_tablet_tool_get_tip_state(event);
+		break;
+	case LIBINPUT_EVENT_TABLET_TOOL_BUTTON:
+		r->code = libinput_event_tablet_tool_get_button(event);
+		r->state = libinput_event_tablet_tool_get_button_state(event);
+		break;
+	default:
+		break;
+	}
+}
+
+/* One record per event as it comes out of libinput, see "EventTrace".
+ * Called before any event is deferred or queued, so each event is
+ * recorded exactly once. What's posted for it is recorded by
+ * xf86libinput_trace_posted().
+ */
+static void
+xf86libinput_trace_event(struct libinput_event *event)
+{
+	struct xf86libinput_device *shared_device;
+	struct trace_record *r;
+
+	r = trace_next(&driver_context.trace);
+	memset(r, 0, sizeof(*r));
+
+	shared_device = libinput_device_get_user_data(libinput_event_get_device(event));
+	r->device = shared_device ? shared_device->id : 0;
+	r->type = libinput_event_get_type(event);
+	r->time = xf86libinput_event_time(event);
+	r->handled = xf86libinput_now_usec();
+
+	switch (r->type) {
+	case LIBINPUT_EVENT_KEYBOARD_KEY: {
+		struct libinput_event_keyboard *k;
+
+		k = libinput_event_get_keyboard_event(event);
+		r->code = libinput_event_keyboard_get_key(k);
+		r->state = libinput_event_keyboard_get_key_state(k);
+		break;
+	}
+	case LIBINPUT_EVENT_POINTER_MOTION:
+	case LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE:
+	case LIBINPUT_EVENT_POINTER_BUTTON:
+	case LIBINPUT_EVENT_POINTER_AXIS:
+#if HAVE_LIBINPUT_AXIS_VALUE_V120
+	case LIBINPUT_EVENT_POINTER_SCROLL_WHEEL:
+	case LIBINPUT_EVENT_POINTER_SCROLL_FINGER:
+	case LIBINPUT_EVENT_POINTER_SCROLL_CONTINUOUS:
+#endif
+		xf86libinput_trace_pointer(r, libinput_event_get_pointer_event(event));
+		break;
+	case LIBINPUT_EVENT_TOUCH_DOWN:
+	case LIBINPUT_EVENT_TOUCH_MOTION: {
+		struct libinput_event_touch *t;
+
+		t = libinput_event_get_touch_event(event);
+		r->values[0] = libinput_event_touch_get_x_transformed(t, 1);
+		r->values[1] = libinput_event_touch_get_y_transformed(t, 1);
+		r->slot = libinput_event_touch_get_slot(t);
+		break;
+	}
+	case LIBINPUT_EVENT_TOUCH_UP:
+	case LIBINPUT_EVENT_TOUCH_CANCEL:
+		r->slot = libinput_event_touch_get_slot(libinput_event_get_touch_event(event));
+		break;
+	case LIBINPUT_EVENT_TABLET_TOOL_AXIS:
+	case LIBINPUT_EVENT_TABLET_TOOL_PROXIMITY:
+	case LIBINPUT_EVENT_TABLET_TOOL_TIP:
+	case LIBINPUT_EVENT_TABLET_TOOL_BUTTON:
+		xf86libinput_trace_tablet_tool(r, libinput_event_get_tablet_tool_event(event));
+		break;
+	default:
+		break;
+	}
 
-	xf86PostMotionEventM(dev, Absolute, mask);
+	trace_commit(&driver_context.trace);
 }
 
 static enum event_handling
 xf86libinput_handle_event(struct libinput_event *event)
 {
 	struct libinput_device *device;
+	struct xf86libinput_device *shared_device;
 	enum libinput_event_type type;
 	InputInfoPtr pInfo;
 	enum event_handling event_handling = EVENT_HANDLED;
+	int idx;
 
 	type = libinput_event_get_type(event);
+
+	/* Anything but motion ends the currently batched motion so the
+	   event order stays intact */
+	if (type != LIBINPUT_EVENT_POINTER_MOTION &&
+	    type != LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE)
+		xf86libinput_flush_motion();
+
 	device = libinput_event_get_device(event);
-	pInfo = xf86libinput_pick_device(libinput_device_get_user_data(device),
-					 event);
+	shared_device = libinput_device_get_user_data(device);
+	pInfo = xf86libinput_pick_device(shared_device, event);
+
+	if (!pInfo) {
+		if (shared_device)
+			shared_device->counters.unrouted++;
+		goto out;
+	}
 
-	if (!pInfo || !pInfo->dev->public.on)
+	if (!pInfo->dev->public.on) {
+		((struct xf86libinput *)pInfo->private)->counters.discarded_off++;
 		goto out;
+	}
 
 	switch (type) {
 		case LIBINPUT_EVENT_NONE:
@@ -2270,15 +4042,26 @@ xf86libinput_handle_event(struct libinput_event *event)
 						libinput_event_get_keyboard_event(event));
 			break;
 		case LIBINPUT_EVENT_POINTER_AXIS:
+#if !HAVE_LIBINPUT_AXIS_VALUE_V120
+			/* otherwise we get the scroll events below too */
 			xf86libinput_handle_axis(pInfo,
 						 libinput_event_get_pointer_event(event));
+#endif
 			break;
-		case LIBINPUT_EVENT_TOUCH_FRAME:
+#if HAVE_LIBINPUT_AXIS_VALUE_V120
+		case LIBINPUT_EVENT_POINTER_SCROLL_WHEEL:
+		case LIBINPUT_EVENT_POINTER_SCROLL_FINGER:
+		case LIBINPUT_EVENT_POINTER_SCROLL_CONTINUOUS:
+			xf86libinput_handle_scroll(pInfo,
+						   libinput_event_get_pointer_event(event),
+						   type);
 			break;
+#endif
 		case LIBINPUT_EVENT_TOUCH_UP:
 		case LIBINPUT_EVENT_TOUCH_DOWN:
 		case LIBINPUT_EVENT_TOUCH_MOTION:
 		case LIBINPUT_EVENT_TOUCH_CANCEL:
+		case LIBINPUT_EVENT_TOUCH_FRAME:
 			xf86libinput_handle_touch(pInfo,
 						  libinput_event_get_touch_event(event),
 						  libinput_event_get_type(event));
@@ -2289,6 +4072,9 @@ xf86libinput_handle_event(struct libinput_event *event)
 		case LIBINPUT_EVENT_GESTURE_PINCH_BEGIN:
 		case LIBINPUT_EVENT_GESTURE_PINCH_UPDATE:
 		case LIBINPUT_EVENT_GESTURE_PINCH_END:
+			xf86libinput_handle_gesture(pInfo,
+						    libinput_event_get_gesture_event(event),
+						    type);
 			break;
 		case LIBINPUT_EVENT_TABLET_TOOL_AXIS:
 			event_handling = xf86libinput_handle_tablet_axis(pInfo,
@@ -2320,80 +4106,272 @@ xf86libinput_handle_event(struct libinput_event *event)
 			break;
 	}
 
+	idx = event_counter_index(type);
+	if (event_handling == EVENT_HANDLED && idx >= 0) {
+		struct xf86libinput *driver_data = pInfo->private;
+
+		driver_data->counters.handled[idx]++;
+	}
+
+#if ENABLE_LATENCY_STATS
+	if (event_handling == EVENT_HANDLED)
+		xf86libinput_record_latency(pInfo, event);
+#endif
+
 out:
 	return event_handling;
 }
 
-static void
-xf86libinput_read_input(InputInfoPtr pInfo)
+static inline bool
+xf86libinput_budget_available(struct xf86libinput_device *shared_device)
 {
-	struct libinput *libinput = driver_context.libinput;
-	int rc;
-	struct libinput_event *event;
-
-        rc = libinput_dispatch(libinput);
-	if (rc == -EAGAIN)
-		return;
+	uint32_t generation = shared_device->context->budget_generation;
 
-	if (rc < 0) {
-		xf86IDrvMsg(pInfo, X_ERROR,
-			    "Error reading events: %s\n",
-			    strerror(-rc));
-		return;
+	if (shared_device->budget.generation != generation) {
+		shared_device->budget.generation = generation;
+		shared_device->budget.used = 0;
 	}
 
-	while ((event = libinput_get_event(libinput))) {
-		if (xf86libinput_handle_event(event) == EVENT_HANDLED)
-			libinput_event_destroy(event);
-	}
+	return shared_device->budget.used < shared_device->budget.limit;
 }
 
-/*
-   libinput provides a userdata for the context, but not per path device. so
-   the open_restricted call has the libinput context, but no reference to
-   the pInfo->fd that we actually need to return.
-   The server stores the fd in the options though, so we just get it from
-   there. If a device is added twice with two different fds this may give us
-   the wrong fd but why are you doing that anyway.
- */
-static int
-open_restricted(const char *path, int flags, void *data)
+static struct libinput_event *
+xf86libinput_pop_deferred(struct xf86libinput_device *shared_device)
 {
-	InputInfoPtr pInfo;
-	int fd = -1;
+	struct libinput_event *event;
+	size_t idx = shared_device->budget.first;
 
-	/* Special handling for sysfs files (used for pad LEDs) */
-	if (strneq(path, "/sys/", 5)) {
-		fd = open(path, flags);
-		return fd < 0 ? -errno : fd;
-	}
+	event = shared_device->budget.events[idx];
+	shared_device->budget.first = (idx + 1) % shared_device->budget.size;
+	shared_device->budget.count--;
 
-	nt_list_for_each_entry(pInfo, xf86FirstLocalDevice(), next) {
-		char *device = xf86CheckStrOption(pInfo->options, "Device", NULL);
+	return event;
+}
 
-		if (device != NULL && streq(path, device)) {
-			free(device);
-			break;
-		}
-		free(device);
-	}
+static void
+xf86libinput_handle_deferred_event(struct xf86libinput_device *shared_device)
+{
+	struct libinput_event *event;
 
-	if (pInfo == NULL) {
-		xf86Msg(X_ERROR, "Failed to look up path '%s'\n", path);
-		return -ENODEV;
-	}
+	event = xf86libinput_pop_deferred(shared_device);
+	if (xf86libinput_handle_event(event) == EVENT_HANDLED)
+		libinput_event_destroy(event);
+}
 
-	fd = xf86OpenSerial(pInfo->options);
-	if (fd < 0)
-		return -errno;
+static bool
+xf86libinput_grow_deferred(struct xf86libinput_device *shared_device)
+{
+	struct libinput_event **events;
+	size_t size = shared_device->budget.size;
+	size_t first = shared_device->budget.first;
+	size_t newsize = size ? size * 2 : 64;
 
-	xf86FlushInput(fd);
+	if (newsize > DEFERRED_EVENTS_MAX)
+		return false;
 
-	return fd;
-}
+	events = realloc(shared_device->budget.events,
+			 newsize * sizeof(*events));
+	if (!events)
+		return false;
 
-static void
-close_restricted(int fd, void *data)
+	/* unwrap the ring into the new space */
+	if (first + shared_device->budget.count > size)
+		memcpy(&events[size], events,
+		       (first + shared_device->budget.count - size) * sizeof(*events));
+
+	shared_device->budget.events = events;
+	shared_device->budget.size = newsize;
+
+	return true;
+}
+
+/* Returns true if the event was taken, it will be handled once the
+ * device has budget again. Events for a device with deferred events
+ * always queue up behind those to keep them in order.
+ */
+static bool
+xf86libinput_defer_event(struct libinput_event *event)
+{
+	struct xf86libinput_device *shared_device;
+	size_t idx;
+
+	shared_device = libinput_device_get_user_data(libinput_event_get_device(event));
+	if (!shared_device || shared_device->budget.limit == 0)
+		return false;
+
+	if (xf86libinput_budget_available(shared_device) &&
+	    shared_device->budget.count == 0) {
+		shared_device->budget.used++;
+		return false;
+	}
+
+	/* When we can't defer any more, handle the oldest one now, the
+	   device is effectively unlimited until it calms down */
+	if (shared_device->budget.count == shared_device->budget.size &&
+	    !xf86libinput_grow_deferred(shared_device)) {
+		if (shared_device->budget.count == 0)
+			return false;
+		xf86libinput_handle_deferred_event(shared_device);
+	}
+
+	idx = (shared_device->budget.first + shared_device->budget.count) %
+		shared_device->budget.size;
+	shared_device->budget.events[idx] = event;
+	shared_device->budget.count++;
+
+	if (xorg_list_is_empty(&shared_device->budget.link))
+		xorg_list_append(&shared_device->budget.link,
+				 &driver_context.deferred_devices);
+
+	return true;
+}
+
+/* Each device with deferred events gets its budget's worth, the first
+ * one moves to the back so nobody is always first */
+static void
+xf86libinput_handle_deferred_events(void)
+{
+	struct xf86libinput_device *shared_device, *tmp;
+	struct xorg_list *list = &driver_context.deferred_devices;
+
+	xorg_list_for_each_entry_safe(shared_device, tmp, list, budget.link) {
+		while (shared_device->budget.count > 0 &&
+		       xf86libinput_budget_available(shared_device)) {
+			shared_device->budget.used++;
+			xf86libinput_handle_deferred_event(shared_device);
+		}
+
+		if (shared_device->budget.count == 0)
+			xorg_list_del(&shared_device->budget.link);
+	}
+
+	if (!xorg_list_is_empty(list)) {
+		shared_device = xorg_list_first_entry(list,
+						      struct xf86libinput_device,
+						      budget.link);
+		xorg_list_del(&shared_device->budget.link);
+		xorg_list_append(&shared_device->budget.link, list);
+	}
+}
+
+static CARD32
+xf86libinput_deferred_timer_cb(OsTimerPtr timer, CARD32 time, void *data)
+{
+	CARD32 next = 0;
+	int i;
+
+#if HAVE_THREADED_INPUT
+	input_lock();
+#else
+	int sigstate = xf86BlockSIGIO();
+#endif
+	for (i = 0; i < INPUT_CONTEXTS_MAX; i++)
+		driver_context.contexts[i].budget_generation++;
+	xf86libinput_handle_deferred_events();
+	xf86libinput_flush_motion();
+
+	if (!xorg_list_is_empty(&driver_context.deferred_devices))
+		next = 1;
+#if HAVE_THREADED_INPUT
+	input_unlock();
+#else
+	xf86UnblockSIGIO(sigstate);
+#endif
+
+	return next;
+}
+
+static void
+xf86libinput_read_input(InputInfoPtr pInfo)
+{
+	struct xf86libinput_context *context = xf86libinput_get_context(pInfo);
+	struct libinput *libinput = context->libinput;
+	int rc;
+	struct libinput_event *event;
+
+        rc = libinput_dispatch(libinput);
+	if (rc == -EAGAIN)
+		return;
+
+	if (rc < 0) {
+		xf86IDrvMsg(pInfo, X_ERROR,
+			    "Error reading events: %s\n",
+			    strerror(-rc));
+		return;
+	}
+
+	context->budget_generation++;
+	xf86libinput_handle_deferred_events();
+
+	while ((event = libinput_get_event(libinput))) {
+		if (driver_context.trace.header)
+			xf86libinput_trace_event(event);
+
+		if (xf86libinput_defer_event(event))
+			continue;
+
+		if (xf86libinput_handle_event(event) == EVENT_HANDLED)
+			libinput_event_destroy(event);
+	}
+
+	xf86libinput_flush_motion();
+
+	/* Our fd won't wake us up for events we already read, the
+	   timer does. It also gives the server a chance to process
+	   what we just posted */
+	if (!xorg_list_is_empty(&driver_context.deferred_devices))
+		driver_context.deferred_timer = TimerSet(driver_context.deferred_timer,
+							 0, 1,
+							 xf86libinput_deferred_timer_cb,
+							 NULL);
+}
+
+/*
+   libinput provides a userdata for the context, but not per path device. so
+   the open_restricted call has the libinput context, but no reference to
+   the pInfo->fd that we actually need to return.
+   The server stores the fd in the options though, so we just get it from
+   there. If a device is added twice with two different fds this may give us
+   the wrong fd but why are you doing that anyway.
+ */
+static int
+open_restricted(const char *path, int flags, void *data)
+{
+	InputInfoPtr pInfo;
+	int fd = -1;
+
+	/* Special handling for sysfs files (used for pad LEDs) */
+	if (strneq(path, "/sys/", 5)) {
+		fd = open(path, flags);
+		return fd < 0 ? -errno : fd;
+	}
+
+	nt_list_for_each_entry(pInfo, xf86FirstLocalDevice(), next) {
+		char *device = xf86CheckStrOption(pInfo->options, "Device", NULL);
+
+		if (device != NULL && streq(path, device)) {
+			free(device);
+			break;
+		}
+		free(device);
+	}
+
+	if (pInfo == NULL) {
+		xf86Msg(X_ERROR, "Failed to look up path '%s'\n", path);
+		return -ENODEV;
+	}
+
+	fd = xf86OpenSerial(pInfo->options);
+	if (fd < 0)
+		return -errno;
+
+	xf86FlushInput(fd);
+
+	return fd;
+}
+
+static void
+close_restricted(int fd, void *data)
 {
 	InputInfoPtr pInfo;
 	int server_fd = -1;
@@ -2450,6 +4428,19 @@ xf86libinput_log_handler(struct libinput *libinput,
 	LogVMessageVerb(type, verbosity, format, args);
 }
 
+/* The lowest priority the server would log with the given verbosity,
+ * see the verbosities in xf86libinput_log_handler */
+static inline enum libinput_log_priority
+xf86libinput_log_priority_from_verbosity(int verbosity)
+{
+	if (verbosity >= 10)
+		return LIBINPUT_LOG_PRIORITY_DEBUG;
+	else if (verbosity >= 3)
+		return LIBINPUT_LOG_PRIORITY_INFO;
+	else
+		return LIBINPUT_LOG_PRIORITY_ERROR;
+}
+
 static inline BOOL
 xf86libinput_parse_tap_option(InputInfoPtr pInfo,
 			      struct libinput_device *device)
@@ -2936,6 +4927,109 @@ xf86libinput_parse_horiz_scroll_option(InputInfoPtr pInfo)
 	return xf86SetBoolOption(pInfo->options, "HorizontalScrolling", TRUE);
 }
 
+static inline BOOL
+xf86libinput_parse_motion_batching_option(InputInfoPtr pInfo)
+{
+	return xf86SetBoolOption(pInfo->options, "MotionBatching", FALSE);
+}
+
+static inline BOOL
+xf86libinput_parse_gesture_passthrough_option(InputInfoPtr pInfo)
+{
+	return xf86SetBoolOption(pInfo->options, "GesturePassthrough", FALSE);
+}
+
+static inline BOOL
+xf86libinput_parse_raw_motion_option(InputInfoPtr pInfo)
+{
+	return xf86SetBoolOption(pInfo->options, "RawMotion", FALSE);
+}
+
+static inline BOOL
+xf86libinput_parse_pad_scrolling_option(InputInfoPtr pInfo)
+{
+	return xf86SetBoolOption(pInfo->options, "TabletPadScrolling", FALSE);
+}
+
+static inline BOOL
+xf86libinput_parse_probe_once_option(InputInfoPtr pInfo)
+{
+	return xf86SetBoolOption(pInfo->options, "ProbeOnce", FALSE);
+}
+
+static inline enum input_context_type
+xf86libinput_context_class(struct libinput_device *device)
+{
+	if (libinput_device_has_capability(device, LIBINPUT_DEVICE_CAP_TABLET_TOOL))
+		return INPUT_CONTEXT_CLASS_TABLET;
+	if (libinput_device_has_capability(device, LIBINPUT_DEVICE_CAP_TABLET_PAD))
+		return INPUT_CONTEXT_CLASS_TABLET_PAD;
+	if (libinput_device_has_capability(device, LIBINPUT_DEVICE_CAP_TOUCH))
+		return INPUT_CONTEXT_CLASS_TOUCH;
+	if (libinput_device_has_capability(device, LIBINPUT_DEVICE_CAP_POINTER))
+		return INPUT_CONTEXT_CLASS_POINTER;
+	return INPUT_CONTEXT_CLASS_KEYBOARD;
+}
+
+/* The trace is shared by all devices, the first device with the
+ * option starts it */
+static void
+xf86libinput_parse_trace_option(InputInfoPtr pInfo)
+{
+	char *path;
+	int size;
+	int rc;
+
+	if (driver_context.trace.header)
+		return;
+
+	path = xf86CheckStrOption(pInfo->options, "EventTrace", NULL);
+	if (!path)
+		return;
+
+	size = xf86SetIntOption(pInfo->options, "EventTraceSize", EVENT_TRACE_SIZE);
+	if (size < 2) {
+		xf86IDrvMsg(pInfo, X_ERROR,
+			    "Invalid EventTraceSize %d, using %d instead\n",
+			    size, EVENT_TRACE_SIZE);
+		size = EVENT_TRACE_SIZE;
+	}
+
+	rc = trace_open(&driver_context.trace, path, size);
+	if (rc != 0)
+		xf86IDrvMsg(pInfo, X_ERROR,
+			    "Failed to create event trace %s: %s\n",
+			    path, strerror(-rc));
+	else
+		xf86IDrvMsg(pInfo, X_INFO,
+			    "Recording events to %s\n", path);
+
+	free(path);
+}
+
+static inline enum input_context_type
+xf86libinput_parse_input_context_option(InputInfoPtr pInfo,
+					struct libinput_device *device)
+{
+	enum input_context_type type = INPUT_CONTEXT_SHARED;
+	char *str;
+
+	str = xf86SetStrOption(pInfo->options, "InputContext", NULL);
+	if (str) {
+		if (streq(str, "class"))
+			type = xf86libinput_context_class(device);
+		else if (streq(str, "device"))
+			type = INPUT_CONTEXT_DEVICE;
+		else if (!streq(str, "shared"))
+			xf86IDrvMsg(pInfo, X_ERROR,
+				    "Invalid InputContext: %s\n",
+				    str);
+		free(str);
+	}
+
+	return type;
+}
+
 static inline double
 xf86libinput_parse_rotation_angle_option(InputInfoPtr pInfo,
 					 struct libinput_device *device)
@@ -2959,6 +5053,39 @@ xf86libinput_parse_rotation_angle_option(InputInfoPtr pInfo,
 	return angle;
 }
 
+static void
+xf86libinput_parse_pressurecurve_precision_option(InputInfoPtr pInfo,
+						  struct xf86libinput *driver_data)
+{
+	int sz, nsegments;
+
+	sz = xf86SetIntOption(pInfo->options,
+			      "TabletToolPressureCurveSize",
+			      0);
+	if (sz == 0)
+		return;
+
+	if (sz < 2 || sz > BEZIER_MAX_SIZE) {
+		xf86IDrvMsg(pInfo, X_ERROR,
+			    "Invalid pressure curve size %d, must be between 2 and %d\n",
+			    sz, BEZIER_MAX_SIZE);
+		return;
+	}
+
+	nsegments = xf86SetIntOption(pInfo->options,
+				     "TabletToolPressureCurveSegments",
+				     256);
+	if (nsegments < 1 || nsegments > BEZIER_MAX_SIZE) {
+		xf86IDrvMsg(pInfo, X_ERROR,
+			    "Invalid pressure curve segment count %d\n",
+			    nsegments);
+		return;
+	}
+
+	driver_data->pressurecurve.sz = sz;
+	driver_data->pressurecurve.nsegments = nsegments;
+}
+
 static void
 xf86libinput_parse_pressurecurve_option(InputInfoPtr pInfo,
 					struct xf86libinput *driver_data,
@@ -2974,14 +5101,15 @@ xf86libinput_parse_pressurecurve_option(InputInfoPtr pInfo,
 	char *str;
 	int rc = 0;
 	int test_bezier[64];
-	struct libinput_tablet_tool *tool = driver_data->tablet_tool;
 
 	if ((driver_data->capabilities & CAP_TABLET_TOOL) == 0)
 		return;
 
-	if (!tool || !libinput_tablet_tool_has_pressure(tool))
+	if (!(driver_data->tool_desc.axes & TOOL_AXIS_PRESSURE))
 		return;
 
+	xf86libinput_parse_pressurecurve_precision_option(pInfo, driver_data);
+
 	str = xf86SetStrOption(pInfo->options,
 			       "TabletToolPressureCurve",
 			       NULL);
@@ -3035,6 +5163,85 @@ want_area_handling(struct xf86libinput *driver_data)
 	return !libinput_device_config_calibration_has_matrix(device);
 }
 
+static inline int
+xf86libinput_parse_tool_queue_option(InputInfoPtr pInfo)
+{
+	int size;
+
+	size = xf86SetIntOption(pInfo->options,
+				"TabletToolEventQueueSize",
+				TOOL_EVENT_QUEUE_SIZE);
+	/* we need at least room for the proximity event */
+	if (size < 2) {
+		xf86IDrvMsg(pInfo, X_ERROR,
+			    "Invalid tablet tool event queue size %d, using %d instead\n",
+			    size, TOOL_EVENT_QUEUE_SIZE);
+		size = TOOL_EVENT_QUEUE_SIZE;
+	}
+
+	return size;
+}
+
+static inline int
+xf86libinput_parse_tool_axis_rate_option(InputInfoPtr pInfo)
+{
+	int rate;
+
+	rate = xf86SetIntOption(pInfo->options, "TabletToolAxisRate", 0);
+	if (rate < 0) {
+		xf86IDrvMsg(pInfo, X_ERROR,
+			    "Invalid tablet tool axis rate %d, using 0 instead\n",
+			    rate);
+		rate = 0;
+	}
+
+	return rate;
+}
+
+static inline int
+xf86libinput_parse_tool_prediction_option(InputInfoPtr pInfo)
+{
+	int ms;
+
+	ms = xf86SetIntOption(pInfo->options, "TabletToolPrediction", 0);
+	if (ms < 0 || ms > TABLET_PREDICTION_MAX) {
+		xf86IDrvMsg(pInfo, X_ERROR,
+			    "Invalid tablet tool prediction %dms, using 0 instead\n",
+			    ms);
+		ms = 0;
+	}
+
+	return ms;
+}
+
+/* Only the tool subdevices post axis events, the tablet device itself
+ * never uses these */
+static void
+xf86libinput_parse_tool_options(InputInfoPtr pInfo,
+				struct xf86libinput *driver_data)
+{
+	xf86libinput_set_axis_rate(driver_data,
+				   xf86libinput_parse_tool_axis_rate_option(pInfo));
+	xf86libinput_set_prediction(driver_data,
+				    xf86libinput_parse_tool_prediction_option(pInfo));
+}
+
+static inline int
+xf86libinput_parse_event_budget_option(InputInfoPtr pInfo)
+{
+	int budget;
+
+	budget = xf86SetIntOption(pInfo->options, "EventBudget", 0);
+	if (budget < 0) {
+		xf86IDrvMsg(pInfo, X_ERROR,
+			    "Invalid event budget %d, disabling\n",
+			    budget);
+		budget = 0;
+	}
+
+	return budget;
+}
+
 static void
 xf86libinput_parse_tablet_area_option(InputInfoPtr pInfo,
 				      struct xf86libinput *driver_data,
@@ -3064,14 +5271,48 @@ out:
 	free(str);
 }
 
-static void
-xf86libinput_parse_options(InputInfoPtr pInfo,
-			   struct xf86libinput *driver_data,
-			   struct libinput_device *device)
+/* A hash of the option list as the parsers see it: names are
+ * case-insensitive and ignore '_' and ' ', options starting with '_'
+ * are internal and the Name differs between subdevices anyway. The
+ * order doesn't matter.
+ */
+static uint64_t
+xf86libinput_hash_options(XF86OptionPtr list)
 {
-	struct options *options = &driver_data->options;
+	const uint64_t prime = 1099511628211ULL;
+	uint64_t hash = 0;
+	XF86OptionPtr o;
+
+	for (o = list; o; o = xf86NextOption(o)) {
+		const char *name = xf86OptionName(o);
+		const char *value = xf86OptionValue(o);
+		uint64_t h = 14695981039346656037ULL;
+
+		if (name[0] == '_' || xf86NameCmp(name, "Name") == 0)
+			continue;
+
+		for (; *name; name++) {
+			if (*name == '_' || *name == ' ')
+				continue;
+			h = (h ^ tolower((unsigned char)*name)) * prime;
+		}
+		h = (h ^ '=') * prime;
+		for (; value && *value; value++)
+			h = (h ^ (unsigned char)*value) * prime;
 
-	/* libinput options */
+		hash += h;
+	}
+
+	return hash;
+}
+
+/* The options that only depend on the libinput device and the option
+ * list, not on the capabilities of this X device */
+static void
+xf86libinput_parse_device_options(InputInfoPtr pInfo,
+				  struct options *options,
+				  struct libinput_device *device)
+{
 	options->tapping = xf86libinput_parse_tap_option(pInfo, device);
 	options->tap_drag = xf86libinput_parse_tap_drag_option(pInfo, device);
 	options->tap_drag_lock = xf86libinput_parse_tap_drag_lock_option(pInfo, device);
@@ -3087,15 +5328,40 @@ xf86libinput_parse_options(InputInfoPtr pInfo,
 	options->middle_emulation = xf86libinput_parse_middleemulation_option(pInfo, device);
 	options->disable_while_typing = xf86libinput_parse_disablewhiletyping_option(pInfo, device);
 	options->rotation_angle = xf86libinput_parse_rotation_angle_option(pInfo, device);
-	xf86libinput_parse_calibration_option(pInfo, device, driver_data->options.matrix);
+	xf86libinput_parse_calibration_option(pInfo, device, options->matrix);
 
 	/* non-libinput options */
 	xf86libinput_parse_buttonmap_option(pInfo,
 					    options->btnmap,
 					    sizeof(options->btnmap));
+	options->event_budget = xf86libinput_parse_event_budget_option(pInfo);
+}
+
+static void
+xf86libinput_parse_options(InputInfoPtr pInfo,
+			   struct xf86libinput *driver_data,
+			   struct libinput_device *device)
+{
+	struct xf86libinput_device *shared_device = driver_data->shared_device;
+	struct options *options = &driver_data->options;
+	uint64_t hash;
+
+	hash = xf86libinput_hash_options(pInfo->options);
+	if (shared_device->parsed.valid && shared_device->parsed.hash == hash) {
+		*options = shared_device->parsed.options;
+	} else {
+		xf86libinput_parse_device_options(pInfo, options, device);
+		shared_device->parsed.options = *options;
+		shared_device->parsed.hash = hash;
+		shared_device->parsed.valid = true;
+	}
+
 	if (driver_data->capabilities & CAP_POINTER) {
 		xf86libinput_parse_draglock_option(pInfo, driver_data);
 		options->horiz_scrolling_enabled = xf86libinput_parse_horiz_scroll_option(pInfo);
+		options->motion_batching = xf86libinput_parse_motion_batching_option(pInfo);
+		options->gesture_passthrough = xf86libinput_parse_gesture_passthrough_option(pInfo);
+		options->raw_motion = xf86libinput_parse_raw_motion_option(pInfo);
 	}
 
 	xf86libinput_parse_pressurecurve_option(pInfo,
@@ -3104,158 +5370,413 @@ xf86libinput_parse_options(InputInfoPtr pInfo,
 	xf86libinput_parse_tablet_area_option(pInfo,
 					      driver_data,
 					      &options->area);
+	if (driver_data->capabilities & CAP_TABLET)
+		options->tool_queue_size = xf86libinput_parse_tool_queue_option(pInfo);
+	if (driver_data->capabilities & CAP_TABLET_TOOL)
+		xf86libinput_parse_tool_options(pInfo, driver_data);
+	if (driver_data->capabilities & CAP_TABLET_PAD)
+		options->pad_scrolling = xf86libinput_parse_pad_scrolling_option(pInfo);
+}
+
+static const char*
+xf86libinput_get_type_name(struct libinput_device *device,
+			   struct xf86libinput *driver_data)
+{
+	const char *type_name;
+
+	/* now pick an actual type */
+	if (libinput_device_config_tap_get_finger_count(device) > 0)
+		type_name = XI_TOUCHPAD;
+	else if (driver_data->capabilities & CAP_TOUCH)
+		type_name = XI_TOUCHSCREEN;
+	else if (driver_data->capabilities & CAP_POINTER)
+		type_name = XI_MOUSE;
+	else if (driver_data->capabilities & CAP_TABLET)
+		type_name = XI_TABLET;
+	else if (driver_data->capabilities & CAP_TABLET_PAD)
+		type_name = "PAD";
+	else if (driver_data->capabilities & CAP_TABLET_TOOL){
+		switch (driver_data->tool_desc.type) {
+		case LIBINPUT_TABLET_TOOL_TYPE_PEN:
+		case LIBINPUT_TABLET_TOOL_TYPE_BRUSH:
+		case LIBINPUT_TABLET_TOOL_TYPE_PENCIL:
+		case LIBINPUT_TABLET_TOOL_TYPE_AIRBRUSH:
+			type_name = "STYLUS";
+			break;
+		case LIBINPUT_TABLET_TOOL_TYPE_ERASER:
+			type_name = "ERASER";
+			break;
+		case LIBINPUT_TABLET_TOOL_TYPE_MOUSE:
+		case LIBINPUT_TABLET_TOOL_TYPE_LENS:
+			type_name = "CURSOR";
+			break;
+		default:
+			type_name = XI_TABLET;
+			break;
+		}
+	} else
+		type_name = XI_KEYBOARD;
+
+	return type_name;
+}
+
+static struct libinput *
+xf86libinput_context_new(struct xf86libinput_context *context)
+{
+	struct libinput *shared = driver_context.contexts[INPUT_CONTEXT_SHARED].libinput;
+	struct libinput *libinput;
+	enum libinput_log_priority priority;
+
+	libinput = libinput_path_create_context(&interface, &driver_context);
+	if (!libinput)
+		return NULL;
+
+	/* don't have libinput format messages the server
+	   drops anyway, see "libinput Log Priority" */
+	if (shared)
+		priority = libinput_log_get_priority(shared);
+	else
+		priority = xf86libinput_log_priority_from_verbosity(xf86GetVerbosity());
+
+	libinput_log_set_handler(libinput, xf86libinput_log_handler);
+	libinput_log_set_priority(libinput, priority);
+
+	memset(context, 0, sizeof(*context));
+	context->libinput = libinput;
+
+	return libinput;
+}
+
+static void
+xf86libinput_init_driver_context(void)
+{
+	struct xf86libinput_context *context = &driver_context.contexts[INPUT_CONTEXT_SHARED];
+
+	if (!context->libinput) {
+		xorg_list_init(&driver_context.deferred_devices);
+		xf86libinput_context_new(context);
+	} else {
+		libinput_ref(context->libinput);
+	}
+}
+
+/* Moves a new shared device into the context picked by "InputContext".
+ * This happens before the device is first added to it, we only have it
+ * in the shared context for probing. If there's no context left, the
+ * device stays in the shared one */
+static void
+xf86libinput_shared_set_context(InputInfoPtr pInfo,
+				struct xf86libinput_device *shared_device,
+				enum input_context_type type)
+{
+	struct xf86libinput_context *context = NULL;
+	int i;
+
+	if (type == INPUT_CONTEXT_SHARED)
+		return;
+
+	if (type == INPUT_CONTEXT_DEVICE) {
+		for (i = INPUT_CONTEXT_DEVICE; i < INPUT_CONTEXTS_MAX; i++) {
+			if (!driver_context.contexts[i].libinput) {
+				context = &driver_context.contexts[i];
+				break;
+			}
+		}
+	} else {
+		context = &driver_context.contexts[type];
+	}
+
+	if (!context) {
+		xf86IDrvMsg(pInfo, X_WARNING,
+			    "Too many input contexts, using the shared one\n");
+		return;
+	}
+
+	if (context->libinput)
+		libinput_ref(context->libinput);
+	else if (!xf86libinput_context_new(context)) {
+		xf86IDrvMsg(pInfo, X_WARNING,
+			    "Failed to create an input context, using the shared one\n");
+		return;
+	}
+
+	/* The probed device belongs to the shared context, drop it like
+	   we do without ProbeOnce */
+	if (shared_device->probed) {
+		libinput_path_remove_device(shared_device->device);
+		shared_device->probed = false;
+	}
+
+	shared_device->context = context;
+}
+
+/* Subdevices waiting to be created, grouped by their parent device.
+ * They're all created from one work proc, under one input_lock() */
+struct xf86libinput_hotplug_info {
+	struct xorg_list node; /* driver_context.pending_hotplugs */
+	uint32_t shared_device_id;
+	InputAttributes *attrs;
+	XF86OptionPtr options; /* the parent's, shared by all subdevices */
+	char *tool_registry; /* only set if a tool needs registering */
+
+	size_t nsubdevices;
+	struct subdevice_request {
+		uint32_t capabilities;
+		XF86OptionPtr extra_options;
+		bool register_tool;
+		struct tool_registry_entry tool;
+	} *subdevices;
+};
+
+static InputOption *
+xf86libinput_hotplug_options(struct xf86libinput_hotplug_info *hotplug,
+			     struct subdevice_request *request)
+{
+	InputOption *iopts = NULL;
+	XF86OptionPtr options, o;
+	uint32_t capabilities = request->capabilities;
+
+	options = xf86OptionListDuplicate(hotplug->options);
+	options = xf86OptionListMerge(options, request->extra_options);
+	request->extra_options = NULL;
+
+	if (capabilities & CAP_KEYBOARD)
+		options = xf86ReplaceBoolOption(options, "_libinput/cap-keyboard", 1);
+	if (capabilities & CAP_POINTER)
+		options = xf86ReplaceBoolOption(options, "_libinput/cap-pointer", 1);
+	if (capabilities & CAP_TOUCH)
+		options = xf86ReplaceBoolOption(options, "_libinput/cap-touch", 1);
+	if (capabilities & CAP_TABLET_TOOL)
+		options = xf86ReplaceBoolOption(options, "_libinput/cap-tablet-tool", 1);
+	if (capabilities & CAP_TABLET_PAD)
+		options = xf86ReplaceBoolOption(options, "_libinput/cap-tablet-pad", 1);
+
+	/* need convert from one option list to the other. woohoo. */
+	o = options;
+	while (o) {
+		iopts = input_option_new(iopts,
+					 xf86OptionName(o),
+					 xf86OptionValue(o));
+		o = xf86NextOption(o);
+	}
+	xf86OptionListFree(options);
+
+	return iopts;
+}
+
+static void
+xf86libinput_hotplug_info_free(struct xf86libinput_hotplug_info *hotplug)
+{
+	size_t i;
+
+	for (i = 0; i < hotplug->nsubdevices; i++)
+		xf86OptionListFree(hotplug->subdevices[i].extra_options);
+	free(hotplug->subdevices);
+	xf86OptionListFree(hotplug->options);
+	FreeInputAttributes(hotplug->attrs);
+	free(hotplug->tool_registry);
+	free(hotplug);
+}
+
+/* A subdevice created from the registry whose tool has changed type or
+ * axes since never binds the tool, see xf86libinput_tool_matches(). It
+ * is replaced by the new subdevice and its registry entry overwritten */
+static void
+xf86libinput_remove_stale_tool_device(DeviceIntPtr dev)
+{
+	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct xf86libinput *driver_data = pInfo->private;
+	struct xf86libinput *d, *stale = NULL;
+
+	xorg_list_for_each_entry(d,
+				 &driver_data->shared_device->device_list,
+				 shared_device_link) {
+		if (d != driver_data &&
+		    (d->capabilities & CAP_TABLET_TOOL) &&
+		    d->tablet_tool == NULL &&
+		    d->tool_desc.serial == driver_data->tool_desc.serial &&
+		    d->tool_desc.tool_id == driver_data->tool_desc.tool_id) {
+			stale = d;
+			break;
+		}
+	}
+
+	if (!stale)
+		return;
+
+	xf86IDrvMsg(stale->pInfo, X_INFO,
+		    "tool has changed since it was registered, removing\n");
+	DeleteInputDeviceRequest(stale->pInfo->dev);
 }
 
-static const char*
-xf86libinput_get_type_name(struct libinput_device *device,
-			   struct xf86libinput *driver_data)
+static void
+xf86libinput_hotplug_devices(struct xf86libinput_hotplug_info *hotplug)
 {
-	const char *type_name;
+	size_t i;
 
-	/* now pick an actual type */
-	if (libinput_device_config_tap_get_finger_count(device) > 0)
-		type_name = XI_TOUCHPAD;
-	else if (driver_data->capabilities & CAP_TOUCH)
-		type_name = XI_TOUCHSCREEN;
-	else if (driver_data->capabilities & CAP_POINTER)
-		type_name = XI_MOUSE;
-	else if (driver_data->capabilities & CAP_TABLET)
-		type_name = XI_TABLET;
-	else if (driver_data->capabilities & CAP_TABLET_PAD)
-		type_name = "PAD";
-	else if (driver_data->capabilities & CAP_TABLET_TOOL){
-		switch (libinput_tablet_tool_get_type(driver_data->tablet_tool)) {
-		case LIBINPUT_TABLET_TOOL_TYPE_PEN:
-		case LIBINPUT_TABLET_TOOL_TYPE_BRUSH:
-		case LIBINPUT_TABLET_TOOL_TYPE_PENCIL:
-		case LIBINPUT_TABLET_TOOL_TYPE_AIRBRUSH:
-			type_name = "STYLUS";
-			break;
-		case LIBINPUT_TABLET_TOOL_TYPE_ERASER:
-			type_name = "ERASER";
-			break;
-		case LIBINPUT_TABLET_TOOL_TYPE_MOUSE:
-		case LIBINPUT_TABLET_TOOL_TYPE_LENS:
-			type_name = "CURSOR";
-			break;
-		default:
-			type_name = XI_TABLET;
-			break;
-		}
-	} else
-		type_name = XI_KEYBOARD;
+	for (i = 0; i < hotplug->nsubdevices; i++) {
+		struct subdevice_request *request = &hotplug->subdevices[i];
+		InputOption *iopts;
+		DeviceIntPtr dev;
+		int rc;
 
-	return type_name;
+		iopts = xf86libinput_hotplug_options(hotplug, request);
+		rc = NewInputDeviceRequest(iopts, hotplug->attrs, &dev);
+		input_option_free_list(&iopts);
+
+		if (rc != Success)
+			request->register_tool = false;
+		else if (request->register_tool)
+			xf86libinput_remove_stale_tool_device(dev);
+	}
 }
 
 static void
-xf86libinput_init_driver_context(void)
+xf86libinput_hotplug_register_tools(struct xf86libinput_hotplug_info *hotplug)
 {
-	if (!driver_context.libinput) {
-		driver_context.libinput = libinput_path_create_context(&interface, &driver_context);
-		libinput_log_set_handler(driver_context.libinput,
-					 xf86libinput_log_handler);
-		/* we want all msgs, let the server filter */
-		libinput_log_set_priority(driver_context.libinput,
-					  LIBINPUT_LOG_PRIORITY_DEBUG);
-	} else {
-		libinput_ref(driver_context.libinput);
+	const struct tool_registry_entry *tools[TOOL_REGISTRY_MAX];
+	size_t i, ntools = 0;
+
+	if (!hotplug->tool_registry)
+		return;
+
+	for (i = 0; i < hotplug->nsubdevices && ntools < ARRAY_SIZE(tools); i++) {
+		if (hotplug->subdevices[i].register_tool)
+			tools[ntools++] = &hotplug->subdevices[i].tool;
 	}
-}
 
-struct xf86libinput_hotplug_info {
-	InputAttributes *attrs;
-	InputOption *input_options;
-};
+	if (ntools > 0)
+		xf86libinput_register_tools(hotplug->tool_registry, tools, ntools);
+}
 
-static DeviceIntPtr
-xf86libinput_hotplug_device(struct xf86libinput_hotplug_info *hotplug)
+static Bool
+xf86libinput_hotplug_device_cb(ClientPtr client, pointer closure)
 {
-	DeviceIntPtr dev;
+	struct xf86libinput_hotplug_info *hotplug, *tmp;
+	struct xorg_list done;
+
+	xorg_list_init(&done);
 
 #if HAVE_THREADED_INPUT
 	input_lock();
 #else
 	int sigstate = xf86BlockSIGIO();
 #endif
-	if (NewInputDeviceRequest(hotplug->input_options,
-				  hotplug->attrs,
-				  &dev) != Success)
-		dev = NULL;
+	/* A new subdevice's PreInit may queue more, take
+	   them in this batch too */
+	while (!xorg_list_is_empty(&driver_context.pending_hotplugs)) {
+		hotplug = xorg_list_first_entry(&driver_context.pending_hotplugs,
+						struct xf86libinput_hotplug_info,
+						node);
+		xorg_list_del(&hotplug->node);
+		xf86libinput_hotplug_devices(hotplug);
+		xorg_list_append(&hotplug->node, &done);
+	}
+	driver_context.hotplug_queued = false;
 #if HAVE_THREADED_INPUT
 	input_unlock();
 #else
 	xf86UnblockSIGIO(sigstate);
 #endif
 
-	input_option_free_list(&hotplug->input_options);
-	FreeInputAttributes(hotplug->attrs);
-	free(hotplug);
+	/* the file I/O doesn't need to hold up the input thread */
+	xorg_list_for_each_entry_safe(hotplug, tmp, &done, node) {
+		xorg_list_del(&hotplug->node);
+		xf86libinput_hotplug_register_tools(hotplug);
+		xf86libinput_hotplug_info_free(hotplug);
+	}
 
-	return dev;
+	return TRUE;
 }
 
-static Bool
-xf86libinput_hotplug_device_cb(ClientPtr client, pointer closure)
+static struct xf86libinput_hotplug_info *
+xf86libinput_find_hotplug_info(InputInfoPtr pInfo,
+			       struct xf86libinput_device *shared_device)
 {
-	struct xf86libinput_hotplug_info *hotplug = closure;
+	struct xf86libinput_hotplug_info *hotplug;
 
-	xf86libinput_hotplug_device(hotplug);
+	if (!driver_context.hotplug_queued) {
+		xorg_list_init(&driver_context.pending_hotplugs);
+		if (!QueueWorkProc(xf86libinput_hotplug_device_cb,
+				   serverClient, NULL))
+			return NULL;
+		driver_context.hotplug_queued = true;
+	}
 
-	return TRUE;
+	xorg_list_for_each_entry(hotplug,
+				 &driver_context.pending_hotplugs,
+				 node) {
+		if (hotplug->shared_device_id == shared_device->id)
+			return hotplug;
+	}
+
+	hotplug = calloc(1, sizeof(*hotplug));
+	if (!hotplug)
+		return NULL;
+
+	hotplug->shared_device_id = shared_device->id;
+	hotplug->options = xf86OptionListDuplicate(pInfo->options);
+	hotplug->options = xf86ReplaceStrOption(hotplug->options,
+						"_source",
+						"_driver/libinput");
+	hotplug->attrs = DuplicateInputAttributes(pInfo->attrs);
+	xorg_list_append(&hotplug->node, &driver_context.pending_hotplugs);
+
+	return hotplug;
 }
 
 static void
 xf86libinput_create_subdevice(InputInfoPtr pInfo,
 			      uint32_t capabilities,
-			      XF86OptionPtr extra_options)
+			      XF86OptionPtr extra_options,
+			      const struct tool_registry_entry *register_tool)
 {
 	struct xf86libinput *driver_data = pInfo->private;
 	struct xf86libinput_device *shared_device;
 	struct xf86libinput_hotplug_info *hotplug;
-	InputOption *iopts = NULL;
-	XF86OptionPtr options, o;
+	struct subdevice_request *subdevices;
 
 	shared_device = driver_data->shared_device;
 	pInfo->options = xf86ReplaceIntOption(pInfo->options,
 					      "_libinput/shared-device",
 					      shared_device->id);
 
-	options = xf86OptionListDuplicate(pInfo->options);
-	options = xf86ReplaceStrOption(options, "_source", "_driver/libinput");
-	options = xf86OptionListMerge(options, extra_options);
+	/* called from PreInit and from the input thread */
+#if HAVE_THREADED_INPUT
+	input_lock();
+#else
+	int sigstate = xf86BlockSIGIO();
+#endif
+	hotplug = xf86libinput_find_hotplug_info(pInfo, shared_device);
+	if (!hotplug)
+		goto out;
 
-	if (capabilities & CAP_KEYBOARD)
-		options = xf86ReplaceBoolOption(options, "_libinput/cap-keyboard", 1);
-	if (capabilities & CAP_POINTER)
-		options = xf86ReplaceBoolOption(options, "_libinput/cap-pointer", 1);
-	if (capabilities & CAP_TOUCH)
-		options = xf86ReplaceBoolOption(options, "_libinput/cap-touch", 1);
-	if (capabilities & CAP_TABLET_TOOL)
-		options = xf86ReplaceBoolOption(options, "_libinput/cap-tablet-tool", 1);
-	if (capabilities & CAP_TABLET_PAD)
-		options = xf86ReplaceBoolOption(options, "_libinput/cap-tablet-pad", 1);
+	subdevices = realloc(hotplug->subdevices,
+			     (hotplug->nsubdevices + 1) * sizeof(*subdevices));
+	if (!subdevices)
+		goto out;
 
-	/* need convert from one option list to the other. woohoo. */
-	o = options;
-	while (o) {
-		iopts = input_option_new(iopts,
-					 xf86OptionName(o),
-					 xf86OptionValue(o));
-		o = xf86NextOption(o);
+	hotplug->subdevices = subdevices;
+	subdevices[hotplug->nsubdevices].capabilities = capabilities;
+	subdevices[hotplug->nsubdevices].extra_options = extra_options;
+	subdevices[hotplug->nsubdevices].register_tool = false;
+	if (register_tool &&
+	    (hotplug->tool_registry ||
+	     (hotplug->tool_registry = strdup(shared_device->tool_registry)))) {
+		subdevices[hotplug->nsubdevices].register_tool = true;
+		subdevices[hotplug->nsubdevices].tool = *register_tool;
 	}
-	xf86OptionListFree(options);
-
-	hotplug = calloc(1, sizeof(*hotplug));
-	if (!hotplug)
-		return;
-
-	hotplug->input_options = iopts;
-	hotplug->attrs = DuplicateInputAttributes(pInfo->attrs);
+	hotplug->nsubdevices++;
+	extra_options = NULL;
 
 	xf86IDrvMsg(pInfo, X_INFO, "needs a virtual subdevice\n");
-
-	QueueWorkProc(xf86libinput_hotplug_device_cb, serverClient, hotplug);
+out:
+#if HAVE_THREADED_INPUT
+	input_unlock();
+#else
+	xf86UnblockSIGIO(sigstate);
+#endif
+	xf86OptionListFree(extra_options);
 }
 
 static inline uint32_t
@@ -3280,29 +5801,94 @@ claim_tablet_tool(InputInfoPtr pInfo)
 {
 	struct xf86libinput *driver_data = pInfo->private;
 	struct xf86libinput_device *shared_device = driver_data->shared_device;
+	struct libinput_device *device = shared_device->device;
 	struct xf86libinput_tablet_tool_event_queue *queue;
 	struct xf86libinput_tablet_tool *t;
+	struct tool_registry_entry *pending = NULL;
 	uint64_t serial, tool_id;
+	Bool claimed = FALSE;
 
 	serial = (uint32_t)xf86CheckIntOption(pInfo->options, "_libinput/tablet-tool-serial", 0);
 	tool_id = (uint32_t)xf86CheckIntOption(pInfo->options, "_libinput/tablet-tool-id", 0);
 
+	if (device)
+		pending = tool_registry_find(&shared_device->pending_tools,
+					     libinput_device_get_id_vendor(device),
+					     libinput_device_get_id_product(device),
+					     serial, tool_id);
+
 	xorg_list_for_each_entry(t,
 				 &shared_device->unclaimed_tablet_tool_list,
 				 node) {
 		if (libinput_tablet_tool_get_serial(t->tool) == serial &&
 		    libinput_tablet_tool_get_tool_id(t->tool) == tool_id) {
 			driver_data->tablet_tool = t->tool;
+			xf86libinput_describe_tool(&driver_data->tool_desc, device, t->tool);
 			queue = libinput_tablet_tool_get_user_data(t->tool);
 			if (queue)
 				queue->need_to_queue = false;
 			xorg_list_del(&t->node);
 			free(t);
-			return TRUE;
+			claimed = TRUE;
+			break;
+		}
+	}
+
+	/* From the registry and not in proximity yet, the tool gets
+	 * bound on its first event, see xf86libinput_tool_matches() */
+	if (pending) {
+		if (!claimed) {
+			driver_data->tool_desc = *pending;
+			claimed = TRUE;
 		}
+		tool_registry_remove(&shared_device->pending_tools, pending);
 	}
 
-	return FALSE;
+	return claimed;
+}
+
+/* Creates the subdevices for the tools in the TabletToolRegistry that
+ * were used on this model of tablet before */
+static void
+xf86libinput_create_registered_tools(InputInfoPtr pInfo,
+				     struct libinput_device *device)
+{
+	struct xf86libinput *driver_data = pInfo->private;
+	struct xf86libinput_device *shared_device = driver_data->shared_device;
+	struct tool_registry registry;
+	uint32_t vendor, product;
+	char *path;
+	FILE *fp;
+	size_t i;
+
+	path = xf86SetStrOption(pInfo->options, "TabletToolRegistry", NULL);
+	if (!path)
+		return;
+
+	shared_device->tool_registry = path;
+
+	fp = fopen(path, "r");
+	if (!fp) /* nothing registered yet */
+		return;
+
+	tool_registry_load(&registry, fp);
+	fclose(fp);
+
+	vendor = libinput_device_get_id_vendor(device);
+	product = libinput_device_get_id_product(device);
+
+	for (i = 0; i < registry.nentries; i++) {
+		const struct tool_registry_entry *e = &registry.entries[i];
+
+		if (e->vendor != vendor || e->product != product)
+			continue;
+
+		tool_registry_add(&shared_device->pending_tools, e);
+		xf86libinput_create_subdevice(pInfo,
+					      CAP_TABLET_TOOL,
+					      xf86libinput_tool_subdevice_options(pInfo, e),
+					      NULL);
+	}
 }
 
 static int
@@ -3316,6 +5902,7 @@ xf86libinput_pre_init(InputDriverPtr drv,
 	struct libinput_device *device = NULL;
 	char *path = NULL;
 	bool is_subdevice;
+	bool probed;
 
 	pInfo->type_name = 0;
 	pInfo->device_control = xf86libinput_device_control;
@@ -3327,7 +5914,8 @@ xf86libinput_pre_init(InputDriverPtr drv,
 	if (!driver_data)
 		goto fail;
 
-	driver_data->valuators = valuator_mask_new(6);
+	driver_data->valuators = valuator_mask_new(max(TOUCHPAD_NUM_AXES + GESTURE_NUM_AXES,
+						       TABLET_PAD_NUM_AXES));
 	if (!driver_data->valuators)
 		goto fail;
 
@@ -3340,13 +5928,15 @@ xf86libinput_pre_init(InputDriverPtr drv,
 		goto fail;
 
 	xf86libinput_init_driver_context();
-	libinput = driver_context.libinput;
+	libinput = driver_context.contexts[INPUT_CONTEXT_SHARED].libinput;
 
 	if (libinput == NULL) {
 		xf86IDrvMsg(pInfo, X_ERROR, "Creating a device for %s failed\n", path);
 		goto fail;
 	}
 
+	xf86libinput_parse_trace_option(pInfo);
+
 	is_subdevice = xf86libinput_is_subdevice(pInfo);
 	if (is_subdevice) {
 		InputInfoPtr parent;
@@ -3378,19 +5968,31 @@ xf86libinput_pre_init(InputDriverPtr drv,
 
 		/* We ref the device above, then remove it. It get's
 		   re-added with the same path in DEVICE_ON, we hope
-		   it doesn't change until then */
+		   it doesn't change until then.
+		   With ProbeOnce we keep it instead, suspended so
+		   it doesn't send events before DEVICE_ON */
 		libinput_device_ref(device);
-		libinput_path_remove_device(device);
+		probed = xf86libinput_parse_probe_once_option(pInfo) &&
+			 libinput_device_config_send_events_set_mode(device,
+								     LIBINPUT_CONFIG_SEND_EVENTS_DISABLED) == LIBINPUT_CONFIG_STATUS_SUCCESS;
+		if (!probed)
+			libinput_path_remove_device(device);
 
 		shared_device = xf86libinput_shared_create(device);
 		if (!shared_device) {
+			if (probed)
+				libinput_path_remove_device(device);
 			libinput_device_unref(device);
 			goto fail;
 		}
+		shared_device->probed = probed;
+		xf86libinput_shared_set_context(pInfo, shared_device,
+						xf86libinput_parse_input_context_option(pInfo, device));
 	}
 
 	pInfo->private = driver_data;
 	driver_data->pInfo = pInfo;
+	driver_data->handle = xf86libinput_handle_new(pInfo);
 	driver_data->path = path;
 	driver_data->shared_device = shared_device;
 	xorg_list_append(&driver_data->shared_device_link,
@@ -3403,6 +6005,8 @@ xf86libinput_pre_init(InputDriverPtr drv,
 	 */
 	driver_data->scroll.vdist = 15;
 	driver_data->scroll.hdist = 15;
+	driver_data->scroll.vdist_v120 = driver_data->scroll.vdist/120.0;
+	driver_data->scroll.hdist_v120 = driver_data->scroll.hdist/120.0;
 
 	if (!is_subdevice) {
 		if (libinput_device_has_capability(device, LIBINPUT_DEVICE_CAP_POINTER))
@@ -3437,11 +6041,23 @@ xf86libinput_pre_init(InputDriverPtr drv,
 		driver_data->capabilities &= ~CAP_KEYBOARD;
 		xf86libinput_create_subdevice(pInfo,
 					      CAP_KEYBOARD,
+					      NULL,
 					      NULL);
 	}
 
+	if (!is_subdevice && driver_data->capabilities & CAP_TABLET)
+		xf86libinput_create_registered_tools(pInfo, device);
+
 	pInfo->type_name = xf86libinput_get_type_name(device, driver_data);
 
+	/* The budget is per libinput device, the subdevices share it */
+	if (!is_subdevice)
+		shared_device->budget.limit = driver_data->options.event_budget;
+
+	/* device_list and capabilities are final now */
+	xf86libinput_shared_invalidate_route(shared_device);
+	xf86libinput_build_button_map(driver_data);
+
 	return Success;
 fail:
 	if (driver_data) {
@@ -3454,8 +6070,11 @@ fail:
 	if (shared_device)
 		xf86libinput_shared_unref(shared_device);
 	free(driver_data);
-	if (libinput)
-		driver_context.libinput = libinput_unref(libinput);
+	if (libinput) {
+		driver_context.contexts[INPUT_CONTEXT_SHARED].libinput = libinput_unref(libinput);
+		if (!driver_context.contexts[INPUT_CONTEXT_SHARED].libinput)
+			trace_close(&driver_context.trace);
+	}
 	return BadValue;
 }
 
@@ -3466,9 +6085,15 @@ xf86libinput_uninit(InputDriverPtr drv,
 {
 	struct xf86libinput *driver_data = pInfo->private;
 	if (driver_data) {
-		driver_context.libinput = libinput_unref(driver_context.libinput);
+		struct xf86libinput_context *shared = &driver_context.contexts[INPUT_CONTEXT_SHARED];
+
+		shared->libinput = libinput_unref(shared->libinput);
+		if (!shared->libinput)
+			trace_close(&driver_context.trace);
+		xf86libinput_handle_release(driver_data->handle);
 		valuator_mask_free(&driver_data->valuators);
 		valuator_mask_free(&driver_data->valuators_unaccelerated);
+		free(driver_data->touch.slots);
 		free(driver_data->path);
 		free(driver_data);
 		pInfo->private = NULL;
@@ -3562,51 +6187,32 @@ static Atom prop_rotation_angle_default;
 /* driver properties */
 static Atom prop_draglock;
 static Atom prop_horiz_scroll;
+static Atom prop_raw_motion;
 static Atom prop_pressurecurve;
 static Atom prop_area_ratio;
+static Atom prop_axis_rate;
+static Atom prop_prediction;
+static Atom prop_log_priority;
+static Atom prop_event_counters;
+#if ENABLE_LATENCY_STATS
+static Atom prop_latency;
+#endif
 
 /* general properties */
 static Atom prop_float;
 static Atom prop_device;
 static Atom prop_product_id;
 
-struct mode_prop_state {
-	int deviceid;
-	InputInfoPtr pInfo;
-
-	struct libinput_tablet_pad_mode_group *group;
-	unsigned int mode;
-	unsigned int idx;
-};
-
-static Bool
-update_mode_prop_cb(ClientPtr client, pointer closure)
+static void
+update_mode_prop_apply(InputInfoPtr pInfo, unsigned int idx, unsigned int mode)
 {
-	struct mode_prop_state *state = closure;
-	InputInfoPtr pInfo = state->pInfo, tmp;
 	struct xf86libinput *driver_data = pInfo->private;
-	BOOL found = FALSE;
 	XIPropertyValuePtr val;
 	int rc;
 	unsigned char groups[4] = {0};
-	struct libinput_tablet_pad_mode_group *group = state->group;
-	unsigned int mode = state->mode;
-	unsigned int idx = state->idx;
 
 	if (idx >= ARRAY_SIZE(groups))
-		goto out;
-
-	/* The device may have gotten removed before the WorkProc was
-	 * scheduled. X reuses deviceids, but if the pointer value and
-	 * device ID are what we had before, we're good */
-	nt_list_for_each_entry(tmp, xf86FirstLocalDevice(), next) {
-		if (tmp->dev->id == state->deviceid && tmp == pInfo) {
-			found = TRUE;
-			break;
-		}
-	}
-	if (!found)
-		goto out;
+		return;
 
 	rc = XIGetDeviceProperty(pInfo->dev,
 				 prop_mode_groups,
@@ -3614,54 +6220,103 @@ update_mode_prop_cb(ClientPtr client, pointer closure)
 	if (rc != Success ||
 	    val->format != 8 ||
 	    val->size <= 0)
-		goto out;
+		return;
 
 	memcpy(groups, (unsigned char*)val->data, val->size);
 
 	if (groups[idx] == mode)
-		goto out;
+		return;
 
 	groups[idx] = mode;
 
 	driver_data->allow_mode_group_updates = true;
-	rc = XIChangeDeviceProperty(pInfo->dev,
-				    prop_mode_groups,
-				    XA_INTEGER, 8,
-				    PropModeReplace,
-				    val->size,
-				    groups,
-				    TRUE);
+	XIChangeDeviceProperty(pInfo->dev,
+			       prop_mode_groups,
+			       XA_INTEGER, 8,
+			       PropModeReplace,
+			       val->size,
+			       groups,
+			       TRUE);
 	driver_data->allow_mode_group_updates = false;
+}
+
+static Bool
+xf86libinput_deferred_props_cb(ClientPtr client, pointer closure)
+{
+	unsigned int head, tail;
+
+	/* Cleared first, anything pushed after this queues a new proc */
+	atomic_store(&driver_context.deferred_props.queued, false);
+
+	head = atomic_load_explicit(&driver_context.deferred_props.head,
+				    memory_order_acquire);
+	tail = atomic_load_explicit(&driver_context.deferred_props.tail,
+				    memory_order_relaxed);
+
+	while (tail != head) {
+		struct deferred_prop *prop;
+		InputInfoPtr pInfo;
+
+		prop = &driver_context.deferred_props.entries[tail % DEFERRED_PROPS_SIZE];
+		pInfo = xf86libinput_handle_lookup(prop->handle);
+		if (pInfo && pInfo->dev) {
+			switch (prop->type) {
+			case DEFERRED_PROP_MODE_GROUP:
+				update_mode_prop_apply(pInfo,
+						       prop->mode_group.idx,
+						       prop->mode_group.mode);
+				break;
+			}
+		}
+
+		tail++;
+		atomic_store_explicit(&driver_context.deferred_props.tail,
+				      tail, memory_order_release);
+	}
 
-out:
-	libinput_tablet_pad_mode_group_unref(group);
-	free(state);
 	return TRUE;
 }
 
+/* Input thread only. If the ring is full the change is dropped, the
+   work proc is already queued and draining it by then */
+static void
+xf86libinput_defer_prop(const struct deferred_prop *prop)
+{
+	unsigned int head, tail;
+
+	head = atomic_load_explicit(&driver_context.deferred_props.head,
+				    memory_order_relaxed);
+	tail = atomic_load_explicit(&driver_context.deferred_props.tail,
+				    memory_order_acquire);
+	if (head - tail >= DEFERRED_PROPS_SIZE)
+		return;
+
+	driver_context.deferred_props.entries[head % DEFERRED_PROPS_SIZE] = *prop;
+	atomic_store_explicit(&driver_context.deferred_props.head,
+			      head + 1, memory_order_release);
+
+	/* Schedule a WorkProc so we don't update from within the input
+	   thread */
+	if (!atomic_exchange(&driver_context.deferred_props.queued, true))
+		QueueWorkProc(xf86libinput_deferred_props_cb, serverClient, NULL);
+}
+
 static inline void
 update_mode_prop(InputInfoPtr pInfo,
 		 struct libinput_event_tablet_pad *event)
 {
+	struct xf86libinput *driver_data = pInfo->private;
 	struct libinput_tablet_pad_mode_group *group;
-	struct mode_prop_state *state;
-
-	state = calloc(1, sizeof(*state));
-	if (!state)
-		return;
-
-	state->deviceid = pInfo->dev->id;
-	state->pInfo = pInfo;
+	struct deferred_prop prop = {
+		.handle = driver_data->handle,
+		.type = DEFERRED_PROP_MODE_GROUP,
+	};
 
 	group = libinput_event_tablet_pad_get_mode_group(event);
+	prop.mode_group.mode = libinput_event_tablet_pad_get_mode(event);
+	prop.mode_group.idx = libinput_tablet_pad_mode_group_get_index(group);
 
-	state->group = libinput_tablet_pad_mode_group_ref(group);
-	state->mode = libinput_event_tablet_pad_get_mode(event);
-	state->idx = libinput_tablet_pad_mode_group_get_index(group);
-
-	/* Schedule a WorkProc so we don't update from within the input
-	   thread */
-	QueueWorkProc(update_mode_prop_cb, serverClient, state);
+	xf86libinput_defer_prop(&prop);
 }
 
 static inline BOOL
@@ -3695,9 +6350,6 @@ LibinputSetPropertyTap(DeviceIntPtr dev,
 	struct libinput_device *device = driver_data->shared_device->device;
 	BOOL* data;
 
-	if (val->format != 8 || val->size != 1 || val->type != XA_INTEGER)
-		return BadMatch;
-
 	data = (BOOL*)val->data;
 	if (checkonly) {
 		if (*data != 0 && *data != 1)
@@ -3726,9 +6378,6 @@ LibinputSetPropertyTapDrag(DeviceIntPtr dev,
 	struct libinput_device *device = driver_data->shared_device->device;
 	BOOL* data;
 
-	if (val->format != 8 || val->size != 1 || val->type != XA_INTEGER)
-		return BadMatch;
-
 	data = (BOOL*)val->data;
 	if (checkonly) {
 		if (*data != 0 && *data != 1)
@@ -3757,9 +6406,6 @@ LibinputSetPropertyTapDragLock(DeviceIntPtr dev,
 	struct libinput_device *device = driver_data->shared_device->device;
 	BOOL* data;
 
-	if (val->format != 8 || val->size != 1 || val->type != XA_INTEGER)
-		return BadMatch;
-
 	data = (BOOL*)val->data;
 	if (checkonly) {
 		if (*data != 0 && *data != 1)
@@ -3788,9 +6434,6 @@ LibinputSetPropertyTapButtonmap(DeviceIntPtr dev,
 	BOOL* data;
 	enum libinput_config_tap_button_map map;
 
-	if (val->format != 8 || val->size != 2 || val->type != XA_INTEGER)
-		return BadMatch;
-
 	data = (BOOL*)val->data;
 
 	if (checkonly &&
@@ -3821,9 +6464,6 @@ LibinputSetPropertyCalibration(DeviceIntPtr dev,
 	struct libinput_device *device = driver_data->shared_device->device;
 	float* data;
 
-	if (val->format != 32 || val->size != 9 || val->type != prop_float)
-		return BadMatch;
-
 	data = (float*)val->data;
 
 	if (checkonly) {
@@ -3857,9 +6497,6 @@ LibinputSetPropertyAccel(DeviceIntPtr dev,
 	struct libinput_device *device = driver_data->shared_device->device;
 	float* data;
 
-	if (val->format != 32 || val->size != 1 || val->type != prop_float)
-		return BadMatch;
-
 	data = (float*)val->data;
 
 	if (checkonly) {
@@ -3890,9 +6527,6 @@ LibinputSetPropertyAccelProfile(DeviceIntPtr dev,
 	BOOL* data;
 	uint32_t profiles = 0;
 
-	if (val->format != 8 || val->size != 2 || val->type != XA_INTEGER)
-		return BadMatch;
-
 	data = (BOOL*)val->data;
 
 	if (data[0])
@@ -3930,9 +6564,6 @@ LibinputSetPropertyNaturalScroll(DeviceIntPtr dev,
 	struct libinput_device *device = driver_data->shared_device->device;
 	BOOL* data;
 
-	if (val->format != 8 || val->size != 1 || val->type != XA_INTEGER)
-		return BadMatch;
-
 	data = (BOOL*)val->data;
 
 	if (checkonly) {
@@ -3963,9 +6594,6 @@ LibinputSetPropertySendEvents(DeviceIntPtr dev,
 	BOOL* data;
 	uint32_t modes = 0;
 
-	if (val->format != 8 || val->size != 2 || val->type != XA_INTEGER)
-		return BadMatch;
-
 	data = (BOOL*)val->data;
 
 	if (data[0])
@@ -4001,9 +6629,6 @@ LibinputSetPropertyLeftHanded(DeviceIntPtr dev,
 	struct libinput_device *device = driver_data->shared_device->device;
 	BOOL* data;
 
-	if (val->format != 8 || val->size != 1 || val->type != XA_INTEGER)
-		return BadMatch;
-
 	data = (BOOL*)val->data;
 
 	if (checkonly) {
@@ -4056,9 +6681,6 @@ LibinputSetPropertyScrollMethods(DeviceIntPtr dev,
 	BOOL* data;
 	uint32_t modes = 0;
 
-	if (val->format != 8 || val->size != 3 || val->type != XA_INTEGER)
-		return BadMatch;
-
 	data = (BOOL*)val->data;
 
 	if (data[0])
@@ -4098,9 +6720,6 @@ LibinputSetPropertyScrollButton(DeviceIntPtr dev,
 	struct libinput_device *device = driver_data->shared_device->device;
 	CARD32* data;
 
-	if (val->format != 32 || val->size != 1 || val->type != XA_CARDINAL)
-		return BadMatch;
-
 	data = (CARD32*)val->data;
 
 	if (checkonly) {
@@ -4133,9 +6752,6 @@ LibinputSetPropertyClickMethod(DeviceIntPtr dev,
 	BOOL* data;
 	uint32_t modes = 0;
 
-	if (val->format != 8 || val->size != 2 || val->type != XA_INTEGER)
-		return BadMatch;
-
 	data = (BOOL*)val->data;
 
 	if (data[0])
@@ -4173,9 +6789,6 @@ LibinputSetPropertyMiddleEmulation(DeviceIntPtr dev,
 	struct libinput_device *device = driver_data->shared_device->device;
 	BOOL* data;
 
-	if (val->format != 8 || val->size != 1 || val->type != XA_INTEGER)
-		return BadMatch;
-
 	data = (BOOL*)val->data;
 	if (checkonly) {
 		if (*data != 0 && *data != 1)
@@ -4204,9 +6817,6 @@ LibinputSetPropertyDisableWhileTyping(DeviceIntPtr dev,
 	struct libinput_device *device = driver_data->shared_device->device;
 	BOOL* data;
 
-	if (val->format != 8 || val->size != 1 || val->type != XA_INTEGER)
-		return BadMatch;
-
 	data = (BOOL*)val->data;
 	if (checkonly) {
 		if (*data != 0 && *data != 1)
@@ -4282,9 +6892,7 @@ LibinputSetPropertyDragLockButtons(DeviceIntPtr dev,
 {
 	InputInfoPtr pInfo = dev->public.devicePrivate;
 	struct xf86libinput *driver_data = pInfo->private;
-
-	if (val->format != 8 || val->type != XA_INTEGER)
-		return BadMatch;
+	int rc;
 
 	/* either a single value, or pairs of values */
 	if (val->size > 1 && val->size % 2)
@@ -4294,28 +6902,54 @@ LibinputSetPropertyDragLockButtons(DeviceIntPtr dev,
 		return BadMatch;
 
 	if (val->size <= 1)
-		return prop_draglock_set_meta(driver_data,
-					      (BYTE*)val->data,
-					      val->size, checkonly);
+		rc = prop_draglock_set_meta(driver_data,
+					    (BYTE*)val->data,
+					    val->size, checkonly);
 	else
-		return prop_draglock_set_pairs(driver_data,
-					       (BYTE*)val->data,
-					       val->size, checkonly);
+		rc = prop_draglock_set_pairs(driver_data,
+					     (BYTE*)val->data,
+					     val->size, checkonly);
+
+	if (!checkonly && rc == Success)
+		xf86libinput_build_button_map(driver_data);
+
+	return rc;
+}
+
+static inline int
+LibinputSetPropertyHorizScroll(DeviceIntPtr dev,
+			       Atom atom,
+			       XIPropertyValuePtr val,
+			       BOOL checkonly)
+{
+	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct xf86libinput *driver_data = pInfo->private;
+	BOOL enabled;
+
+	enabled = *(BOOL*)val->data;
+	if (checkonly) {
+		if (enabled != 0 && enabled != 1)
+			return BadValue;
+
+		if (!xf86libinput_check_device (dev, atom))
+			return BadMatch;
+	} else {
+		driver_data->options.horiz_scrolling_enabled = enabled;
+	}
+
+	return Success;
 }
 
 static inline int
-LibinputSetPropertyHorizScroll(DeviceIntPtr dev,
-			       Atom atom,
-			       XIPropertyValuePtr val,
-			       BOOL checkonly)
+LibinputSetPropertyRawMotion(DeviceIntPtr dev,
+			     Atom atom,
+			     XIPropertyValuePtr val,
+			     BOOL checkonly)
 {
 	InputInfoPtr pInfo = dev->public.devicePrivate;
 	struct xf86libinput *driver_data = pInfo->private;
 	BOOL enabled;
 
-	if (val->format != 8 || val->type != XA_INTEGER || val->size != 1)
-		return BadMatch;
-
 	enabled = *(BOOL*)val->data;
 	if (checkonly) {
 		if (enabled != 0 && enabled != 1)
@@ -4324,7 +6958,9 @@ LibinputSetPropertyHorizScroll(DeviceIntPtr dev,
 		if (!xf86libinput_check_device (dev, atom))
 			return BadMatch;
 	} else {
-		driver_data->options.horiz_scrolling_enabled = enabled;
+		driver_data->options.raw_motion = enabled;
+		driver_data->scale.x_remainder = 0.0;
+		driver_data->scale.y_remainder = 0.0;
 	}
 
 	return Success;
@@ -4341,9 +6977,6 @@ LibinputSetPropertyRotationAngle(DeviceIntPtr dev,
 	struct libinput_device *device = driver_data->shared_device->device;
 	float *angle;
 
-	if (val->format != 32 || val->size != 1 || val->type != prop_float)
-		return BadMatch;
-
 	angle = (float*)val->data;
 
 	if (checkonly) {
@@ -4373,9 +7006,6 @@ LibinputSetPropertyPressureCurve(DeviceIntPtr dev,
 	float *vals;
 	struct bezier_control_point controls[4];
 
-	if (val->format != 32 || val->size != 8 || val->type != prop_float)
-		return BadMatch;
-
 	vals = val->data;
 	controls[0].x = vals[0];
 	controls[0].y = vals[1];
@@ -4419,9 +7049,6 @@ LibinputSetPropertyAreaRatio(DeviceIntPtr dev,
 	uint32_t *vals;
 	struct ratio area = { 0, 0 };
 
-	if (val->format != 32 || val->size != 2 || val->type != XA_CARDINAL)
-		return BadMatch;
-
 	vals = val->data;
 	area.x = vals[0];
 	area.y = vals[1];
@@ -4464,92 +7091,368 @@ LibinputSetPropertyAreaRatio(DeviceIntPtr dev,
 	return Success;
 }
 
+static inline int
+LibinputSetPropertyAxisRate(DeviceIntPtr dev,
+			    Atom atom,
+			    XIPropertyValuePtr val,
+			    BOOL checkonly)
+{
+	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct xf86libinput *driver_data = pInfo->private;
+	uint32_t rate = *(uint32_t*)val->data;
+
+	if (checkonly) {
+		if (rate > 1000000)
+			return BadValue;
+
+		if (!xf86libinput_check_device(dev, atom))
+			return BadMatch;
+	} else {
+		/* a held event is still posted by its timer */
+		xf86libinput_set_axis_rate(driver_data, rate);
+	}
+
+	return Success;
+}
+
+static inline int
+LibinputSetPropertyPrediction(DeviceIntPtr dev,
+			      Atom atom,
+			      XIPropertyValuePtr val,
+			      BOOL checkonly)
+{
+	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct xf86libinput *driver_data = pInfo->private;
+	uint32_t ms = *(uint32_t*)val->data;
+
+	if (checkonly) {
+		if (ms > TABLET_PREDICTION_MAX)
+			return BadValue;
+
+		if (!xf86libinput_check_device(dev, atom))
+			return BadMatch;
+	} else {
+		xf86libinput_set_prediction(driver_data, ms);
+	}
+
+	return Success;
+}
+
+static inline int
+LibinputSetPropertyLogPriority(DeviceIntPtr dev,
+			       Atom atom,
+			       XIPropertyValuePtr val,
+			       BOOL checkonly)
+{
+	BOOL* data = (BOOL*)val->data;
+	enum libinput_log_priority priority;
+
+	if (data[0] + data[1] + data[2] != 1)
+		return BadValue;
+
+	if (data[0])
+		priority = LIBINPUT_LOG_PRIORITY_DEBUG;
+	else if (data[1])
+		priority = LIBINPUT_LOG_PRIORITY_INFO;
+	else
+		priority = LIBINPUT_LOG_PRIORITY_ERROR;
+
+	if (!checkonly) {
+		int i;
+
+		for (i = 0; i < INPUT_CONTEXTS_MAX; i++) {
+			if (driver_context.contexts[i].libinput)
+				libinput_log_set_priority(driver_context.contexts[i].libinput,
+							  priority);
+		}
+	}
+
+	return Success;
+}
+
+static inline int
+LibinputSetPropertyModeGroups(DeviceIntPtr dev,
+			      Atom atom,
+			      XIPropertyValuePtr val,
+			      BOOL checkonly)
+{
+	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct xf86libinput *driver_data = pInfo->private;
+
+	/* read-only, except for our own updates */
+	if (driver_data->allow_mode_group_updates)
+		return Success;
+	else
+		return BadAccess;
+}
+
+/* Any write resets the counters, the property is updated on read */
+static inline int
+LibinputSetPropertyEventCounters(DeviceIntPtr dev,
+				 Atom atom,
+				 XIPropertyValuePtr val,
+				 BOOL checkonly)
+{
+	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct xf86libinput *driver_data = pInfo->private;
+	struct event_counters *counters = &driver_data->counters;
+
+	if (counters->allow_updates || checkonly)
+		return Success;
+
+	counters->discarded_off = 0;
+	counters->discarded_abs = 0;
+	counters->merged = 0;
+	memset(counters->handled, 0, sizeof(counters->handled));
+	memset(&driver_data->shared_device->counters, 0,
+	       sizeof(driver_data->shared_device->counters));
+
+	return Success;
+}
+
+#if ENABLE_LATENCY_STATS
+static inline int
+LibinputSetPropertyLatency(DeviceIntPtr dev,
+			   Atom atom,
+			   XIPropertyValuePtr val,
+			   BOOL checkonly)
+{
+	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct xf86libinput *driver_data = pInfo->private;
+
+	/* read-only, except for our own updates */
+	if (driver_data->latency.allow_updates)
+		return Success;
+	else
+		return BadAccess;
+}
+#endif
+
+/* The property atoms are the same for all devices, so there is one
+ * table for all of them, filled in whenever a device initializes its
+ * properties. Open addressing, keyed by atom. The atoms are made anew
+ * after a server regeneration, so is the table.
+ */
+#define PROP_READ_ONLY 0x1
+#define PROP_NO_APPLY 0x2 /* don't call LibinputApplyConfig after setting */
+#define PROPERTY_HANDLERS_SIZE 128 /* power of 2, at least twice the No of properties */
+
+typedef int (*LibinputSetPropertyFunc)(DeviceIntPtr dev,
+				       Atom atom,
+				       XIPropertyValuePtr val,
+				       BOOL checkonly);
+
+struct property_handler {
+	Atom atom;
+	LibinputSetPropertyFunc set;
+	Atom type;
+	int format;
+	int size; /* 0 for any size */
+	uint32_t flags;
+};
+
+static struct property_handler property_handlers[PROPERTY_HANDLERS_SIZE];
+static unsigned long property_handlers_generation;
+
+static inline size_t
+property_handler_index(Atom atom)
+{
+	return (atom * 2654435761U) & (PROPERTY_HANDLERS_SIZE - 1);
+}
+
+static struct property_handler *
+LibinputFindPropertyHandler(Atom atom, bool create)
+{
+	size_t idx = property_handler_index(atom);
+	size_t i;
+
+	for (i = 0; i < PROPERTY_HANDLERS_SIZE; i++) {
+		struct property_handler *h;
+
+		h = &property_handlers[(idx + i) & (PROPERTY_HANDLERS_SIZE - 1)];
+		if (h->atom == atom)
+			return h;
+		if (h->atom == None)
+			return create ? h : NULL;
+	}
+
+	return NULL;
+}
+
+static void
+LibinputRegisterPropertyHandler(Atom atom,
+				LibinputSetPropertyFunc set,
+				Atom type,
+				int format,
+				int size,
+				uint32_t flags)
+{
+	struct property_handler *h;
+
+	/* property isn't available on any device (yet) */
+	if (atom == None)
+		return;
+
+	h = LibinputFindPropertyHandler(atom, true);
+	BUG_RETURN(h == NULL);
+
+	h->atom = atom;
+	h->set = set;
+	h->type = type;
+	h->format = format;
+	h->size = size;
+	h->flags = flags;
+}
+
+static inline void
+LibinputRegisterReadOnlyProperty(Atom atom)
+{
+	LibinputRegisterPropertyHandler(atom, NULL, None, 0, 0, PROP_READ_ONLY);
+}
+
+static void
+LibinputRegisterPropertyHandlers(void)
+{
+	LibinputRegisterPropertyHandler(prop_tap,
+					LibinputSetPropertyTap,
+					XA_INTEGER, 8, 1, 0);
+	LibinputRegisterPropertyHandler(prop_tap_drag,
+					LibinputSetPropertyTapDrag,
+					XA_INTEGER, 8, 1, 0);
+	LibinputRegisterPropertyHandler(prop_tap_drag_lock,
+					LibinputSetPropertyTapDragLock,
+					XA_INTEGER, 8, 1, 0);
+	LibinputRegisterPropertyHandler(prop_tap_buttonmap,
+					LibinputSetPropertyTapButtonmap,
+					XA_INTEGER, 8, 2, 0);
+	LibinputRegisterPropertyHandler(prop_calibration,
+					LibinputSetPropertyCalibration,
+					prop_float, 32, 9, 0);
+	LibinputRegisterPropertyHandler(prop_accel,
+					LibinputSetPropertyAccel,
+					prop_float, 32, 1, 0);
+	LibinputRegisterPropertyHandler(prop_accel_profile_enabled,
+					LibinputSetPropertyAccelProfile,
+					XA_INTEGER, 8, 2, 0);
+	LibinputRegisterPropertyHandler(prop_natural_scroll,
+					LibinputSetPropertyNaturalScroll,
+					XA_INTEGER, 8, 1, 0);
+	LibinputRegisterPropertyHandler(prop_sendevents_enabled,
+					LibinputSetPropertySendEvents,
+					XA_INTEGER, 8, 2, 0);
+	LibinputRegisterPropertyHandler(prop_left_handed,
+					LibinputSetPropertyLeftHanded,
+					XA_INTEGER, 8, 1, 0);
+	LibinputRegisterPropertyHandler(prop_scroll_method_enabled,
+					LibinputSetPropertyScrollMethods,
+					XA_INTEGER, 8, 3, 0);
+	LibinputRegisterPropertyHandler(prop_scroll_button,
+					LibinputSetPropertyScrollButton,
+					XA_CARDINAL, 32, 1, 0);
+	LibinputRegisterPropertyHandler(prop_click_method_enabled,
+					LibinputSetPropertyClickMethod,
+					XA_INTEGER, 8, 2, 0);
+	LibinputRegisterPropertyHandler(prop_middle_emulation,
+					LibinputSetPropertyMiddleEmulation,
+					XA_INTEGER, 8, 1, 0);
+	LibinputRegisterPropertyHandler(prop_disable_while_typing,
+					LibinputSetPropertyDisableWhileTyping,
+					XA_INTEGER, 8, 1, 0);
+	LibinputRegisterPropertyHandler(prop_draglock,
+					LibinputSetPropertyDragLockButtons,
+					XA_INTEGER, 8, 0, 0);
+	LibinputRegisterPropertyHandler(prop_horiz_scroll,
+					LibinputSetPropertyHorizScroll,
+					XA_INTEGER, 8, 1, 0);
+	LibinputRegisterPropertyHandler(prop_raw_motion,
+					LibinputSetPropertyRawMotion,
+					XA_INTEGER, 8, 1, 0);
+	LibinputRegisterPropertyHandler(prop_mode_groups,
+					LibinputSetPropertyModeGroups,
+					XA_INTEGER, 8, 0, PROP_NO_APPLY);
+	LibinputRegisterPropertyHandler(prop_log_priority,
+					LibinputSetPropertyLogPriority,
+					XA_INTEGER, 8, 3, PROP_NO_APPLY);
+	LibinputRegisterPropertyHandler(prop_event_counters,
+					LibinputSetPropertyEventCounters,
+					XA_CARDINAL, 32, 0, PROP_NO_APPLY);
+	LibinputRegisterPropertyHandler(prop_rotation_angle,
+					LibinputSetPropertyRotationAngle,
+					prop_float, 32, 1, 0);
+	LibinputRegisterPropertyHandler(prop_pressurecurve,
+					LibinputSetPropertyPressureCurve,
+					prop_float, 32, 8, 0);
+	LibinputRegisterPropertyHandler(prop_area_ratio,
+					LibinputSetPropertyAreaRatio,
+					XA_CARDINAL, 32, 2, 0);
+	LibinputRegisterPropertyHandler(prop_axis_rate,
+					LibinputSetPropertyAxisRate,
+					XA_CARDINAL, 32, 1, PROP_NO_APPLY);
+	LibinputRegisterPropertyHandler(prop_prediction,
+					LibinputSetPropertyPrediction,
+					XA_CARDINAL, 32, 1, PROP_NO_APPLY);
+#if ENABLE_LATENCY_STATS
+	LibinputRegisterPropertyHandler(prop_latency,
+					LibinputSetPropertyLatency,
+					XA_CARDINAL, 32, 3 + LATENCY_BUCKETS,
+					PROP_NO_APPLY);
+#endif
+
+	LibinputRegisterReadOnlyProperty(prop_device);
+	LibinputRegisterReadOnlyProperty(prop_product_id);
+	LibinputRegisterReadOnlyProperty(prop_tap_default);
+	LibinputRegisterReadOnlyProperty(prop_tap_drag_default);
+	LibinputRegisterReadOnlyProperty(prop_tap_drag_lock_default);
+	LibinputRegisterReadOnlyProperty(prop_tap_buttonmap_default);
+	LibinputRegisterReadOnlyProperty(prop_calibration_default);
+	LibinputRegisterReadOnlyProperty(prop_accel_default);
+	LibinputRegisterReadOnlyProperty(prop_accel_profile_default);
+	LibinputRegisterReadOnlyProperty(prop_natural_scroll_default);
+	LibinputRegisterReadOnlyProperty(prop_sendevents_default);
+	LibinputRegisterReadOnlyProperty(prop_sendevents_available);
+	LibinputRegisterReadOnlyProperty(prop_left_handed_default);
+	LibinputRegisterReadOnlyProperty(prop_scroll_method_default);
+	LibinputRegisterReadOnlyProperty(prop_scroll_methods_available);
+	LibinputRegisterReadOnlyProperty(prop_scroll_button_default);
+	LibinputRegisterReadOnlyProperty(prop_click_method_default);
+	LibinputRegisterReadOnlyProperty(prop_click_methods_available);
+	LibinputRegisterReadOnlyProperty(prop_middle_emulation_default);
+	LibinputRegisterReadOnlyProperty(prop_disable_while_typing_default);
+	LibinputRegisterReadOnlyProperty(prop_mode_groups_available);
+	LibinputRegisterReadOnlyProperty(prop_mode_groups_buttons);
+	LibinputRegisterReadOnlyProperty(prop_mode_groups_rings);
+	LibinputRegisterReadOnlyProperty(prop_mode_groups_strips);
+	LibinputRegisterReadOnlyProperty(prop_rotation_angle_default);
+}
+
 static int
 LibinputSetProperty(DeviceIntPtr dev, Atom atom, XIPropertyValuePtr val,
                  BOOL checkonly)
 {
+	const struct property_handler *handler;
 	int rc;
 
-	if (atom == prop_tap)
-		rc = LibinputSetPropertyTap(dev, atom, val, checkonly);
-	else if (atom == prop_tap_drag)
-		rc = LibinputSetPropertyTapDrag(dev, atom, val, checkonly);
-	else if (atom == prop_tap_drag_lock)
-		rc = LibinputSetPropertyTapDragLock(dev, atom, val, checkonly);
-	else if (atom == prop_tap_buttonmap)
-		rc = LibinputSetPropertyTapButtonmap(dev, atom, val, checkonly);
-	else if (atom == prop_calibration)
-		rc = LibinputSetPropertyCalibration(dev, atom, val,
-						    checkonly);
-	else if (atom == prop_accel)
-		rc = LibinputSetPropertyAccel(dev, atom, val, checkonly);
-	else if (atom == prop_accel_profile_enabled)
-		rc = LibinputSetPropertyAccelProfile(dev, atom, val, checkonly);
-	else if (atom == prop_natural_scroll)
-		rc = LibinputSetPropertyNaturalScroll(dev, atom, val, checkonly);
-	else if (atom == prop_sendevents_enabled)
-		rc = LibinputSetPropertySendEvents(dev, atom, val, checkonly);
-	else if (atom == prop_left_handed)
-		rc = LibinputSetPropertyLeftHanded(dev, atom, val, checkonly);
-	else if (atom == prop_scroll_method_enabled)
-		rc = LibinputSetPropertyScrollMethods(dev, atom, val, checkonly);
-	else if (atom == prop_scroll_button)
-		rc = LibinputSetPropertyScrollButton(dev, atom, val, checkonly);
-	else if (atom == prop_click_method_enabled)
-		rc = LibinputSetPropertyClickMethod(dev, atom, val, checkonly);
-	else if (atom == prop_middle_emulation)
-		rc = LibinputSetPropertyMiddleEmulation(dev, atom, val, checkonly);
-	else if (atom == prop_disable_while_typing)
-		rc = LibinputSetPropertyDisableWhileTyping(dev, atom, val, checkonly);
-	else if (atom == prop_draglock)
-		rc = LibinputSetPropertyDragLockButtons(dev, atom, val, checkonly);
-	else if (atom == prop_horiz_scroll)
-		rc = LibinputSetPropertyHorizScroll(dev, atom, val, checkonly);
-	else if (atom == prop_mode_groups) {
+	handler = LibinputFindPropertyHandler(atom, false);
+	if (!handler)
+		return Success; /* not one of ours */
+
+	if (handler->flags & PROP_READ_ONLY)
+		return BadAccess;
+
+	if (val->format != handler->format ||
+	    val->type != handler->type ||
+	    (handler->size != 0 && val->size != handler->size))
+		return BadMatch;
+
+	rc = handler->set(dev, atom, val, checkonly);
+
+	if (!checkonly && rc == Success && (handler->flags & PROP_NO_APPLY) == 0) {
 		InputInfoPtr pInfo = dev->public.devicePrivate;
 		struct xf86libinput *driver_data = pInfo->private;
 
-		if (driver_data->allow_mode_group_updates)
-			return Success;
-		else
-			return BadAccess;
-	}
-	else if (atom == prop_rotation_angle)
-		rc = LibinputSetPropertyRotationAngle(dev, atom, val, checkonly);
-	else if (atom == prop_pressurecurve)
-		rc = LibinputSetPropertyPressureCurve(dev, atom, val, checkonly);
-	else if (atom == prop_area_ratio)
-		rc = LibinputSetPropertyAreaRatio(dev, atom, val, checkonly);
-	else if (atom == prop_device || atom == prop_product_id ||
-		 atom == prop_tap_default ||
-		 atom == prop_tap_drag_default ||
-		 atom == prop_tap_drag_lock_default ||
-		 atom == prop_tap_buttonmap_default ||
-		 atom == prop_calibration_default ||
-		 atom == prop_accel_default ||
-		 atom == prop_accel_profile_default ||
-		 atom == prop_natural_scroll_default ||
-		 atom == prop_sendevents_default ||
-		 atom == prop_sendevents_available ||
-		 atom == prop_left_handed_default ||
-		 atom == prop_scroll_method_default ||
-		 atom == prop_scroll_methods_available ||
-		 atom == prop_scroll_button_default ||
-		 atom == prop_click_method_default ||
-		 atom == prop_click_methods_available ||
-		 atom == prop_middle_emulation_default ||
-		 atom == prop_disable_while_typing_default ||
-		 atom == prop_mode_groups_available ||
-		 atom == prop_mode_groups_buttons ||
-		 atom == prop_mode_groups_rings ||
-		 atom == prop_mode_groups_strips ||
-		 atom == prop_rotation_angle_default)
-		return BadAccess; /* read-only */
-	else
-		return Success;
-
-	if (!checkonly && rc == Success)
+		driver_data->shared_device->parsed.valid = false;
 		LibinputApplyConfig(dev);
+	}
 
 	return rc;
 }
@@ -5356,6 +8259,21 @@ LibinputInitHorizScrollProperty(DeviceIntPtr dev,
 						 1, &enabled);
 }
 
+static void
+LibinputInitRawMotionProperty(DeviceIntPtr dev,
+			      struct xf86libinput *driver_data)
+{
+	BOOL enabled = driver_data->options.raw_motion;
+
+	if ((driver_data->capabilities & CAP_POINTER) == 0)
+		return;
+
+	prop_raw_motion = LibinputMakeProperty(dev,
+					       LIBINPUT_PROP_RAW_MOTION,
+					       XA_INTEGER, 8,
+					       1, &enabled);
+}
+
 static void
 LibinputInitRotationAngleProperty(DeviceIntPtr dev,
 				  struct xf86libinput *driver_data,
@@ -5388,13 +8306,12 @@ LibinputInitPressureCurveProperty(DeviceIntPtr dev,
 				  struct xf86libinput *driver_data)
 {
 	const struct bezier_control_point *curve = driver_data->options.pressurecurve;
-	struct libinput_tablet_tool *tool = driver_data->tablet_tool;
 	float data[8];
 
 	if ((driver_data->capabilities & CAP_TABLET_TOOL) == 0)
 		return;
 
-	if (!tool || !libinput_tablet_tool_has_pressure(tool))
+	if (!(driver_data->tool_desc.axes & TOOL_AXIS_PRESSURE))
 		return;
 
 	data[0] = curve[0].x;
@@ -5431,6 +8348,192 @@ LibinputInitTabletAreaRatioProperty(DeviceIntPtr dev,
 					       2, data);
 }
 
+static void
+LibinputInitTabletAxisRateProperty(DeviceIntPtr dev,
+				   struct xf86libinput *driver_data)
+{
+	uint32_t rate = driver_data->options.tool_axis_rate;
+
+	if ((driver_data->capabilities & CAP_TABLET_TOOL) == 0)
+		return;
+
+	prop_axis_rate = LibinputMakeProperty(dev,
+					      LIBINPUT_PROP_TABLET_TOOL_AXIS_RATE,
+					      XA_CARDINAL, 32,
+					      1, &rate);
+}
+
+static void
+LibinputInitTabletPredictionProperty(DeviceIntPtr dev,
+				     struct xf86libinput *driver_data)
+{
+	uint32_t ms = driver_data->options.tool_prediction;
+
+	if ((driver_data->capabilities & CAP_TABLET_TOOL) == 0)
+		return;
+
+	prop_prediction = LibinputMakeProperty(dev,
+					       LIBINPUT_PROP_TABLET_TOOL_PREDICTION,
+					       XA_CARDINAL, 32,
+					       1, &ms);
+}
+
+#if ENABLE_LATENCY_STATS
+static void
+LibinputLatencyPropertyData(struct xf86libinput *driver_data,
+			    uint32_t data[3 + LATENCY_BUCKETS])
+{
+	const struct latency_stats *stats = &driver_data->latency;
+
+	data[0] = stats->nevents;
+	data[1] = stats->rate;
+	data[2] = stats->peak_rate;
+	memcpy(&data[3], stats->buckets, sizeof(stats->buckets));
+}
+
+static void
+LibinputInitLatencyProperty(DeviceIntPtr dev,
+			    struct xf86libinput *driver_data)
+{
+	uint32_t data[3 + LATENCY_BUCKETS];
+
+	LibinputLatencyPropertyData(driver_data, data);
+	prop_latency = LibinputMakeProperty(dev,
+					    LIBINPUT_PROP_EVENT_LATENCY_HISTOGRAM,
+					    XA_CARDINAL, 32,
+					    ARRAY_SIZE(data), data);
+}
+
+/* The stats change with every event, so only update the property
+ * when someone's looking */
+static int
+LibinputGetPropertyLatency(DeviceIntPtr dev)
+{
+	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct xf86libinput *driver_data = pInfo->private;
+	uint32_t data[3 + LATENCY_BUCKETS];
+	int rc;
+
+	LibinputLatencyPropertyData(driver_data, data);
+
+	driver_data->latency.allow_updates = true;
+	rc = XIChangeDeviceProperty(dev, prop_latency,
+				    XA_CARDINAL, 32,
+				    PropModeReplace,
+				    ARRAY_SIZE(data), data,
+				    FALSE);
+	driver_data->latency.allow_updates = false;
+
+	return rc;
+}
+#endif
+
+static void
+LibinputEventCountersPropertyData(struct xf86libinput *driver_data,
+				  uint32_t data[EVENT_COUNTERS_SIZE])
+{
+	const struct event_counters *counters = &driver_data->counters;
+	const struct xf86libinput_device *shared_device = driver_data->shared_device;
+
+	data[0] = counters->discarded_off;
+	data[1] = shared_device->counters.unrouted;
+	data[2] = shared_device->counters.tool_queued;
+	data[3] = shared_device->counters.tool_dropped;
+	data[4] = counters->discarded_abs;
+	data[5] = counters->merged;
+	memcpy(&data[6], counters->handled, sizeof(counters->handled));
+}
+
+static void
+LibinputInitEventCountersProperty(DeviceIntPtr dev,
+				  struct xf86libinput *driver_data)
+{
+	uint32_t data[EVENT_COUNTERS_SIZE];
+
+	LibinputEventCountersPropertyData(driver_data, data);
+	prop_event_counters = LibinputMakeProperty(dev,
+						   LIBINPUT_PROP_EVENT_COUNTERS,
+						   XA_CARDINAL, 32,
+						   ARRAY_SIZE(data), data);
+}
+
+/* Like the latency, only updated when someone's looking */
+static int
+LibinputGetPropertyEventCounters(DeviceIntPtr dev)
+{
+	InputInfoPtr pInfo = dev->public.devicePrivate;
+	struct xf86libinput *driver_data = pInfo->private;
+	uint32_t data[EVENT_COUNTERS_SIZE];
+	int rc;
+
+	LibinputEventCountersPropertyData(driver_data, data);
+
+	driver_data->counters.allow_updates = true;
+	rc = XIChangeDeviceProperty(dev, prop_event_counters,
+				    XA_CARDINAL, 32,
+				    PropModeReplace,
+				    ARRAY_SIZE(data), data,
+				    FALSE);
+	driver_data->counters.allow_updates = false;
+
+	return rc;
+}
+
+static inline void
+LibinputLogPriorityPropertyData(BOOL data[3])
+{
+	enum libinput_log_priority priority;
+
+	priority = libinput_log_get_priority(driver_context.contexts[INPUT_CONTEXT_SHARED].libinput);
+	data[0] = priority == LIBINPUT_LOG_PRIORITY_DEBUG;
+	data[1] = priority == LIBINPUT_LOG_PRIORITY_INFO;
+	data[2] = priority == LIBINPUT_LOG_PRIORITY_ERROR;
+}
+
+static void
+LibinputInitLogPriorityProperty(DeviceIntPtr dev,
+				struct xf86libinput *driver_data)
+{
+	BOOL data[3];
+
+	LibinputLogPriorityPropertyData(data);
+	prop_log_priority = LibinputMakeProperty(dev,
+						 LIBINPUT_PROP_LOG_PRIORITY,
+						 XA_INTEGER, 8,
+						 ARRAY_SIZE(data), data);
+}
+
+/* The priority is per libinput context and may have been changed
+ * through another device, so update the property when it's read */
+static int
+LibinputGetPropertyLogPriority(DeviceIntPtr dev)
+{
+	BOOL data[3];
+
+	LibinputLogPriorityPropertyData(data);
+
+	return XIChangeDeviceProperty(dev, prop_log_priority,
+				      XA_INTEGER, 8,
+				      PropModeReplace,
+				      ARRAY_SIZE(data), data,
+				      FALSE);
+}
+
+static int
+LibinputGetProperty(DeviceIntPtr dev, Atom atom)
+{
+	if (atom == prop_log_priority)
+		return LibinputGetPropertyLogPriority(dev);
+	if (atom == prop_event_counters)
+		return LibinputGetPropertyEventCounters(dev);
+#if ENABLE_LATENCY_STATS
+	if (atom == prop_latency)
+		return LibinputGetPropertyLatency(dev);
+#endif
+
+	return Success;
+}
+
 static void
 LibinputInitProperty(DeviceIntPtr dev)
 {
@@ -5441,6 +8544,12 @@ LibinputInitProperty(DeviceIntPtr dev)
 	CARD32 product[2];
 	int rc;
 
+	/* the old atoms may name other properties by now */
+	if (property_handlers_generation != serverGeneration) {
+		memset(property_handlers, 0, sizeof(property_handlers));
+		property_handlers_generation = serverGeneration;
+	}
+
 	prop_float = XIGetKnownProperty("FLOAT");
 
 	LibinputInitTapProperty(dev, driver_data, device);
@@ -5487,6 +8596,16 @@ LibinputInitProperty(DeviceIntPtr dev)
 
 	LibinputInitDragLockProperty(dev, driver_data);
 	LibinputInitHorizScrollProperty(dev, driver_data);
+	LibinputInitRawMotionProperty(dev, driver_data);
 	LibinputInitPressureCurveProperty(dev, driver_data);
 	LibinputInitTabletAreaRatioProperty(dev, driver_data);
+	LibinputInitTabletAxisRateProperty(dev, driver_data);
+	LibinputInitTabletPredictionProperty(dev, driver_data);
+#if ENABLE_LATENCY_STATS
+	LibinputInitLatencyProperty(dev, driver_data);
+#endif
+	LibinputInitLogPriorityProperty(dev, driver_data);
+	LibinputInitEventCountersProperty(dev, driver_data);
+
+	LibinputRegisterPropertyHandlers();
 }
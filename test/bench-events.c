@@ -0,0 +1,1150 @@
+/*
+ * Copyright © 2018 Red Hat, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of Red Hat
+ * not be used in advertising or publicity pertaining to distribution
+ * of the software without specific, written prior permission.  Red
+ * Hat makes no representations about the suitability of this software
+ * for any purpose.  It is provided "as is" without express or implied
+ * warranty.
+ *
+ * THE AUTHORS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Replays synthetic event streams through xf86libinput_read_input() and
+ * the real event handlers and prints the cost per event. The libinput
+ * events, the valuator masks and the xf86Post* calls are faked here, the
+ * rest of the server API is in fake-symbols.c.
+ *
+ * Usage: bench-events [iterations] [trace]
+ *
+ * With a trace recorded by the driver (see "EventTrace"), that trace is
+ * replayed instead, all of it into one device and one pen.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+/* Count the driver's allocations, anything allocating in the hot path
+ * shows up in allocs/event */
+static unsigned long nallocs;
+
+static inline void *
+bench_malloc(size_t sz)
+{
+	nallocs++;
+	return malloc(sz);
+}
+
+static inline void *
+bench_calloc(size_t nmemb, size_t sz)
+{
+	nallocs++;
+	return calloc(nmemb, sz);
+}
+
+static inline void *
+bench_realloc(void *ptr, size_t sz)
+{
+	nallocs++;
+	return realloc(ptr, sz);
+}
+
+#define malloc(sz_) bench_malloc(sz_)
+#define calloc(n_, sz_) bench_calloc(n_, sz_)
+#define realloc(p_, sz_) bench_realloc(p_, sz_)
+
+#include "xf86libinput.c"
+
+#define BENCH_NUM_VALUATORS 8
+
+/* Whatever the server got from us, so the work can't be optimized out */
+static struct {
+	unsigned long nposted;
+	double checksum;
+} sink;
+
+struct bench_valuator_mask {
+	int last_bit;
+	uint32_t mask;
+	double valuators[BENCH_NUM_VALUATORS];
+	double unaccelerated[BENCH_NUM_VALUATORS];
+};
+
+ValuatorMask *
+valuator_mask_new(int num_valuators)
+{
+	return (ValuatorMask*)calloc(1, sizeof(struct bench_valuator_mask));
+}
+
+void
+valuator_mask_free(ValuatorMask **mask)
+{
+	free(*mask);
+	*mask = NULL;
+}
+
+void
+valuator_mask_zero(ValuatorMask *mask)
+{
+	struct bench_valuator_mask *m = (struct bench_valuator_mask*)mask;
+
+	m->last_bit = -1;
+	m->mask = 0;
+}
+
+void
+valuator_mask_set_double(ValuatorMask *mask, int valuator, double data)
+{
+	struct bench_valuator_mask *m = (struct bench_valuator_mask*)mask;
+
+	if (valuator >= BENCH_NUM_VALUATORS)
+		return;
+
+	m->mask |= 1 << valuator;
+	m->valuators[valuator] = data;
+	m->last_bit = max(valuator, m->last_bit);
+}
+
+void
+valuator_mask_set(ValuatorMask *mask, int valuator, int data)
+{
+	valuator_mask_set_double(mask, valuator, data);
+}
+
+int
+valuator_mask_isset(const ValuatorMask *mask, int bit)
+{
+	const struct bench_valuator_mask *m = (const struct bench_valuator_mask*)mask;
+
+	return bit < BENCH_NUM_VALUATORS && (m->mask & (1 << bit));
+}
+
+double
+valuator_mask_get_double(const ValuatorMask *mask, int valuator)
+{
+	const struct bench_valuator_mask *m = (const struct bench_valuator_mask*)mask;
+
+	return m->valuators[valuator];
+}
+
+#if HAVE_VMASK_UNACCEL
+void
+valuator_mask_set_unaccelerated(ValuatorMask *mask,
+				int valuator,
+				double accel,
+				double unaccel)
+{
+	struct bench_valuator_mask *m = (struct bench_valuator_mask*)mask;
+
+	valuator_mask_set_double(mask, valuator, accel);
+	if (valuator < BENCH_NUM_VALUATORS)
+		m->unaccelerated[valuator] = unaccel;
+}
+#endif
+
+static void
+sink_mask(const ValuatorMask *mask)
+{
+	const struct bench_valuator_mask *m = (const struct bench_valuator_mask*)mask;
+	int i;
+
+	sink.nposted++;
+
+	if (!m)
+		return;
+
+	for (i = 0; i <= m->last_bit; i++) {
+		if (m->mask & (1 << i))
+			sink.checksum += m->valuators[i];
+	}
+}
+
+void
+xf86PostMotionEventM(DeviceIntPtr device, int is_absolute,
+		     const ValuatorMask *mask)
+{
+	sink_mask(mask);
+}
+
+void
+xf86PostProximityEventM(DeviceIntPtr device, int is_in,
+			const ValuatorMask *mask)
+{
+	sink_mask(mask);
+}
+
+void
+xf86PostButtonEvent(DeviceIntPtr device, int is_absolute, int button,
+		    int is_down, int first_valuator, int num_valuators, ...)
+{
+	sink.nposted++;
+	sink.checksum += button;
+}
+
+void
+xf86PostButtonEventP(DeviceIntPtr device, int is_absolute, int button,
+		     int is_down, int first_valuator, int num_valuators,
+		     const int *valuators)
+{
+	sink.nposted++;
+	sink.checksum += button;
+}
+
+void
+xf86PostKeyboardEvent(DeviceIntPtr device, unsigned int key_code,
+		      int is_down)
+{
+	sink.nposted++;
+	sink.checksum += key_code;
+}
+
+void
+xf86PostTouchEvent(DeviceIntPtr dev, uint32_t touchid, uint16_t type,
+		   uint32_t flags, const ValuatorMask *mask)
+{
+	sink_mask(mask);
+	sink.checksum += touchid;
+}
+
+/* libinput, or as much of it as the hot paths need. Events are never
+ * freed, a stream is one array that's replayed as-is. The rest of the
+ * API comes from the real library and is never called.
+ */
+struct libinput {
+	struct libinput_event *events;
+	size_t nevents;
+	size_t next;
+	size_t end;
+	size_t chunk; /* events per libinput_dispatch() */
+};
+
+struct libinput_device {
+	void *user_data;
+	int touch_count;
+};
+
+struct libinput_tablet_tool {
+	int refcount;
+	uint64_t serial;
+	uint64_t tool_id;
+	enum libinput_tablet_tool_type type;
+	bool has_pressure;
+	bool has_tilt;
+	void *user_data;
+};
+
+struct libinput_event {
+	enum libinput_event_type type;
+	struct libinput_device *device;
+	struct libinput_tablet_tool *tool;
+	uint64_t time; /* µs */
+
+	/* deltas, or absolute coordinates normalized to [0, 1] */
+	double x, y;
+	double ux, uy;
+
+	uint32_t code; /* button or key */
+	uint32_t state; /* button, key, tip or proximity state */
+	int32_t slot;
+
+	enum libinput_pointer_axis_source source;
+	uint32_t axes; /* bitmask of libinput_pointer_axis */
+	double value[2];
+	double discrete[2];
+
+	double pressure;
+	double tilt_x, tilt_y;
+};
+
+struct libinput_event_pointer { struct libinput_event base; };
+struct libinput_event_keyboard { struct libinput_event base; };
+struct libinput_event_touch { struct libinput_event base; };
+struct libinput_event_tablet_tool { struct libinput_event base; };
+
+int
+libinput_dispatch(struct libinput *libinput)
+{
+	libinput->end = min(libinput->next + libinput->chunk,
+			    libinput->nevents);
+	return 0;
+}
+
+struct libinput_event *
+libinput_get_event(struct libinput *libinput)
+{
+	if (libinput->next >= libinput->end)
+		return NULL;
+
+	return &libinput->events[libinput->next++];
+}
+
+void
+libinput_event_destroy(struct libinput_event *event)
+{
+}
+
+enum libinput_event_type
+libinput_event_get_type(struct libinput_event *event)
+{
+	return event->type;
+}
+
+struct libinput_device *
+libinput_event_get_device(struct libinput_event *event)
+{
+	return event->device;
+}
+
+void *
+libinput_device_get_user_data(struct libinput_device *device)
+{
+	return device->user_data;
+}
+
+void
+libinput_device_set_user_data(struct libinput_device *device, void *user_data)
+{
+	device->user_data = user_data;
+}
+
+unsigned int
+libinput_device_get_id_vendor(struct libinput_device *device)
+{
+	return 0x56a;
+}
+
+unsigned int
+libinput_device_get_id_product(struct libinput_device *device)
+{
+	return 0x357;
+}
+
+#if HAVE_LIBINPUT_TOUCH_COUNT
+int
+libinput_device_touch_get_touch_count(struct libinput_device *device)
+{
+	return device->touch_count;
+}
+#endif
+
+struct libinput_event_pointer *
+libinput_event_get_pointer_event(struct libinput_event *event)
+{
+	return (struct libinput_event_pointer*)event;
+}
+
+struct libinput_event_keyboard *
+libinput_event_get_keyboard_event(struct libinput_event *event)
+{
+	return (struct libinput_event_keyboard*)event;
+}
+
+struct libinput_event_touch *
+libinput_event_get_touch_event(struct libinput_event *event)
+{
+	return (struct libinput_event_touch*)event;
+}
+
+struct libinput_event_tablet_tool *
+libinput_event_get_tablet_tool_event(struct libinput_event *event)
+{
+	return (struct libinput_event_tablet_tool*)event;
+}
+
+struct libinput_event *
+libinput_event_tablet_tool_get_base_event(struct libinput_event_tablet_tool *event)
+{
+	return &event->base;
+}
+
+uint64_t
+libinput_event_pointer_get_time_usec(struct libinput_event_pointer *event)
+{
+	return event->base.time;
+}
+
+uint64_t
+libinput_event_keyboard_get_time_usec(struct libinput_event_keyboard *event)
+{
+	return event->base.time;
+}
+
+uint64_t
+libinput_event_touch_get_time_usec(struct libinput_event_touch *event)
+{
+	return event->base.time;
+}
+
+uint64_t
+libinput_event_tablet_tool_get_time_usec(struct libinput_event_tablet_tool *event)
+{
+	return event->base.time;
+}
+
+double
+libinput_event_pointer_get_dx(struct libinput_event_pointer *event)
+{
+	return event->base.x;
+}
+
+double
+libinput_event_pointer_get_dy(struct libinput_event_pointer *event)
+{
+	return event->base.y;
+}
+
+double
+libinput_event_pointer_get_dx_unaccelerated(struct libinput_event_pointer *event)
+{
+	return event->base.ux;
+}
+
+double
+libinput_event_pointer_get_dy_unaccelerated(struct libinput_event_pointer *event)
+{
+	return event->base.uy;
+}
+
+double
+libinput_event_pointer_get_absolute_x_transformed(struct libinput_event_pointer *event,
+						  uint32_t width)
+{
+	return event->base.x * width;
+}
+
+double
+libinput_event_pointer_get_absolute_y_transformed(struct libinput_event_pointer *event,
+						  uint32_t height)
+{
+	return event->base.y * height;
+}
+
+uint32_t
+libinput_event_pointer_get_button(struct libinput_event_pointer *event)
+{
+	return event->base.code;
+}
+
+enum libinput_button_state
+libinput_event_pointer_get_button_state(struct libinput_event_pointer *event)
+{
+	return event->base.state;
+}
+
+int
+libinput_event_pointer_has_axis(struct libinput_event_pointer *event,
+				enum libinput_pointer_axis axis)
+{
+	return !!(event->base.axes & (1 << axis));
+}
+
+double
+libinput_event_pointer_get_axis_value(struct libinput_event_pointer *event,
+				      enum libinput_pointer_axis axis)
+{
+	return event->base.value[axis];
+}
+
+double
+libinput_event_pointer_get_axis_value_discrete(struct libinput_event_pointer *event,
+					       enum libinput_pointer_axis axis)
+{
+	return event->base.discrete[axis];
+}
+
+enum libinput_pointer_axis_source
+libinput_event_pointer_get_axis_source(struct libinput_event_pointer *event)
+{
+	return event->base.source;
+}
+
+#if HAVE_LIBINPUT_AXIS_VALUE_V120
+double
+libinput_event_pointer_get_scroll_value(struct libinput_event_pointer *event,
+					enum libinput_pointer_axis axis)
+{
+	return event->base.value[axis];
+}
+
+/* discrete is the v120 value for the scroll events */
+double
+libinput_event_pointer_get_scroll_value_v120(struct libinput_event_pointer *event,
+					     enum libinput_pointer_axis axis)
+{
+	return event->base.discrete[axis];
+}
+#endif
+
+uint32_t
+libinput_event_keyboard_get_key(struct libinput_event_keyboard *event)
+{
+	return event->base.code;
+}
+
+enum libinput_key_state
+libinput_event_keyboard_get_key_state(struct libinput_event_keyboard *event)
+{
+	return event->base.state;
+}
+
+int32_t
+libinput_event_touch_get_slot(struct libinput_event_touch *event)
+{
+	return event->base.slot;
+}
+
+double
+libinput_event_touch_get_x_transformed(struct libinput_event_touch *event,
+				       uint32_t width)
+{
+	return event->base.x * width;
+}
+
+double
+libinput_event_touch_get_y_transformed(struct libinput_event_touch *event,
+				       uint32_t height)
+{
+	return event->base.y * height;
+}
+
+struct libinput_tablet_tool *
+libinput_event_tablet_tool_get_tool(struct libinput_event_tablet_tool *event)
+{
+	return event->base.tool;
+}
+
+double
+libinput_event_tablet_tool_get_x_transformed(struct libinput_event_tablet_tool *event,
+					     uint32_t width)
+{
+	return event->base.x * width;
+}
+
+double
+libinput_event_tablet_tool_get_y_transformed(struct libinput_event_tablet_tool *event,
+					     uint32_t height)
+{
+	return event->base.y * height;
+}
+
+double
+libinput_event_tablet_tool_get_pressure(struct libinput_event_tablet_tool *event)
+{
+	return event->base.pressure;
+}
+
+double
+libinput_event_tablet_tool_get_tilt_x(struct libinput_event_tablet_tool *event)
+{
+	return event->base.tilt_x;
+}
+
+double
+libinput_event_tablet_tool_get_tilt_y(struct libinput_event_tablet_tool *event)
+{
+	return event->base.tilt_y;
+}
+
+double
+libinput_event_tablet_tool_get_slider_position(struct libinput_event_tablet_tool *event)
+{
+	return 0.0;
+}
+
+double
+libinput_event_tablet_tool_get_rotation(struct libinput_event_tablet_tool *event)
+{
+	return 0.0;
+}
+
+enum libinput_tablet_tool_proximity_state
+libinput_event_tablet_tool_get_proximity_state(struct libinput_event_tablet_tool *event)
+{
+	return event->base.state;
+}
+
+enum libinput_tablet_tool_tip_state
+libinput_event_tablet_tool_get_tip_state(struct libinput_event_tablet_tool *event)
+{
+	return event->base.state;
+}
+
+uint32_t
+libinput_event_tablet_tool_get_button(struct libinput_event_tablet_tool *event)
+{
+	return event->base.code;
+}
+
+enum libinput_button_state
+libinput_event_tablet_tool_get_button_state(struct libinput_event_tablet_tool *event)
+{
+	return event->base.state;
+}
+
+uint64_t
+libinput_tablet_tool_get_serial(struct libinput_tablet_tool *tool)
+{
+	return tool->serial;
+}
+
+uint64_t
+libinput_tablet_tool_get_tool_id(struct libinput_tablet_tool *tool)
+{
+	return tool->tool_id;
+}
+
+enum libinput_tablet_tool_type
+libinput_tablet_tool_get_type(struct libinput_tablet_tool *tool)
+{
+	return tool->type;
+}
+
+int
+libinput_tablet_tool_has_pressure(struct libinput_tablet_tool *tool)
+{
+	return tool->has_pressure;
+}
+
+int
+libinput_tablet_tool_has_tilt(struct libinput_tablet_tool *tool)
+{
+	return tool->has_tilt;
+}
+
+int
+libinput_tablet_tool_has_slider(struct libinput_tablet_tool *tool)
+{
+	return 0;
+}
+
+int
+libinput_tablet_tool_has_rotation(struct libinput_tablet_tool *tool)
+{
+	return 0;
+}
+
+void *
+libinput_tablet_tool_get_user_data(struct libinput_tablet_tool *tool)
+{
+	return tool->user_data;
+}
+
+void
+libinput_tablet_tool_set_user_data(struct libinput_tablet_tool *tool,
+				   void *user_data)
+{
+	tool->user_data = user_data;
+}
+
+struct libinput_tablet_tool *
+libinput_tablet_tool_ref(struct libinput_tablet_tool *tool)
+{
+	tool->refcount++;
+	return tool;
+}
+
+struct libinput_tablet_tool *
+libinput_tablet_tool_unref(struct libinput_tablet_tool *tool)
+{
+	tool->refcount--;
+	return tool->refcount > 0 ? tool : NULL;
+}
+
+/* The streams */
+struct stream {
+	struct libinput_event *events;
+	size_t nevents;
+	size_t sz;
+	uint64_t time; /* µs, of the next event */
+};
+
+static struct libinput_device bench_device;
+static struct libinput_tablet_tool bench_tool = {
+	.refcount = 1,
+	.serial = 0x1234,
+	.tool_id = 0x802,
+	.type = LIBINPUT_TABLET_TOOL_TYPE_PEN,
+	.has_pressure = true,
+	.has_tilt = true,
+};
+
+static struct libinput_event *
+stream_append(struct stream *s, enum libinput_event_type type)
+{
+	struct libinput_event *e;
+
+	if (s->nevents == s->sz) {
+		s->sz = s->sz ? s->sz * 2 : 1024;
+		s->events = realloc(s->events, s->sz * sizeof(*s->events));
+		if (!s->events)
+			abort();
+	}
+
+	e = &s->events[s->nevents++];
+	memset(e, 0, sizeof(*e));
+	e->type = type;
+	e->device = &bench_device;
+	e->time = s->time;
+
+	return e;
+}
+
+/* 1 kHz mouse: motion every ms, a click every 250ms and a burst of
+ * wheel clicks every second */
+static void
+stream_mouse(struct stream *s, int ms)
+{
+	struct libinput_event *e;
+	int t;
+
+	for (t = 0; t < ms; t++) {
+		s->time += 1000;
+		e = stream_append(s, LIBINPUT_EVENT_POINTER_MOTION);
+		e->x = 3.0 * sin(t/100.0);
+		e->y = 3.0 * cos(t/100.0);
+		e->ux = e->x/1.5;
+		e->uy = e->y/1.5;
+
+		if (t % 250 == 0 || t % 250 == 80) {
+			e = stream_append(s, LIBINPUT_EVENT_POINTER_BUTTON);
+			e->code = BTN_LEFT;
+			e->state = (t % 250 == 0) ?
+					LIBINPUT_BUTTON_STATE_PRESSED :
+					LIBINPUT_BUTTON_STATE_RELEASED;
+		}
+
+		if (t % 1000 >= 500 && t % 40 == 0 && t % 1000 < 700) {
+			e = stream_append(s, LIBINPUT_EVENT_POINTER_AXIS);
+			e->source = LIBINPUT_POINTER_AXIS_SOURCE_WHEEL;
+			e->axes = 1 << LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL;
+			e->value[LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL] = 15.0;
+			e->discrete[LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL] = 1.0;
+		}
+	}
+}
+
+static void
+touch_frame(struct stream *s, enum libinput_event_type type,
+	    int nfingers, int frame)
+{
+	struct libinput_event *e;
+	int slot;
+
+	s->time += 8000;
+	for (slot = 0; slot < nfingers; slot++) {
+		e = stream_append(s, type);
+		e->slot = slot;
+		e->x = 0.05 + slot * 0.09 + 0.0005 * frame;
+		e->y = 0.2 + 0.002 * frame;
+	}
+
+	stream_append(s, LIBINPUT_EVENT_TOUCH_FRAME);
+}
+
+/* 10 fingers down, moving for 200 frames, all up again */
+static void
+stream_touch(struct stream *s, int ngestures)
+{
+	int g, frame;
+
+	for (g = 0; g < ngestures; g++) {
+		touch_frame(s, LIBINPUT_EVENT_TOUCH_DOWN, 10, 0);
+		for (frame = 1; frame < 200; frame++)
+			touch_frame(s, LIBINPUT_EVENT_TOUCH_MOTION, 10, frame);
+		touch_frame(s, LIBINPUT_EVENT_TOUCH_UP, 10, 200);
+	}
+}
+
+static struct libinput_event *
+tablet_event(struct stream *s, enum libinput_event_type type, int frame)
+{
+	struct libinput_event *e;
+
+	s->time += 5000;
+	e = stream_append(s, type);
+	e->tool = &bench_tool;
+	e->x = 0.3 + 0.001 * frame;
+	e->y = 0.6 - 0.0005 * frame;
+	e->pressure = 0.5 + 0.45 * sin(frame/20.0);
+	e->tilt_x = 30.0 * cos(frame/50.0);
+	e->tilt_y = -20.0 * sin(frame/50.0);
+
+	return e;
+}
+
+/* Pen strokes: proximity in, tip down, 300 axis events, tip up and
+ * proximity out */
+static void
+stream_tablet(struct stream *s, int nstrokes)
+{
+	struct libinput_event *e;
+	int stroke, frame;
+
+	for (stroke = 0; stroke < nstrokes; stroke++) {
+		e = tablet_event(s, LIBINPUT_EVENT_TABLET_TOOL_PROXIMITY, 0);
+		e->state = LIBINPUT_TABLET_TOOL_PROXIMITY_STATE_IN;
+		e = tablet_event(s, LIBINPUT_EVENT_TABLET_TOOL_TIP, 0);
+		e->state = LIBINPUT_TABLET_TOOL_TIP_DOWN;
+		for (frame = 1; frame < 300; frame++)
+			tablet_event(s, LIBINPUT_EVENT_TABLET_TOOL_AXIS, frame);
+		e = tablet_event(s, LIBINPUT_EVENT_TABLET_TOOL_TIP, 300);
+		e->state = LIBINPUT_TABLET_TOOL_TIP_UP;
+		e = tablet_event(s, LIBINPUT_EVENT_TABLET_TOOL_PROXIMITY, 300);
+		e->state = LIBINPUT_TABLET_TOOL_PROXIMITY_STATE_OUT;
+	}
+}
+
+/* The events the bench can fake, anything else in the trace is skipped */
+static bool
+stream_append_record(struct stream *s, const struct trace_record *r)
+{
+	struct libinput_event *e;
+
+	switch (r->type) {
+	case LIBINPUT_EVENT_KEYBOARD_KEY:
+	case LIBINPUT_EVENT_POINTER_MOTION:
+	case LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE:
+	case LIBINPUT_EVENT_POINTER_BUTTON:
+	case LIBINPUT_EVENT_POINTER_AXIS:
+#if HAVE_LIBINPUT_AXIS_VALUE_V120
+	case LIBINPUT_EVENT_POINTER_SCROLL_WHEEL:
+	case LIBINPUT_EVENT_POINTER_SCROLL_FINGER:
+	case LIBINPUT_EVENT_POINTER_SCROLL_CONTINUOUS:
+#endif
+	case LIBINPUT_EVENT_TOUCH_DOWN:
+	case LIBINPUT_EVENT_TOUCH_UP:
+	case LIBINPUT_EVENT_TOUCH_MOTION:
+	case LIBINPUT_EVENT_TOUCH_CANCEL:
+	case LIBINPUT_EVENT_TOUCH_FRAME:
+		break;
+	case LIBINPUT_EVENT_TABLET_TOOL_AXIS:
+	case LIBINPUT_EVENT_TABLET_TOOL_PROXIMITY:
+	case LIBINPUT_EVENT_TABLET_TOOL_TIP:
+	case LIBINPUT_EVENT_TABLET_TOOL_BUTTON:
+		break;
+	default:
+		return false;
+	}
+
+	s->time = r->time;
+	e = stream_append(s, r->type);
+	e->code = r->code;
+	e->state = r->state;
+	e->slot = r->slot;
+	e->x = r->values[0];
+	e->y = r->values[1];
+
+	switch (r->type) {
+	case LIBINPUT_EVENT_POINTER_MOTION:
+		e->ux = r->values[2];
+		e->uy = r->values[3];
+		break;
+	case LIBINPUT_EVENT_POINTER_AXIS:
+#if HAVE_LIBINPUT_AXIS_VALUE_V120
+	case LIBINPUT_EVENT_POINTER_SCROLL_WHEEL:
+	case LIBINPUT_EVENT_POINTER_SCROLL_FINGER:
+	case LIBINPUT_EVENT_POINTER_SCROLL_CONTINUOUS:
+#endif
+		/* for the scroll events the discrete values are v120 */
+		e->x = e->y = 0;
+		e->source = r->state;
+		e->axes = r->axes;
+		e->value[LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL] = r->values[0];
+		e->value[LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL] = r->values[1];
+		e->discrete[LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL] = r->values[2];
+		e->discrete[LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL] = r->values[3];
+		break;
+	case LIBINPUT_EVENT_TABLET_TOOL_AXIS:
+	case LIBINPUT_EVENT_TABLET_TOOL_PROXIMITY:
+	case LIBINPUT_EVENT_TABLET_TOOL_TIP:
+	case LIBINPUT_EVENT_TABLET_TOOL_BUTTON:
+		e->tool = &bench_tool;
+		e->pressure = r->values[2];
+		e->tilt_x = r->values[3];
+		e->tilt_y = r->values[4];
+		break;
+	default:
+		break;
+	}
+
+	return true;
+}
+
+static int
+stream_trace(struct stream *s, const char *path)
+{
+	struct trace trace;
+	size_t i, n, posted = 0, skipped = 0;
+	int rc;
+
+	rc = trace_open_readonly(&trace, path);
+	if (rc != 0) {
+		fprintf(stderr, "Failed to open trace %s: %s\n", path, strerror(-rc));
+		return rc;
+	}
+
+	n = trace_count(&trace);
+	for (i = 0; i < n; i++) {
+		const struct trace_record *r = trace_get(&trace, i);
+
+		/* what the driver posted, the replay posts its own */
+		if (r->type & TRACE_POSTED)
+			posted++;
+		else if (!stream_append_record(s, r))
+			skipped++;
+	}
+
+	printf("%s: %zu records, %zu posted, %zu skipped\n",
+	       path, n, posted, skipped);
+	trace_close(&trace);
+
+	return s->nevents > 0 ? 0 : -ENODATA;
+}
+
+/* Just enough of PreInit/DEVICE_INIT for the event handlers */
+static InputInfoPtr
+bench_device_new(struct xf86libinput_device *shared_device,
+		 uint32_t capabilities)
+{
+	InputInfoPtr pInfo;
+	DeviceIntPtr dev;
+	struct xf86libinput *driver_data;
+
+	pInfo = calloc(1, sizeof(*pInfo));
+	dev = calloc(1, sizeof(*dev));
+	driver_data = calloc(1, sizeof(*driver_data));
+	if (!pInfo || !dev || !driver_data)
+		abort();
+
+	pInfo->name = "bench device";
+	pInfo->fd = -1;
+	pInfo->dev = dev;
+	pInfo->private = driver_data;
+	dev->public.devicePrivate = pInfo;
+	dev->public.on = TRUE;
+
+	driver_data->pInfo = pInfo;
+	driver_data->capabilities = capabilities;
+	driver_data->shared_device = shared_device;
+	driver_data->valuators = valuator_mask_new(6);
+	driver_data->valuators_unaccelerated = valuator_mask_new(2);
+	driver_data->scroll.vdist = 15;
+	driver_data->scroll.hdist = 15;
+	driver_data->options.horiz_scrolling_enabled = TRUE;
+	driver_data->options.tool_queue_size = TOOL_EVENT_QUEUE_SIZE;
+	memcpy(driver_data->options.pressurecurve, bezier_defaults,
+	       sizeof(bezier_defaults));
+
+	xf86libinput_build_button_map(driver_data);
+
+	xorg_list_append(&driver_data->shared_device_link,
+			 &shared_device->device_list);
+	xf86libinput_shared_invalidate_route(shared_device);
+
+	return pInfo;
+}
+
+static void
+bench_device_destroy(InputInfoPtr pInfo)
+{
+	struct xf86libinput *driver_data = pInfo->private;
+
+	xorg_list_del(&driver_data->shared_device_link);
+	xf86libinput_shared_invalidate_route(driver_data->shared_device);
+
+	if (driver_data->tablet_tool)
+		libinput_tablet_tool_unref(driver_data->tablet_tool);
+	valuator_mask_free(&driver_data->valuators);
+	valuator_mask_free(&driver_data->valuators_unaccelerated);
+	xf86OptionListFree(pInfo->options);
+	free(driver_data->touch.slots);
+	free(driver_data->pressurecurve.values);
+	free(driver_data);
+	free(pInfo->dev);
+	free(pInfo);
+}
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+bench_run(const char *name, InputInfoPtr pInfo,
+	  const struct stream *s, size_t chunk, int iterations)
+{
+	struct libinput li = {
+		.events = s->events,
+		.nevents = s->nevents,
+		.chunk = chunk,
+	};
+	struct libinput *old = driver_context.contexts[INPUT_CONTEXT_SHARED].libinput;
+	uint64_t start, elapsed;
+	unsigned long allocs, posted;
+	size_t nevents = s->nevents * iterations;
+	int i;
+
+	driver_context.contexts[INPUT_CONTEXT_SHARED].libinput = &li;
+
+	/* warm up, also builds the routing and axis caches */
+	while (li.next < li.nevents)
+		xf86libinput_read_input(pInfo);
+
+	sink.nposted = 0;
+	allocs = nallocs;
+	start = now_ns();
+
+	for (i = 0; i < iterations; i++) {
+		li.next = 0;
+		while (li.next < li.nevents)
+			xf86libinput_read_input(pInfo);
+	}
+
+	elapsed = now_ns() - start;
+	allocs = nallocs - allocs;
+	posted = sink.nposted;
+
+	driver_context.contexts[INPUT_CONTEXT_SHARED].libinput = old;
+
+	printf("%-24s %9zu events %9lu posted %8.1f ns/event %6.2f allocs/event\n",
+	       name, nevents, posted,
+	       (double)elapsed/nevents,
+	       (double)allocs/nevents);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct xf86libinput_device *shared_device;
+	struct stream mouse = {0}, touch = {0}, tablet = {0};
+	struct bezier_control_point curve[4] = {
+		{ 0.0, 0.0 }, { 0.0, 0.4 }, { 0.6, 1.0 }, { 1.0, 1.0 },
+	};
+	InputInfoPtr pInfo, tool_pInfo;
+	struct xf86libinput *driver_data;
+	int iterations = 100;
+
+	if (argc > 1)
+		iterations = max(atoi(argv[1]), 1);
+
+	xorg_list_init(&driver_context.deferred_devices);
+
+	shared_device = xf86libinput_shared_create(&bench_device);
+	libinput_device_set_user_data(&bench_device, shared_device);
+
+	if (argc > 2) {
+		struct stream trace = {0};
+
+		if (stream_trace(&trace, argv[2]) != 0)
+			return 1;
+
+		/* one event per wakeup, the trace doesn't tell us better */
+		bench_device.touch_count = 10;
+		pInfo = bench_device_new(shared_device,
+					 CAP_KEYBOARD|CAP_POINTER|CAP_TOUCH|CAP_TABLET);
+		xf86libinput_init_touch(pInfo);
+		tool_pInfo = bench_device_new(shared_device, CAP_TABLET_TOOL);
+		driver_data = tool_pInfo->private;
+		driver_data->tablet_tool = libinput_tablet_tool_ref(&bench_tool);
+		xf86libinput_describe_tool(&driver_data->tool_desc,
+					   &bench_device, &bench_tool);
+		bench_run("replay", pInfo, &trace, 1, iterations);
+
+		bench_device_destroy(tool_pInfo);
+		bench_device_destroy(pInfo);
+		xf86libinput_shared_unref(shared_device);
+		free(trace.events);
+		return 0;
+	}
+
+	stream_mouse(&mouse, 10000);
+	stream_touch(&touch, 10);
+	stream_tablet(&tablet, 20);
+
+	/* mouse, the server wakes us up for every few events */
+	pInfo = bench_device_new(shared_device, CAP_POINTER);
+	driver_data = pInfo->private;
+	bench_run("mouse-1khz", pInfo, &mouse, 4, iterations);
+	driver_data->options.motion_batching = TRUE;
+	bench_run("mouse-1khz-batched", pInfo, &mouse, 4, iterations);
+	driver_data->options.motion_batching = FALSE;
+	driver_data->options.raw_motion = TRUE;
+	bench_run("mouse-1khz-raw", pInfo, &mouse, 4, iterations);
+	bench_device_destroy(pInfo);
+
+	/* touchscreen, one frame per wakeup */
+	bench_device.touch_count = 10;
+	pInfo = bench_device_new(shared_device, CAP_POINTER|CAP_TOUCH);
+	xf86libinput_init_touch(pInfo);
+	bench_run("touch-10fg", pInfo, &touch, 11, iterations);
+	bench_device_destroy(pInfo);
+
+	/* tablet with an existing pen subdevice, one event per wakeup */
+	pInfo = bench_device_new(shared_device, CAP_TABLET);
+	tool_pInfo = bench_device_new(shared_device, CAP_TABLET_TOOL);
+	driver_data = tool_pInfo->private;
+	driver_data->tablet_tool = libinput_tablet_tool_ref(&bench_tool);
+	xf86libinput_describe_tool(&driver_data->tool_desc,
+				   &bench_device, &bench_tool);
+	bench_run("tablet-pen", pInfo, &tablet, 1, iterations);
+
+	if (!xf86libinput_set_pressurecurve(driver_data, curve))
+		abort();
+	bench_run("tablet-pen-curve", pInfo, &tablet, 1, iterations);
+
+	free(driver_data->pressurecurve.values);
+	driver_data->pressurecurve.values = NULL;
+	driver_data->pressurecurve.nsegments = 256;
+	driver_data->pressurecurve.sz = 1024;
+	if (!xf86libinput_set_pressurecurve(driver_data, curve))
+		abort();
+	bench_run("tablet-pen-curve-hires", pInfo, &tablet, 1, iterations);
+
+	/* the pen runs at 200Hz, about every other event is merged */
+	tool_pInfo->options = xf86ReplaceIntOption(tool_pInfo->options,
+						   "TabletToolAxisRate", 120);
+	xf86libinput_parse_tool_options(tool_pInfo, driver_data);
+	bench_run("tablet-pen-120hz", pInfo, &tablet, 1, iterations);
+
+	tool_pInfo->options = xf86ReplaceIntOption(tool_pInfo->options,
+						   "TabletToolAxisRate", 0);
+	tool_pInfo->options = xf86ReplaceIntOption(tool_pInfo->options,
+						   "TabletToolPrediction", 8);
+	xf86libinput_parse_tool_options(tool_pInfo, driver_data);
+	bench_run("tablet-pen-predict", pInfo, &tablet, 1, iterations);
+
+	bench_device_destroy(tool_pInfo);
+	bench_device_destroy(pInfo);
+
+	xf86libinput_shared_unref(shared_device);
+	free(mouse.events);
+	free(touch.events);
+	free(tablet.events);
+
+	/* keep the sink alive */
+	return sink.checksum == 12345.6789 ? 1 : 0;
+}
@@ -0,0 +1,452 @@
+/*
+ * Copyright © 2018 Red Hat, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of Red Hat
+ * not be used in advertising or publicity pertaining to distribution
+ * of the software without specific, written prior permission.  Red
+ * Hat makes no representations about the suitability of this software
+ * for any purpose.  It is provided "as is" without express or implied
+ * warranty.
+ *
+ * THE AUTHORS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Fake versions of the server API the driver links against, so the
+ * driver can be built into a standalone binary. These do the least
+ * possible, the event posting and valuator mask API that the hot paths
+ * use is faked in the benchmark itself.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <xorg-server.h>
+#include <exevents.h>
+#include <xkbsrv.h>
+#include <xf86.h>
+#include <xf86Xinput.h>
+#include <xf86_OSproc.h>
+
+ClientPtr serverClient;
+unsigned long serverGeneration = 1;
+
+void
+xf86Msg(MessageType type, const char *format, ...)
+{
+}
+
+void
+xf86IDrvMsg(InputInfoPtr dev, MessageType type, const char *format, ...)
+{
+}
+
+void
+LogVMessageVerb(MessageType type, int verb, const char *format, va_list args)
+{
+}
+
+int
+xf86GetVerbosity(void)
+{
+	return 0;
+}
+
+void
+xf86AddInputDriver(InputDriverPtr driver, void *module, int flags)
+{
+}
+
+InputInfoPtr
+xf86FirstLocalDevice(void)
+{
+	return NULL;
+}
+
+void
+xf86DeleteInput(InputInfoPtr pInp, int flags)
+{
+}
+
+void
+xf86AddEnabledDevice(InputInfoPtr pInfo)
+{
+}
+
+void
+xf86RemoveEnabledDevice(InputInfoPtr pInfo)
+{
+}
+
+#if GET_ABI_MAJOR(ABI_XINPUT_VERSION) < 23
+int
+xf86BlockSIGIO(void)
+{
+	return 0;
+}
+
+void
+xf86UnblockSIGIO(int wasset)
+{
+}
+
+void
+AddEnabledDevice(int fd)
+{
+}
+
+void
+RemoveEnabledDevice(int fd)
+{
+}
+#else
+void
+input_lock(void)
+{
+}
+
+void
+input_unlock(void)
+{
+}
+#endif
+
+int
+xf86OpenSerial(XF86OptionPtr options)
+{
+	return -1;
+}
+
+int
+xf86CloseSerial(int fd)
+{
+	return 0;
+}
+
+void
+xf86FlushInput(int fd)
+{
+}
+
+/* Int options are kept, so the benchmark can set a device up through
+ * its options. Everything else always gets the default */
+struct fake_option {
+	struct fake_option *next;
+	char *name;
+	int value;
+};
+
+static struct fake_option *
+fake_option_find(XF86OptionPtr optlist, const char *name)
+{
+	struct fake_option *opt;
+
+	for (opt = (struct fake_option*)optlist; opt; opt = opt->next) {
+		if (strcasecmp(opt->name, name) == 0)
+			return opt;
+	}
+
+	return NULL;
+}
+
+int
+xf86SetIntOption(XF86OptionPtr optlist, const char *name, int deflt)
+{
+	struct fake_option *opt = fake_option_find(optlist, name);
+
+	return opt ? opt->value : deflt;
+}
+
+double
+xf86SetRealOption(XF86OptionPtr optlist, const char *name, double deflt)
+{
+	return deflt;
+}
+
+char *
+xf86SetStrOption(XF86OptionPtr optlist, const char *name, const char *deflt)
+{
+	return deflt ? strdup(deflt) : NULL;
+}
+
+int
+xf86SetBoolOption(XF86OptionPtr list, const char *name, int deflt)
+{
+	return deflt;
+}
+
+int
+xf86CheckIntOption(XF86OptionPtr optlist, const char *name, int deflt)
+{
+	return xf86SetIntOption(optlist, name, deflt);
+}
+
+char *
+xf86CheckStrOption(XF86OptionPtr optlist, const char *name, const char *deflt)
+{
+	return deflt ? strdup(deflt) : NULL;
+}
+
+int
+xf86CheckBoolOption(XF86OptionPtr list, const char *name, int deflt)
+{
+	return deflt;
+}
+
+XF86OptionPtr
+xf86ReplaceIntOption(XF86OptionPtr optlist, const char *name, const int val)
+{
+	struct fake_option *opt = fake_option_find(optlist, name);
+
+	if (!opt) {
+		opt = calloc(1, sizeof(*opt));
+		if (!opt)
+			abort();
+		opt->name = strdup(name);
+		opt->next = (struct fake_option*)optlist;
+		optlist = (XF86OptionPtr)opt;
+	}
+	opt->value = val;
+
+	return optlist;
+}
+
+XF86OptionPtr
+xf86ReplaceBoolOption(XF86OptionPtr optlist, const char *name, const Bool val)
+{
+	return optlist;
+}
+
+XF86OptionPtr
+xf86ReplaceStrOption(XF86OptionPtr optlist, const char *name, const char *val)
+{
+	return optlist;
+}
+
+XF86OptionPtr
+xf86OptionListDuplicate(XF86OptionPtr list)
+{
+	return NULL;
+}
+
+XF86OptionPtr
+xf86OptionListMerge(XF86OptionPtr head, XF86OptionPtr tail)
+{
+	return head;
+}
+
+void
+xf86OptionListFree(XF86OptionPtr optlist)
+{
+	struct fake_option *opt = (struct fake_option*)optlist;
+
+	while (opt) {
+		struct fake_option *next = opt->next;
+
+		free(opt->name);
+		free(opt);
+		opt = next;
+	}
+}
+
+XF86OptionPtr
+xf86NextOption(XF86OptionPtr list)
+{
+	return NULL;
+}
+
+char *
+xf86OptionName(XF86OptionPtr opt)
+{
+	return NULL;
+}
+
+char *
+xf86OptionValue(XF86OptionPtr opt)
+{
+	return NULL;
+}
+
+int
+xf86NameCmp(const char *s1, const char *s2)
+{
+	return 0;
+}
+
+Bool
+xf86InitValuatorAxisStruct(DeviceIntPtr dev, int axnum, Atom label,
+			   int minval, int maxval, int resolution,
+			   int min_res, int max_res, int mode)
+{
+	return TRUE;
+}
+
+Bool
+SetScrollValuator(DeviceIntPtr dev, int axnum, enum ScrollType type,
+		  double increment, int flags)
+{
+	return TRUE;
+}
+
+int
+GetMotionHistorySize(void)
+{
+	return 0;
+}
+
+Bool
+InitPointerDeviceStruct(DevicePtr device, CARD8 *map, int numButtons,
+			Atom *btn_labels, PtrCtrlProcPtr controlProc,
+			int numMotionEvents, int numAxes, Atom *axes_labels)
+{
+	return TRUE;
+}
+
+Bool
+InitKeyboardDeviceStruct(DeviceIntPtr dev, XkbRMLVOSet *rmlvo,
+			 BellProcPtr bell_func, KbdCtrlProcPtr ctrl_func)
+{
+	return TRUE;
+}
+
+Bool
+InitTouchClassDeviceStruct(DeviceIntPtr device, unsigned int max_touches,
+			   unsigned int mode, unsigned int numAxes)
+{
+	return TRUE;
+}
+
+Bool
+InitProximityClassDeviceStruct(DeviceIntPtr dev)
+{
+	return TRUE;
+}
+
+void
+XkbGetRulesDflts(XkbRMLVOSet *rmlvo)
+{
+	memset(rmlvo, 0, sizeof(*rmlvo));
+}
+
+void
+XkbFreeRMLVOSet(XkbRMLVOSet *rmlvo, Bool freeRMLVO)
+{
+}
+
+Atom
+MakeAtom(const char *string, unsigned int len, Bool makeit)
+{
+	static Atom next_atom = 1;
+
+	return makeit ? next_atom++ : None;
+}
+
+Atom
+XIGetKnownProperty(const char *name)
+{
+	return None;
+}
+
+int
+XIChangeDeviceProperty(DeviceIntPtr dev, Atom property, Atom type,
+		       int format, int mode, unsigned long len,
+		       const void *value, Bool sendevent)
+{
+	return Success;
+}
+
+int
+XIGetDeviceProperty(DeviceIntPtr dev, Atom property,
+		    XIPropertyValuePtr *value)
+{
+	return BadAtom;
+}
+
+int
+XISetDevicePropertyDeletable(DeviceIntPtr dev, Atom property, Bool deletable)
+{
+	return Success;
+}
+
+long
+XIRegisterPropertyHandler(DeviceIntPtr dev,
+			  int (*SetProperty) (DeviceIntPtr dev,
+					      Atom property,
+					      XIPropertyValuePtr prop,
+					      BOOL checkonly),
+			  int (*GetProperty) (DeviceIntPtr dev,
+					      Atom property),
+			  int (*DeleteProperty) (DeviceIntPtr dev,
+						 Atom property))
+{
+	return 0;
+}
+
+OsTimerPtr
+TimerSet(OsTimerPtr timer, int flags, CARD32 millis,
+	 OsTimerCallback func, void *arg)
+{
+	return timer;
+}
+
+void
+TimerFree(OsTimerPtr timer)
+{
+}
+
+Bool
+QueueWorkProc(Bool (*function)(ClientPtr clientUnused, void *closure),
+	      ClientPtr client, void *closure)
+{
+	return FALSE;
+}
+
+int
+NewInputDeviceRequest(InputOption *options, InputAttributes *attrs,
+		      DeviceIntPtr *pdev)
+{
+	return BadImplementation;
+}
+
+void
+DeleteInputDeviceRequest(DeviceIntPtr dev)
+{
+}
+
+InputOption *
+input_option_new(InputOption *list, const char *key, const char *value)
+{
+	return list;
+}
+
+void
+input_option_free_list(InputOption **opt)
+{
+}
+
+InputAttributes *
+DuplicateInputAttributes(InputAttributes *attrs)
+{
+	return NULL;
+}
+
+void
+FreeInputAttributes(InputAttributes *attrs)
+{
+}
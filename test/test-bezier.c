@@ -24,9 +24,12 @@
 #include "bezier.h"
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
 static inline void
 print_curve(int *bezier, size_t size)
 {
@@ -192,6 +195,166 @@ test_nonzero_y_linear(void)
 	}
 }
 
+static void
+test_fixed_linear(void)
+{
+	const int size = 2048;
+	int bezier[size];
+	bool rc;
+
+	struct bezier_control_point controls[] = {
+		{ 0.0, 0.0 },
+		{ 0.0, 0.0 },
+		{ 1.0, 1.0 },
+		{ 1.0, 1.0 }
+	};
+
+	rc = cubic_bezier_fixed(controls, 50, bezier, size);
+	assert(rc);
+
+	for (int x = 0; x < size; x++)
+		assert(bezier[x] == x << BEZIER_FRAC_BITS);
+}
+
+/* Within rounding errors of the low-res curve */
+static void
+test_fixed_matches(void)
+{
+	const int size = 2048;
+	int bezier[size];
+	int fixed[size];
+	bool rc;
+
+	struct bezier_control_point controls[] = {
+		{ 0.0, 0.0 },
+		{ 0.1, 0.4 },
+		{ 0.4, 1.0 },
+		{ 1.0, 1.0 }
+	};
+
+	cubic_bezier(controls, bezier, size);
+	rc = cubic_bezier_fixed(controls, 1024, fixed, size);
+	assert(rc);
+
+	assert(fixed[0] == 0);
+	assert(fixed[size - 1] == (size - 1) << BEZIER_FRAC_BITS);
+
+	for (int x = 0; x < size; x++) {
+		int y = fixed[x] >> BEZIER_FRAC_BITS;
+
+		assert(abs(y - bezier[x]) <= 8);
+		if (x > 0)
+			assert(fixed[x] >= fixed[x - 1]);
+	}
+}
+
+static void
+test_fixed_sizes(void)
+{
+	struct bezier_control_point controls[] = {
+		{ 0.0, 0.0 },
+		{ 0.1, 0.0 },
+		{ 1.0, 0.9 },
+		{ 1.0, 1.0 }
+	};
+	const size_t sizes[] = { 2, 3, 64, 2048, 8192 };
+	const size_t segments[] = { 1, 7, 50, 64, 65, 4096 };
+
+	for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+		for (size_t j = 0; j < ARRAY_SIZE(segments); j++) {
+			size_t size = sizes[i];
+			int *bezier = calloc(size, sizeof(*bezier));
+			bool rc;
+
+			assert(bezier);
+
+			rc = cubic_bezier_fixed(controls, segments[j], bezier, size);
+			assert(rc);
+
+			assert(bezier[0] == 0);
+			assert(bezier[size - 1] == (int)(size - 1) << BEZIER_FRAC_BITS);
+			for (size_t x = 1; x < size; x++)
+				assert(bezier[x] >= bezier[x - 1]);
+
+			free(bezier);
+		}
+	}
+}
+
+static void
+test_fixed_nonzero_x(void)
+{
+	const int size = 2048;
+	int bezier[size];
+	int x;
+
+	struct bezier_control_point controls[] = {
+		{ 0.2, 0.0 },
+		{ 0.2, 0.0 },
+		{ 0.8, 1.0 },
+		{ 0.8, 1.0 }
+	};
+
+	cubic_bezier_fixed(controls, 256, bezier, size);
+
+	for (x = 0; x <= (size - 1) * 0.2; x++)
+		assert(bezier[x] == 0);
+
+	for (; x < (size - 1) * 0.8; x++)
+		assert(bezier[x] > bezier[x-1]);
+
+	for (x = (size - 1) * 0.8 + 1; x < size; x++)
+		assert(bezier[x] == (size - 1) << BEZIER_FRAC_BITS);
+}
+
+static void
+test_fixed_invalid(void)
+{
+	int bezier[64];
+
+	struct bezier_control_point controls[] = {
+		{ 0.0, 0.0 },
+		{ 0.6, 0.0 },
+		{ 0.4, 1.0 },
+		{ 1.0, 1.0 }
+	};
+	struct bezier_control_point out_of_range[] = {
+		{ 0.0, 0.0 },
+		{ 0.0, 0.0 },
+		{ 1.0, 1.1 },
+		{ 1.0, 1.0 }
+	};
+
+	assert(!cubic_bezier_fixed(controls, 50, bezier, ARRAY_SIZE(bezier)));
+	assert(!cubic_bezier_fixed(out_of_range, 50, bezier, ARRAY_SIZE(bezier)));
+	assert(!cubic_bezier_fixed(bezier_defaults, 0, bezier, ARRAY_SIZE(bezier)));
+	assert(!cubic_bezier_fixed(bezier_defaults, 50, bezier, 1));
+}
+
+static void
+test_interpolate(void)
+{
+	const int size = 64;
+	const int one = 1 << BEZIER_FRAC_BITS;
+	int bezier[size];
+
+	for (int x = 0; x < size; x++)
+		bezier[x] = x * x * one;
+
+	assert(bezier_interpolate(bezier, size, -1) == 0);
+	assert(bezier_interpolate(bezier, size, 0) == 0);
+	assert(bezier_interpolate(bezier, size, (size - 1) * one) == bezier[size - 1]);
+	assert(bezier_interpolate(bezier, size, size * one) == bezier[size - 1]);
+
+	for (int x = 0; x < size - 1; x++) {
+		assert(bezier_interpolate(bezier, size, x * one) == bezier[x]);
+		assert(bezier_interpolate(bezier, size, x * one + one/2) ==
+		       (bezier[x] + bezier[x + 1])/2);
+		assert(bezier_interpolate(bezier, size, x * one + one/4) ==
+		       bezier[x] + (bezier[x + 1] - bezier[x])/4);
+	}
+}
+
 int
 main(int argc, char **argv)
 {
@@ -202,5 +365,12 @@ main(int argc, char **argv)
 	test_nonzero_x_linear();
 	test_nonzero_y_linear();
 
+	test_fixed_linear();
+	test_fixed_matches();
+	test_fixed_sizes();
+	test_fixed_nonzero_x();
+	test_fixed_invalid();
+	test_interpolate();
+
 	return 0;
 }
@@ -182,6 +182,11 @@ test_set_meta(void)
 	rc = draglock_set_meta(&dl, -1);
 	assert(rc == 1);
 	rc = draglock_set_meta(&dl, 32);
+	assert(rc == 0);
+	assert(dl.mode == DRAGLOCK_META);
+	rc = draglock_set_meta(&dl, DRAGLOCK_MAX_BUTTONS - 1);
+	assert(rc == 0);
+	rc = draglock_set_meta(&dl, DRAGLOCK_MAX_BUTTONS);
 	assert(rc == 1);
 }
 
@@ -222,6 +227,34 @@ test_set_pairs(void)
 	assert(dl.mode == DRAGLOCK_PAIRS);
 }
 
+static void
+test_set_pairs_high_buttons(void)
+{
+	struct draglock dl;
+	int rc;
+	int map[DRAGLOCK_MAX_BUTTONS + 1];
+
+	draglock_init_from_string(&dl, "");
+	memset(map, 0, sizeof(map));
+
+	map[100] = 120;
+	rc = draglock_set_pairs(&dl, map, DRAGLOCK_MAX_BUTTONS);
+	assert(rc == 0);
+	assert(dl.mode == DRAGLOCK_PAIRS);
+
+	map[100] = DRAGLOCK_MAX_BUTTONS;
+	rc = draglock_set_pairs(&dl, map, DRAGLOCK_MAX_BUTTONS);
+	assert(rc == 1);
+
+	/* trailing zeroes are fine, a pair beyond the limit isn't */
+	map[100] = 120;
+	rc = draglock_set_pairs(&dl, map, DRAGLOCK_MAX_BUTTONS + 1);
+	assert(rc == 0);
+	map[DRAGLOCK_MAX_BUTTONS] = 1;
+	rc = draglock_set_pairs(&dl, map, DRAGLOCK_MAX_BUTTONS + 1);
+	assert(rc == 1);
+}
+
 static void
 test_filter_meta_passthrough(void)
 {
@@ -515,6 +548,90 @@ test_filter_pairs(void)
 	}
 }
 
+static void
+test_filter_high_buttons(void)
+{
+	struct draglock dl;
+	int rc;
+	int button, press;
+
+	rc = draglock_init_from_string(&dl, "100 120 33 64");
+	assert(rc == 0);
+	assert(dl.mode == DRAGLOCK_PAIRS);
+
+	/* press/release locks 100 as 120 */
+	button = 100;
+	press = 1;
+	rc = draglock_filter_button(&dl, &button, &press);
+	assert(button == 120);
+	assert(press == 1);
+	button = 100;
+	press = 0;
+	rc = draglock_filter_button(&dl, &button, &press);
+	assert(button == 0);
+
+	/* 33 in a different word is unaffected */
+	button = 33;
+	press = 1;
+	rc = draglock_filter_button(&dl, &button, &press);
+	assert(button == 64);
+	button = 33;
+	press = 0;
+	rc = draglock_filter_button(&dl, &button, &press);
+	assert(button == 0);
+
+	/* unpaired buttons pass through */
+	button = 101;
+	press = 1;
+	rc = draglock_filter_button(&dl, &button, &press);
+	assert(button == 101);
+	assert(press == 1);
+
+	/* press/release unlocks */
+	button = 100;
+	press = 1;
+	rc = draglock_filter_button(&dl, &button, &press);
+	assert(button == 0);
+	button = 100;
+	press = 0;
+	rc = draglock_filter_button(&dl, &button, &press);
+	assert(button == 120);
+	assert(press == 0);
+
+	rc = draglock_init_from_string(&dl, "90");
+	assert(rc == 0);
+	assert(dl.mode == DRAGLOCK_META);
+
+	button = 90;
+	press = 1;
+	rc = draglock_filter_button(&dl, &button, &press);
+	assert(button == 0);
+	button = 90;
+	press = 0;
+	rc = draglock_filter_button(&dl, &button, &press);
+	assert(button == 0);
+
+	button = 127;
+	press = 1;
+	rc = draglock_filter_button(&dl, &button, &press);
+	assert(button == 127);
+	assert(press == 1);
+	button = 127;
+	press = 0;
+	rc = draglock_filter_button(&dl, &button, &press);
+	assert(button == 0);
+
+	button = 127;
+	press = 1;
+	rc = draglock_filter_button(&dl, &button, &press);
+	assert(button == 0);
+	button = 127;
+	press = 0;
+	rc = draglock_filter_button(&dl, &button, &press);
+	assert(button == 127);
+	assert(press == 0);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -527,6 +644,7 @@ main(int argc, char **argv)
 	test_config_get();
 	test_set_meta();
 	test_set_pairs();
+	test_set_pairs_high_buttons();
 
 	test_filter_meta_passthrough();
 	test_filter_meta_click_meta_only();
@@ -535,6 +653,7 @@ main(int argc, char **argv)
 	test_filter_meta_interleaved();
 
 	test_filter_pairs();
+	test_filter_high_buttons();
 
 	return 0;
 }
@@ -0,0 +1,174 @@
+/*
+ * Copyright © 2018 Red Hat, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of Red Hat
+ * not be used in advertising or publicity pertaining to distribution
+ * of the software without specific, written prior permission.  Red
+ * Hat makes no representations about the suitability of this software
+ * for any purpose.  It is provided "as is" without express or implied
+ * warranty.
+ *
+ * THE AUTHORS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "tool-registry.h"
+
+#include <assert.h>
+#include <string.h>
+
+static FILE *
+file_with(const char *contents)
+{
+	FILE *fp = tmpfile();
+
+	assert(fp);
+	fputs(contents, fp);
+	rewind(fp);
+
+	return fp;
+}
+
+static void
+test_load(void)
+{
+	struct tool_registry registry;
+	struct tool_registry_entry *e;
+	FILE *fp;
+
+	fp = file_with("# comment\n"
+		       "056a:0357 1a2b3c 802 2 3\n"
+		       "056a:0357 1a2b3c 80a 3 1\n"
+		       "256c:006e 0 0 2 1\n");
+	assert(tool_registry_load(&registry, fp) == 3);
+	fclose(fp);
+
+	e = tool_registry_find(&registry, 0x56a, 0x357, 0x1a2b3c, 0x802);
+	assert(e);
+	assert(e->type == 2);
+	assert(e->axes == 3);
+
+	e = tool_registry_find(&registry, 0x56a, 0x357, 0x1a2b3c, 0x80a);
+	assert(e);
+	assert(e->type == 3);
+
+	e = tool_registry_find(&registry, 0x256c, 0x6e, 0, 0);
+	assert(e);
+	assert(e->axes == 1);
+
+	assert(tool_registry_find(&registry, 0x56a, 0x358, 0x1a2b3c, 0x802) == NULL);
+}
+
+static void
+test_load_invalid(void)
+{
+	struct tool_registry registry;
+	FILE *fp;
+
+	fp = file_with("056a:0357 1a2b3c 802 2\n"
+		       "056a 0357 1a2b3c 802 2 3\n"
+		       "056a:0357 1a2b3c 802 2 3 x\n"
+		       "garbage\n"
+		       "\n");
+	assert(tool_registry_load(&registry, fp) == 0);
+	fclose(fp);
+}
+
+static void
+test_duplicates(void)
+{
+	struct tool_registry registry;
+	FILE *fp;
+
+	/* last one wins */
+	fp = file_with("056a:0357 1a 802 2 1\n"
+		       "056a:0357 1a 802 2 3\n");
+	assert(tool_registry_load(&registry, fp) == 1);
+	fclose(fp);
+	assert(registry.entries[0].axes == 3);
+}
+
+static void
+test_add_remove(void)
+{
+	struct tool_registry registry = {0};
+	struct tool_registry_entry e = {
+		.vendor = 0x56a,
+		.product = 0x357,
+		.type = 2,
+	};
+	size_t i;
+
+	for (i = 0; i < TOOL_REGISTRY_MAX; i++) {
+		e.serial = i;
+		assert(tool_registry_add(&registry, &e));
+	}
+
+	e.serial = TOOL_REGISTRY_MAX;
+	assert(!tool_registry_add(&registry, &e));
+
+	/* replacing works when full */
+	e.serial = 3;
+	e.axes = TOOL_AXIS_TILT;
+	assert(tool_registry_add(&registry, &e));
+	assert(registry.nentries == TOOL_REGISTRY_MAX);
+
+	tool_registry_remove(&registry,
+			     tool_registry_find(&registry, 0x56a, 0x357, 0, 0));
+	assert(registry.nentries == TOOL_REGISTRY_MAX - 1);
+	assert(tool_registry_find(&registry, 0x56a, 0x357, 0, 0) == NULL);
+	assert(tool_registry_find(&registry, 0x56a, 0x357, 3, 0)->axes == TOOL_AXIS_TILT);
+	assert(registry.entries[0].serial == 1);
+}
+
+static void
+test_save(void)
+{
+	struct tool_registry registry = {0}, loaded;
+	struct tool_registry_entry e = {
+		.vendor = 0x56a,
+		.product = 0x357,
+		.serial = 0xfffffffff,
+		.tool_id = 0x802,
+		.type = 2,
+		.axes = TOOL_AXIS_PRESSURE|TOOL_AXIS_TILT,
+	};
+	FILE *fp;
+
+	assert(tool_registry_add(&registry, &e));
+	e.tool_id = 0x80a;
+	e.axes = TOOL_AXIS_PRESSURE;
+	assert(tool_registry_add(&registry, &e));
+
+	fp = tmpfile();
+	assert(fp);
+	assert(tool_registry_save(&registry, fp) == 0);
+	rewind(fp);
+	assert(tool_registry_load(&loaded, fp) == 2);
+	fclose(fp);
+
+	assert(memcmp(&loaded.entries, &registry.entries,
+		      2 * sizeof(registry.entries[0])) == 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	test_load();
+	test_load_invalid();
+	test_duplicates();
+	test_add_remove();
+	test_save();
+
+	return 0;
+}
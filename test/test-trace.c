@@ -0,0 +1,162 @@
+/*
+ * Copyright © 2018 Red Hat, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of Red Hat
+ * not be used in advertising or publicity pertaining to distribution
+ * of the software without specific, written prior permission.  Red
+ * Hat makes no representations about the suitability of this software
+ * for any purpose.  It is provided "as is" without express or implied
+ * warranty.
+ *
+ * THE AUTHORS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "trace.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void
+make_path(char *path, size_t sz)
+{
+	int fd;
+
+	snprintf(path, sz, "/tmp/test-trace.XXXXXX");
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+}
+
+static void
+test_write_read(void)
+{
+	struct trace trace;
+	char path[64];
+	int rc;
+	int i;
+
+	make_path(path, sizeof(path));
+
+	rc = trace_open(&trace, path, 16);
+	assert(rc == 0);
+	assert(trace_count(&trace) == 0);
+
+	for (i = 0; i < 10; i++) {
+		struct trace_record *r = trace_next(&trace);
+
+		r->time = i;
+		r->type = 100 + i;
+		r->values[0] = i/10.0;
+		trace_commit(&trace);
+	}
+	assert(trace_count(&trace) == 10);
+	trace_close(&trace);
+
+	rc = trace_open_readonly(&trace, path);
+	assert(rc == 0);
+	assert(trace_count(&trace) == 10);
+	for (i = 0; i < 10; i++) {
+		const struct trace_record *r = trace_get(&trace, i);
+
+		assert(r->time == i);
+		assert(r->type == 100 + i);
+		assert(r->values[0] == i/10.0);
+	}
+	trace_close(&trace);
+
+	unlink(path);
+}
+
+static void
+test_wrap(void)
+{
+	struct trace trace;
+	char path[64];
+	int rc;
+	int i;
+
+	make_path(path, sizeof(path));
+
+	rc = trace_open(&trace, path, 8);
+	assert(rc == 0);
+
+	for (i = 0; i < 21; i++) {
+		trace_next(&trace)->time = i;
+		trace_commit(&trace);
+	}
+
+	/* only the newest 7 are left, oldest first, the 8th slot is
+	 * the one written next */
+	assert(trace_count(&trace) == 7);
+	for (i = 0; i < 7; i++)
+		assert(trace_get(&trace, i)->time == 14 + i);
+	trace_close(&trace);
+
+	rc = trace_open_readonly(&trace, path);
+	assert(rc == 0);
+	assert(trace_count(&trace) == 7);
+	assert(trace_get(&trace, 0)->time == 14);
+	assert(trace_get(&trace, 6)->time == 20);
+	trace_close(&trace);
+
+	unlink(path);
+}
+
+static void
+test_invalid(void)
+{
+	struct trace trace = {0};
+	char path[64];
+	FILE *fp;
+	int rc;
+
+	rc = trace_open(&trace, "/tmp/test-trace-nonexistent/trace", 8);
+	assert(rc == -ENOENT);
+
+	make_path(path, sizeof(path));
+
+	rc = trace_open(&trace, path, 0);
+	assert(rc == -EINVAL);
+	rc = trace_open(&trace, path, 1);
+	assert(rc == -EINVAL);
+
+	/* empty file */
+	rc = trace_open_readonly(&trace, path);
+	assert(rc == -EINVAL);
+
+	/* not a trace */
+	fp = fopen(path, "w");
+	assert(fp);
+	for (rc = 0; rc < 256; rc++)
+		fputc('x', fp);
+	fclose(fp);
+	rc = trace_open_readonly(&trace, path);
+	assert(rc == -EINVAL);
+	assert(trace.header == NULL);
+
+	unlink(path);
+}
+
+int
+main(int argc, char **argv)
+{
+	test_write_read();
+	test_wrap();
+	test_invalid();
+
+	return 0;
+}